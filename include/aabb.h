@@ -3,6 +3,9 @@
 
 #include <array>
 #include <algorithm>
+#include <cassert>
+#include <limits>
+#include <optional>
 
 #include "ray.h"
 
@@ -18,8 +21,47 @@ static inline std::optional<std::array<float,2>> Overlap(float x0, float x1, flo
 class AABB {
 
 public:
+    /// @brief Constructs an empty box, which contains nothing and is the identity for Extend()
+    constexpr AABB()
+        : min{Vec3(std::numeric_limits<float>::max())}, max{Vec3(std::numeric_limits<float>::lowest())} {}
+
+    //Note a box may be flat in some dimension (e.g. around an axis-aligned triangle)
     constexpr AABB(const Vec3& vmin, const Vec3& vmax)
-        : min{vmin}, max{vmax} { for(int i =0;i<2;++i) {assert(min[i] < max[i]);}}
+        : min{vmin}, max{vmax} { for(int i =0;i<3;++i) {assert(!(min[i] > max[i]));}}
+
+    /// @brief Grows the box to enclose another box
+    constexpr void Extend(const AABB& other) {
+        for(int i = 0; i < 3; ++i) {
+            min[i] = std::min(min[i], other.min[i]);
+            max[i] = std::max(max[i], other.max[i]);
+        }
+    }
+
+    /// @brief Grows the box to enclose a point
+    constexpr void Extend(const Point3& p) {
+        for(int i = 0; i < 3; ++i) {
+            min[i] = std::min(min[i], p[i]);
+            max[i] = std::max(max[i], p[i]);
+        }
+    }
+
+    [[nodiscard]] constexpr bool IsEmpty() const noexcept {return min.X() > max.X() || min.Y() > max.Y() || min.Z() > max.Z();}
+
+    [[nodiscard]] constexpr Point3 Centroid() const noexcept {return 0.5f * (min + max);}
+
+    /// @brief Returns the surface area of the box, or 0 if it is empty
+    [[nodiscard]] constexpr float SurfaceArea() const noexcept {
+        if(IsEmpty()) return 0.f;
+        const auto d{max - min};
+        return 2.f * (d.X()*d.Y() + d.Y()*d.Z() + d.Z()*d.X());
+    }
+
+    /// @brief Returns the axis (0=x, 1=y, 2=z) along which the box is longest
+    [[nodiscard]] constexpr int MaxExtentAxis() const noexcept {
+        const auto d{max - min};
+        if(d.X() > d.Y() && d.X() > d.Z()) return 0;
+        return d.Y() > d.Z() ? 1 : 2;
+    }
 
     [[nodiscard]] bool Intersects(const Ray& ray, float t_low, float t_high) const {
 
@@ -65,22 +107,30 @@ public:
         return true;
     }
 
+    /// @brief Slab test against a ray whose reciprocal direction has been precomputed.
+    /// @brief Unlike Intersects(), this only reports hits with t in [t_low,t_high], so a traversal can cull boxes beyond its closest hit.
+    /// @param dir_is_neg For each axis, whether the ray direction is negative (so the ray meets the max plane first)
+    [[nodiscard]] bool Intersects(const Point3& origin, const Vec3& inv_dir, const std::array<int,3>& dir_is_neg, float t_low, float t_high) const {
+        for(int i = 0; i < 3; ++i) {
+            const auto t_near{((dir_is_neg[i] ? max : min)[i] - origin[i]) * inv_dir[i]};
+            const auto t_far {((dir_is_neg[i] ? min : max)[i] - origin[i]) * inv_dir[i]};
+            //Written so that a NaN (ray in the plane of a slab) leaves the interval unchanged
+            t_low = t_near > t_low ? t_near : t_low;
+            t_high = t_far < t_high ? t_far : t_high;
+            if(t_low > t_high) return false;
+        }
+        return true;
+    }
+
 public:
     Vec3 min;
     Vec3 max;
 };
 
 [[nodiscard]] inline AABB SurroundingBox(const AABB& bb1, const AABB& bb2) {
-
-        Vec3 min( std::min(bb1.min.X(),bb2.min.X()),
-                std::min(bb1.min.Y(),bb2.min.Y()),
-                std::min(bb1.min.Z(),bb2.min.Z()));
-
-        Vec3 max( std::max(bb1.max.X(),bb2.max.X()),
-                std::max(bb1.max.Y(),bb2.max.Y()),
-                std::max(bb1.max.Z(),bb2.max.Z()));
-    
-        return AABB(min,max);
+        auto box{bb1};
+        box.Extend(bb2);
+        return box;
     };
 
 
@@ -0,0 +1,37 @@
+#ifndef ACCEL_H
+#define ACCEL_H
+
+#include <memory>
+#include <optional>
+#include <string_view>
+
+#include "bvh_build.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+class ThreadPool;
+
+/// @brief The acceleration structures a scene can be traced with. LINEAR is the default; the wide BVHs are opt-in, and on the
+/// @brief benchmark scenes are not reliably faster than it: fewer, wider box tests mostly trade against SIMD overhead.
+enum class AccelType 
+{
+    BVH_NODE, //binary tree of Hittables
+    LINEAR,   //flattened binary BVH
+    BVH4,     //4-wide, SSE box tests
+    BVH8      //8-wide, AVX box tests
+};
+
+/// @brief Most primitives in a leaf of the accelerators BuildAccelerator() makes over a scene's objects
+inline constexpr int kAccelLeafSize{4};
+
+/// @brief Parses "bvhnode", "linear", "bvh4" or "bvh8"
+std::optional<AccelType> ParseAccelType(std::string_view name);
+
+std::string_view AccelName(AccelType type);
+
+/// @brief Builds an acceleration structure of the given type over the objects in a list
+/// @param pool If not null, the build is spread over the pool's workers
+/// @param stats If not null, receives the time spent in each build phase
+std::unique_ptr<Hittable> BuildAccelerator(AccelType type, const HittableList& world, ThreadPool* pool = nullptr, BVHBuildStats* stats = nullptr);
+
+#endif
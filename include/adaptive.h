@@ -0,0 +1,96 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+
+#include "vec3.h"
+
+/// @brief Per-pixel adaptive sampling. Instead of a fixed samples_per_pixel, each pixel takes samples until the estimated
+/// @brief relative error of its mean drops to max_error, but always at least min_samples and at most max_samples.
+/// @brief Flat regions such as the sky stop at min_samples, and what they save goes to glass edges and highlights.
+struct AdaptiveSettings
+{
+    bool enabled{false};
+    int min_samples{8};
+    int max_samples{64};
+    float max_error{0.05f}; //standard error of the mean luminance, relative to the mean
+};
+
+/// @brief Running mean of a pixel's samples, and the variance of their luminance (Welford's algorithm).
+class PixelEstimate
+{
+public:
+    void Add(const Color& sample) noexcept
+    {
+        ++m_count;
+        m_sum += sample;
+        const auto y{Luminance(sample)};
+        const auto delta{y - m_mean};
+        m_mean += delta / static_cast<float>(m_count);
+        m_m2 += delta * (y - m_mean);
+    }
+
+    [[nodiscard]] int Count() const noexcept {return m_count;}
+
+    [[nodiscard]] Color Mean() const noexcept {return m_count > 0 ? m_sum * (1.f / static_cast<float>(m_count)) : Color{0.f};}
+
+    /// @brief Standard error of the mean luminance over the mean luminance. Dark pixels are measured against a floor
+    /// @brief instead, so that noise which would be invisible after tone mapping does not keep them sampling forever.
+    [[nodiscard]] float RelativeError() const noexcept
+    {
+        if(m_count < 2) return std::numeric_limits<float>::infinity();
+        const auto variance{m_m2 / static_cast<float>(m_count - 1)};
+        return std::sqrt(variance / static_cast<float>(m_count)) / std::max(m_mean, kDarkLuminance);
+    }
+
+    [[nodiscard]] bool Converged(const AdaptiveSettings& settings) const noexcept
+    {
+        return m_count >= settings.max_samples || (m_count >= settings.min_samples && RelativeError() <= settings.max_error);
+    }
+
+private:
+    static constexpr float kDarkLuminance{0.05f};
+
+    static constexpr float Luminance(const Color& c) noexcept {return 0.2126f*c.X() + 0.7152f*c.Y() + 0.0722f*c.Z();}
+
+    int m_count{0};
+    Color m_sum{0.f};
+    float m_mean{0.f};
+    float m_m2{0.f};
+};
+
+/// @brief Decides which pixels of a width x height grid take another sample: those that have not converged, and their four
+/// @brief neighbours. A pixel on an edge can look converged by luck, when its first samples all land on the same side, 
+/// @brief but it is unlikely that its neighbours are all that lucky too. Pixels at max_samples are done regardless.
+/// @return Whether any pixel is still active
+inline bool UpdateActive(std::span<const PixelEstimate> estimates, int width, int height, const AdaptiveSettings& settings, 
+                         std::span<std::uint8_t> active)
+{
+    assert(estimates.size() == static_cast<std::size_t>(width) * height && active.size() == estimates.size());
+    std::fill(active.begin(), active.end(), std::uint8_t{0});
+    for(int y = 0; y < height; ++y) {
+        for(int x = 0; x < width; ++x) {
+            const auto p{static_cast<std::size_t>(y) * width + x};
+            if(estimates[p].Converged(settings)) continue;
+            active[p] = 1;
+            if(x > 0) active[p - 1] = 1;
+            if(x + 1 < width) active[p + 1] = 1;
+            if(y > 0) active[p - width] = 1;
+            if(y + 1 < height) active[p + width] = 1;
+        }
+    }
+
+    bool any_active{false};
+    for(std::size_t p = 0; p < active.size(); ++p) {
+        active[p] = active[p] && estimates[p].Count() < settings.max_samples;
+        any_active = any_active || active[p];
+    }
+    return any_active;
+}
+
+#endif
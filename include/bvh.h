@@ -1,59 +1,48 @@
 #ifndef BVH_H
 #define BVH_H
 
+#include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <iostream>
+#include <vector>
 #include "aabb.h"
+#include "bvh_build.h"
 #include "hittable.h"
 #include "hittable_list.h"
 #include "ray.h"
 
 
+/// @brief A binary BVH in which every node is a Hittable.
+/// @brief The tree is built with the binned SAH builder, with one primitive per leaf: the children of a node are
+/// @brief either other BVHNodes or the primitives themselves.
 class BVHNode : public Hittable {
 public:
 
-    BVHNode(const std::vector<std::shared_ptr<Hittable>>& list, int low, int high)
-        : box(Vec3(0.f,0.f,0.f),Vec3(1.f,1.f,1.f)) 
+    /// @param options Build options. The leaf size is always 1.
+    explicit BVHNode(const HittableList& h, BVHBuildOptions options = {}) 
     {
-           
-        assert(!(list.empty()));
-        auto obj = list;
+        const auto& objects = h.m_objects;
+        assert(!(objects.empty()));
+        options.max_prims_in_leaf = 1;
 
-        //#0 Base cases
-        if(low + 1 ==high) {
-            left = list[low];
-            right = nullptr;
-        }
+        //Precompute bounds and centroids once, so the builder never needs to call back into the primitives
+        auto prims = ComputePrimitiveInfo(objects, options);
+        const auto nodes = BuildBVH(prims, options);
 
-        else if(low+2==high) {
-            left = std::min(obj[low],obj[low+1], [](auto&& h1, auto&& h2) {return h1->BoundingBox().min.X() < h2->BoundingBox().min.X();});
-            right = std::max(obj[low],obj[low+1], [](auto&& h1, auto&& h2) {return h2->BoundingBox().min.X() > h2->BoundingBox().min.X();});
+        const auto start{std::chrono::steady_clock::now()};
+        //A single primitive produces a root leaf
+        if(nodes[0].IsLeaf()) {
+            left = objects[prims[nodes[0].first_prim].index];
+            box = nodes[0].bounds;
         }
-
         else {
-            //#1 sort along some random axis
-            std::sort(obj.begin() + low , obj.begin() + high, [](auto&& h1, auto&& h2) {
-                return h2->BoundingBox().min.X() < h1->BoundingBox().min.X();
-            });
-
-            //#2 Split
-            const int mid = low + (high - low)/2;
-            left = std::make_shared<BVHNode>(obj,low,mid);
-            right = std::make_shared<BVHNode>(obj,mid,high);
+            Init(nodes, 0, prims, objects);
         }
-        
-        //Note that both children shouldnt be null since the input is not empty
-        if(!left) box = right->BoundingBox();
-        if(!right) box = left->BoundingBox();
-        else box = SurroundingBox(left->BoundingBox(), right->BoundingBox());
-
+        if(options.stats) {options.stats->finalize_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();}
     }
 
-
-    explicit BVHNode(const HittableList& h) 
-        : BVHNode(h.m_objects, 0, h.m_objects.size())
-        {}
-
     //Recursively traverse the tree
     [[nodiscard]] std::optional<HitData> Hit(const Ray& ray, float t_low, float t_high) const override {
         //If the ray doesnt intersect the enclosing volume at this node, then it will not hit any primitives in the subtree. Return early.
@@ -69,7 +58,39 @@ public:
         //TODO 
     }
 
+    [[nodiscard]] bool Occluded(const Ray& ray, float t_low, float t_high) const override {
+        if(!box.Intersects(ray,t_low,t_high)) return false;
+        return (left && left->Occluded(ray,t_low,t_high)) || (right && right->Occluded(ray,t_low,t_high));
+    }
+
     [[nodiscard]] AABB BoundingBox() const override {return box;}
+
+private:
+    BVHNode() = default;
+
+    /// @brief Sets this node up from the interior build node at nodes[index]
+    void Init(const std::vector<BVHBuildNode>& nodes, int index, 
+              const std::vector<BVHPrimitiveInfo>& prims, const std::vector<std::shared_ptr<Hittable>>& objects) 
+    {
+        assert(!nodes[index].IsLeaf());
+        box = nodes[index].bounds;
+        left = MakeChild(nodes, index + 1, prims, objects);
+        right = MakeChild(nodes, nodes[index].right_child, prims, objects);
+    }
+
+    /// @brief Leaves hold exactly one primitive, which becomes the child directly
+    static std::shared_ptr<Hittable> MakeChild(const std::vector<BVHBuildNode>& nodes, int index, 
+                                               const std::vector<BVHPrimitiveInfo>& prims, const std::vector<std::shared_ptr<Hittable>>& objects) 
+    {
+        if(nodes[index].IsLeaf()) {
+            assert(nodes[index].prim_count == 1);
+            return objects[prims[nodes[index].first_prim].index];
+        }
+        auto child = std::shared_ptr<BVHNode>(new BVHNode());
+        child->Init(nodes, index, prims, objects);
+        return child;
+    }
+
 private:
     AABB box; //AABB that encloses all primitives in the subtree 
     std::shared_ptr<Hittable> left;
@@ -0,0 +1,83 @@
+#ifndef BVH_BUILD_H
+#define BVH_BUILD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <vector>
+
+#include "aabb.h"
+#include "hittable.h"
+
+class ThreadPool;
+
+/// @brief What the builder needs to know about a primitive. 
+/// @brief Bounds and centroids are computed once up front so that the build never calls back into the primitives.
+struct BVHPrimitiveInfo
+{
+    AABB bounds;
+    Point3 centroid;
+    std::uint32_t index; //index of the primitive in the caller's array
+};
+
+/// @brief A node of a built BVH.
+/// @brief Nodes are stored depth-first: the left child of an interior node is always the next node in the array.
+struct BVHBuildNode
+{
+    AABB bounds;
+    int right_child{-1}; //interior nodes only
+    int first_prim{0};   //leaves only: offset of the first primitive in the (reordered) primitive array
+    int prim_count{0};   //0 for interior nodes
+    int split_axis{0};   //interior nodes only: axis the children were partitioned along
+
+    [[nodiscard]] constexpr bool IsLeaf() const noexcept {return prim_count > 0;}
+};
+
+/// @brief Wall-clock time spent in each phase of building an acceleration structure, in milliseconds.
+struct BVHBuildStats
+{
+    double info_ms{0.0};     //computing primitive bounds and centroids
+    double top_ms{0.0};      //splitting the top of the tree into independent subtrees (parallel builds only)
+    double subtree_ms{0.0};  //building the subtrees (for a serial build, the whole tree)
+    double stitch_ms{0.0};   //joining the subtrees into one depth-first array (parallel builds only)
+    double finalize_ms{0.0}; //converting the built tree into the structure's own layout
+    int subtree_tasks{0};
+    std::size_t node_count{0};
+
+    [[nodiscard]] double TotalMs() const noexcept {return info_ms + top_ms + subtree_ms + stitch_ms + finalize_ms;}
+};
+
+std::ostream& operator<<(std::ostream& out, const BVHBuildStats& stats);
+
+/// @brief Tuning parameters for the SAH builder.
+struct BVHBuildOptions
+{
+    int max_prims_in_leaf{1};
+    int num_bins{16};            //candidate split planes per axis is num_bins-1
+    float traversal_cost{1.f};   //cost of visiting an interior node, relative to intersecting one primitive
+    ThreadPool* pool{nullptr};   //if set, large builds are spread over the pool's workers
+    BVHBuildStats* stats{nullptr}; //if set, receives the time spent in each phase
+};
+
+/// @brief The deepest BuildBVH() goes: no node has more than kMaxBVHDepth ancestors. Traversals rely on it to size their
+/// @brief stacks, since a path from the root passes at most kMaxBVHDepth interior nodes.
+inline constexpr int kMaxBVHDepth{64};
+
+/// @brief Bump whenever a change to BuildBVH() changes the trees it builds, so that scene caches holding old ones are rebuilt
+inline constexpr std::uint32_t kBVHBuilderVersion{1};
+
+/// @brief Computes bounds and centroids for every object, on the pool if the options have one.
+std::vector<BVHPrimitiveInfo> ComputePrimitiveInfo(const std::vector<std::shared_ptr<Hittable>>& objects, const BVHBuildOptions& options);
+
+/// @brief Builds a BVH over the primitives with a binned Surface Area Heuristic.
+/// @brief The primitive array is partitioned in place, so on return each leaf's primitives are the contiguous 
+/// @brief range [first_prim, first_prim + prim_count) of prims. No other per-primitive memory is allocated.
+/// @brief With a thread pool, the top of the tree is split (with parallel binning) into independent subtrees, 
+/// @brief which are then built concurrently and stitched together. The result has the same layout either way.
+/// @brief Where SAH splits could take the tree past kMaxBVHDepth, e.g. over many coincident primitives, ranges are halved
+/// @brief by count instead, which reaches single primitives in the levels that are left.
+/// @return The nodes in depth-first order, with the root at index 0. Empty if prims is empty.
+std::vector<BVHBuildNode> BuildBVH(std::vector<BVHPrimitiveInfo>& prims, const BVHBuildOptions& options = {});
+
+#endif
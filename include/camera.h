@@ -1,8 +1,13 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include <algorithm>
+#include <cassert>
 #include <numbers>
+#include <span>
+
 #include "ray.h"
+#include "ray_packet.h"
 
 class Vec3;
 class Ray;
@@ -43,6 +48,37 @@ public:
         return Ray(m_position, lower_left_corner + u*m_horizontal + v*m_vertical - m_position);
     }
 
+    /// @brief Generates a packet of rays through the viewport coordinates (us[i], vs[i]).
+    /// @brief Each ray is exactly the one GetRay() returns for the same coordinates. The frustum is built from the rectangle 
+    /// @brief in (u,v) that bounds all the samples, so it is tight when they come from a compact block of pixels.
+    [[nodiscard]] RayPacket GetRayPacket(std::span<const float> us, std::span<const float> vs) const {
+        assert(us.size() == vs.size() && us.size() <= static_cast<std::size_t>(RayPacket::kSize));
+        RayPacket packet;
+        packet.origin = m_position;
+        packet.count = static_cast<int>(us.size());
+
+        auto u_min{us.empty() ? 0.f : us[0]}, u_max{u_min};
+        auto v_min{vs.empty() ? 0.f : vs[0]}, v_max{v_min};
+        for(std::size_t i = 0; i < us.size(); ++i) {
+            const auto dir{lower_left_corner + us[i]*m_horizontal + vs[i]*m_vertical - m_position};
+            packet.dir_x[i] = dir.X();
+            packet.dir_y[i] = dir.Y();
+            packet.dir_z[i] = dir.Z();
+            u_min = std::min(u_min, us[i]); u_max = std::max(u_max, us[i]);
+            v_min = std::min(v_min, vs[i]); v_max = std::max(v_max, vs[i]);
+        }
+
+        //Each side plane contains two adjacent corner rays. Orient it so that the centre ray is on the inside.
+        const auto corner = [&](float u, float v) {return lower_left_corner + u*m_horizontal + v*m_vertical - m_position;};
+        const std::array corners{corner(u_min, v_min), corner(u_max, v_min), corner(u_max, v_max), corner(u_min, v_max)};
+        const auto centre{corner(0.5f*(u_min + u_max), 0.5f*(v_min + v_max))};
+        for(int i = 0; i < 4; ++i) {
+            const auto n{Cross(corners[i], corners[(i+1) % 4])};
+            packet.frustum[i] = Dot(n, centre) < 0.f ? -n : n;
+        }
+        return packet;
+    }
+
 };
 
 #endif
\ No newline at end of file
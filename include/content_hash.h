@@ -0,0 +1,74 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <type_traits>
+
+/// @brief A 64-bit hash of a sequence of byte strings, for telling whether the inputs to something have changed.
+/// @brief It is not cryptographic. Each Add() also hashes its length, so Add("ab") then Add("c") differs from Add("abc").
+/// @brief Four independent lanes of 8 bytes each keep the multiplies in flight, so a large file hashes at several GB/s.
+class ContentHash
+{
+public:
+    void Add(std::span<const std::byte> bytes) noexcept
+    {
+        auto lanes{m_lanes};
+        const auto* data = bytes.data();
+        auto size{bytes.size()};
+        for(; size >= 32; data += 32, size -= 32) {
+            for(std::size_t l = 0; l < lanes.size(); ++l) {lanes[l] = Round(lanes[l], Load(data + 8 * l));}
+        }
+        for(std::size_t l = 0; size >= 8; data += 8, size -= 8, ++l) {lanes[l] = Round(lanes[l], Load(data));}
+
+        std::uint64_t tail{0};
+        if(size > 0) {std::memcpy(&tail, data, size);}
+        lanes[0] = Round(lanes[0], tail);
+        lanes[1] = Round(lanes[1], bytes.size());
+        m_lanes = lanes;
+    }
+
+    void Add(std::string_view text) noexcept {Add(std::as_bytes(std::span{text.data(), text.size()}));}
+
+    template<typename T>
+    requires std::is_trivially_copyable_v<T>
+    void AddValue(const T& value) noexcept {Add(std::as_bytes(std::span{&value, 1}));}
+
+    [[nodiscard]] std::uint64_t Value() const noexcept
+    {
+        std::uint64_t h{0};
+        for(const auto lane : m_lanes) {h = Finalize(h ^ lane);}
+        return h;
+    }
+
+private:
+    static std::uint64_t Load(const std::byte* p) noexcept
+    {
+        std::uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        return word;
+    }
+
+    static constexpr std::uint64_t Round(std::uint64_t lane, std::uint64_t word) noexcept
+    {
+        lane += word * 0xc2b2ae3d27d4eb4full;
+        return std::rotl(lane, 31) * 0x9e3779b97f4a7c15ull;
+    }
+
+    /// @brief The splitmix64 finaliser, so that every input bit affects every output bit
+    static constexpr std::uint64_t Finalize(std::uint64_t h) noexcept
+    {
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+        return h ^ (h >> 31);
+    }
+
+    std::array<std::uint64_t, 4> m_lanes{0x243f6a8885a308d3ull, 0x13198a2e03707344ull, 0xa4093822299f31d0ull, 0x082efa98ec4e6c89ull};
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "vec3.h"
+
+/// @brief An in-memory image of linear float colors.
+/// @brief Pixels are stored row-major with row 0 at the TOP of the image (i.e. in file order).
+/// @brief Tracing only ever writes linear radiance here; conversion to a file format happens once, when the image is written.
+class Framebuffer
+{
+public:
+    Framebuffer(int width, int height)
+        : m_width{width}, m_height{height}, m_pixels(static_cast<std::size_t>(width) * height, Color{0.f}) 
+        { assert(width > 0 && height > 0); }
+
+    [[nodiscard]] int Width() const noexcept {return m_width;}
+    [[nodiscard]] int Height() const noexcept {return m_height;}
+
+    [[nodiscard]] Color& At(int x, int y) { assert(x>=0 && x<m_width && y>=0 && y<m_height); return m_pixels[static_cast<std::size_t>(y) * m_width + x];}
+    [[nodiscard]] const Color& At(int x, int y) const { assert(x>=0 && x<m_width && y>=0 && y<m_height); return m_pixels[static_cast<std::size_t>(y) * m_width + x];}
+
+    [[nodiscard]] const std::vector<Color>& Pixels() const noexcept {return m_pixels;}
+
+    /// @brief The pixels as Width() * Height() consecutive RGB triples of floats
+    [[nodiscard]] float* Data() noexcept 
+    {
+        static_assert(sizeof(Color) == 3 * sizeof(float), "Color must be three packed floats");
+        return reinterpret_cast<float*>(m_pixels.data());
+    }
+
+    /// @brief Writes the image as a binary 8-bit PPM (P6), gamma corrected with a gamma of 2.
+    /// @return False if the file could not be written.
+    [[nodiscard]] bool WriteP6(const std::string& path) const;
+
+    /// @brief Writes the image as a little-endian Portable Float Map, with linear (not gamma corrected) values.
+    /// @return False if the file could not be written.
+    [[nodiscard]] bool WritePFM(const std::string& path) const;
+
+private:
+    int m_width;
+    int m_height;
+    std::vector<Color> m_pixels;
+};
+
+#endif
@@ -3,12 +3,16 @@
 
 #include "aabb.h"
 #include "ray.h"
+#include "ray_packet.h"
 
+#include <bit>
+#include <cstdint>
 #include <memory>
 #include <optional>
+#include <span>
 #include <utility>
 
-class Material;
+#include "material.h"
 
 /// @brief Stores information from a ray-object intersection that is needed for shading
 struct HitData
@@ -16,7 +20,7 @@ struct HitData
     float hit_param; //ray parameter at intersection
     Point3 hit_point; //point of intersection
     Norm3 hit_normal; //OUTWARDS normal at intersection
-    std::shared_ptr<Material> mat_ptr; //material
+    MaterialID mat_id; //index into the scene's MaterialTable
 };
 
 /// @brief Interface for anything that a ray can intersect 
@@ -28,6 +32,24 @@ public:
     /// @brief Optionally returns data at an intersection
     virtual std::optional<HitData> Hit(const Ray& ray, float t_low, float t_high) const = 0; 
 
+    /// @brief Returns whether the ray hits anything with t in [t_low,t_high], e.g. for shadow rays.
+    /// @brief Unlike Hit(), implementations may stop at the first intersection they find, and should not build a HitData.
+    virtual bool Occluded(const Ray& ray, float t_low, float t_high) const { return Hit(ray, t_low, t_high).has_value(); }
+
+    /// @brief For each ray of the packet whose bit is set in active, finds the closest hit in [t_low, t_max[i]].
+    /// @brief A hit lowers t_max[i] and is written to hits[i]; for rays that hit nothing both are left untouched.
+    /// @brief The default traces the rays one at a time. Accelerators override it to trace the packet together.
+    virtual void HitPacket(const RayPacket& packet, std::uint64_t active, float t_low, std::span<float> t_max, std::span<std::optional<HitData>> hits) const {
+        while(active) {
+            const auto i{std::countr_zero(active)};
+            active &= active - 1;
+            if(auto hit = Hit(packet.GetRay(i), t_low, t_max[i]); hit) {
+                t_max[i] = hit->hit_param;
+                hits[i] = std::move(hit);
+            }
+        }
+    }
+
     virtual AABB BoundingBox() const = 0;
 };
 
@@ -40,15 +40,18 @@ public:
         return data;
     }
     
-    [[nodiscard]] AABB BoundingBox() const override {
-
-
-        auto aabb = AABB{Vec3(std::numeric_limits<float>::max()),
-                         Vec3(std::numeric_limits<float>::lowest())};
+    /// @brief Returns true as soon as any object in the list blocks the ray
+    [[nodiscard]] bool Occluded(const Ray& ray, float t_low, float t_high) const override {
+        for(const auto& object : m_objects) {
+            if(object->Occluded(ray, t_low, t_high)) return true;
+        }
+        return false;
+    }
 
+    [[nodiscard]] AABB BoundingBox() const override {
+        AABB aabb;
         for(const auto& primitive : m_objects) {
-
-            aabb = SurroundingBox(primitive->BoundingBox(),aabb);
+            aabb.Extend(primitive->BoundingBox());
         }
         return aabb;
     }
@@ -0,0 +1,198 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "aabb.h"
+#include "bvh_build.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "ray.h"
+#include "ray_packet.h"
+
+/// @brief A BVH node in a flat, depth-first array. Two nodes fit in one cache line.
+/// @brief The left child of an interior node is the next node in the array, so only the right child's index is stored.
+struct LinearBVHNode
+{
+    AABB bounds;
+    std::int32_t offset;      //leaves: index of the first primitive; interior nodes: index of the right child
+    std::uint16_t prim_count; //0 for interior nodes
+    std::uint8_t axis;        //interior nodes: axis the children were split along
+    std::uint8_t pad;
+};
+static_assert(sizeof(LinearBVHNode) == 32);
+
+/// @brief Converts the output of BuildBVH() to linear nodes. 
+/// @brief The build nodes are already depth-first, so this is a one-to-one copy.
+std::vector<LinearBVHNode> FlattenBVH(const std::vector<BVHBuildNode>& nodes);
+
+/// @brief Walks a linear BVH with an explicit stack, visiting the nearer child first (by the sign of the ray direction).
+/// @param intersect_leaf Called as intersect_leaf(first_prim, prim_count, t_high) for each leaf the ray reaches. It should 
+/// @param intersect_leaf return true if it found a hit, and lower t_high to that hit, which then culls any node further away.
+/// @tparam kAnyHit If true, traversal stops at the first leaf that reports a hit.
+/// @return True if any leaf reported a hit.
+template<bool kAnyHit = false, typename LeafFn>
+bool TraverseLinearBVH(std::span<const LinearBVHNode> nodes, const Ray& ray, float t_low, float t_high, LeafFn&& intersect_leaf)
+{
+    if(nodes.empty()) return false;
+
+    const auto origin{ray.Origin()};
+    const auto dir{ray.Direction()};
+    const auto inv_dir = Vec3{1.f/dir.X(), 1.f/dir.Y(), 1.f/dir.Z()};
+    const std::array<int,3> dir_is_neg{inv_dir.X() < 0.f, inv_dir.Y() < 0.f, inv_dir.Z() < 0.f};
+
+    //Nodes still to visit: at most one per interior node on the path from the root, see kMaxBVHDepth
+    std::array<std::int32_t, kMaxBVHDepth> stack;
+    int stack_size{0};
+    std::int32_t current{0};
+    bool hit{false};
+
+    while(true)
+    {
+        const auto& node = nodes[current];
+        if(node.bounds.Intersects(origin, inv_dir, dir_is_neg, t_low, t_high))
+        {
+            if(node.prim_count > 0) {
+                if(intersect_leaf(node.offset, static_cast<int>(node.prim_count), t_high)) {
+                    hit = true;
+                    if constexpr(kAnyHit) {return true;}
+                }
+            }
+            else {
+                //Descend into the near child and come back for the far one
+                assert(stack_size < static_cast<int>(stack.size()));
+                if(dir_is_neg[node.axis]) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if(stack_size == 0) break;
+        current = stack[--stack_size];
+    }
+    return hit;
+}
+
+/// @brief Ray data shared by every box test of one packet traversal
+struct PacketRays
+{
+    std::array<float,3> origin;
+    alignas(32) std::array<float, RayPacket::kSize> inv_x;
+    alignas(32) std::array<float, RayPacket::kSize> inv_y;
+    alignas(32) std::array<float, RayPacket::kSize> inv_z;
+};
+
+PacketRays MakePacketRays(const RayPacket& packet);
+
+/// @brief Returns the subset of candidates (a bitmask of rays) that hit the box within [t_low, t_max[i]]
+std::uint64_t IntersectPacket(const AABB& box, const PacketRays& rays, std::uint64_t candidates, float t_low, std::span<const float> t_max);
+
+/// @brief Returns false if the box lies entirely outside the packet's frustum, in which case no ray of the packet can hit it
+bool FrustumOverlaps(const RayPacket& packet, const AABB& box);
+
+/// @brief Walks a linear BVH with a whole packet of rays. A node is entered if any active ray hits it. To decide that cheaply,
+/// @brief the ray that entered the last node is tested first; only if it misses is the node culled against the packet's 
+/// @brief frustum, and only if that fails to rule it out are the remaining rays tested, 8 at a time.
+/// @param intersect_leaf Called as intersect_leaf(first_prim, prim_count, rays), where rays is the bitmask of active rays 
+/// @param intersect_leaf that hit the leaf. It should lower t_max for each ray it finds a hit for.
+template<typename LeafFn>
+void TraverseLinearBVHPacket(std::span<const LinearBVHNode> nodes, const RayPacket& packet, std::uint64_t active, float t_low, 
+                             std::span<float> t_max, LeafFn&& intersect_leaf)
+{
+    if(nodes.empty() || active == 0) return;
+    const auto rays{MakePacketRays(packet)};
+
+    //Tests a single ray, to find out quickly whether a node is worth entering
+    const auto ray_hits = [&](int i, const AABB& box) {
+        const auto inv_dir = Vec3{rays.inv_x[i], rays.inv_y[i], rays.inv_z[i]};
+        const std::array<int,3> dir_is_neg{inv_dir.X() < 0.f, inv_dir.Y() < 0.f, inv_dir.Z() < 0.f};
+        return box.Intersects(packet.origin, inv_dir, dir_is_neg, t_low, t_max[i]);
+    };
+
+    std::array<std::int32_t, kMaxBVHDepth> stack;
+    int stack_size{0};
+    std::int32_t current{0};
+    int first{std::countr_zero(active)};
+
+    while(true)
+    {
+        const auto& node = nodes[current];
+        std::uint64_t hit_rays{0};
+        bool enter{ray_hits(first, node.bounds)};
+        if(!enter && FrustumOverlaps(packet, node.bounds)) {
+            hit_rays = IntersectPacket(node.bounds, rays, active, t_low, t_max);
+            enter = hit_rays != 0;
+            if(enter) {first = std::countr_zero(hit_rays);}
+        }
+
+        if(enter)
+        {
+            if(node.prim_count > 0) {
+                if(hit_rays == 0) {hit_rays = IntersectPacket(node.bounds, rays, active, t_low, t_max);}
+                intersect_leaf(node.offset, static_cast<int>(node.prim_count), hit_rays);
+            }
+            else {
+                //Order the children for the ray that got us here: the rays of a packet mostly share direction signs
+                assert(stack_size < static_cast<int>(stack.size()));
+                const std::array first_dir{packet.dir_x[first], packet.dir_y[first], packet.dir_z[first]};
+                if(first_dir[node.axis] < 0.f) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if(stack_size == 0) break;
+        current = stack[--stack_size];
+    }
+}
+
+/// @brief A BVH over arbitrary Hittables, stored as a flat array of nodes.
+/// @brief Primitives are kept in leaf order so that each leaf's primitives are adjacent.
+class LinearBVH : public Hittable
+{
+public:
+    explicit LinearBVH(const HittableList& h, const BVHBuildOptions& options = BVHBuildOptions{.max_prims_in_leaf = 4});
+
+    /// @brief Restores a BVH from the Primitives() and Nodes() of one built earlier, without building anything
+    /// @param owner Keeps the memory behind nodes alive for as long as the BVH exists
+    LinearBVH(std::vector<std::shared_ptr<Hittable>> primitives, std::span<const LinearBVHNode> nodes, std::shared_ptr<const void> owner);
+
+    [[nodiscard]] std::optional<HitData> Hit(const Ray& ray, float t_low, float t_high) const override;
+
+    [[nodiscard]] bool Occluded(const Ray& ray, float t_low, float t_high) const override;
+
+    void HitPacket(const RayPacket& packet, std::uint64_t active, float t_low, std::span<float> t_max, std::span<std::optional<HitData>> hits) const override;
+
+    [[nodiscard]] AABB BoundingBox() const override {return m_nodes.empty() ? AABB{} : m_nodes[0].bounds;}
+
+    [[nodiscard]] std::size_t NodeCount() const noexcept {return m_nodes.size();}
+
+    /// @brief The primitives in leaf order
+    [[nodiscard]] const std::vector<std::shared_ptr<Hittable>>& Primitives() const noexcept {return m_primitives;}
+
+    [[nodiscard]] std::span<const LinearBVHNode> Nodes() const noexcept {return m_nodes;}
+
+private:
+    std::vector<std::shared_ptr<Hittable>> m_primitives;
+    std::span<const LinearBVHNode> m_nodes;
+    std::shared_ptr<const void> m_owner; //the memory behind m_nodes
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+
+/// @brief A whole file mapped read-only into memory. Pages are read in as they are first touched, and are shared with
+/// @brief every other process mapping the same file through the page cache.
+/// @brief Held by shared_ptr, so that objects whose data points into the mapping can keep it alive as their owner.
+class MappedFile
+{
+public:
+    /// @return Null if the file cannot be opened or mapped. An empty file maps to no bytes
+    static std::shared_ptr<const MappedFile> Open(const std::string& path);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    [[nodiscard]] std::span<const std::byte> Bytes() const noexcept {return {m_data, m_size};}
+
+    [[nodiscard]] std::size_t Size() const noexcept {return m_size;}
+
+private:
+    MappedFile(const std::byte* data, std::size_t size) noexcept
+        : m_data{data}, m_size{size} {}
+
+    const std::byte* m_data;
+    std::size_t m_size;
+};
+
+#endif
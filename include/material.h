@@ -1,6 +1,13 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
 #include "vec3.h"
 
 class Material
@@ -21,6 +28,51 @@ public:
     Color Kd; //diffuse component
     Color Ks; //specular component
     float specular_exponent; //used in blinn-phong illumination for specular component
+
+    friend bool operator==(const Material&, const Material&) = default;
+};
+
+/// @brief Index of a material in a MaterialTable. Primitives store this instead of owning a pointer, 
+/// @brief so reporting a hit copies 4 bytes rather than touching a shared reference count.
+using MaterialID = std::uint32_t;
+
+/// @brief Owns every material in a scene, in one contiguous array.
+/// @brief Adding a material that is equal to one already in the table returns the existing ID.
+class MaterialTable
+{
+public:
+    MaterialID Add(const Material& material)
+    {
+        if(const auto it = m_ids.find(material); it != m_ids.end()) {return it->second;}
+        const auto id{static_cast<MaterialID>(m_materials.size())};
+        m_materials.push_back(material);
+        m_ids.emplace(material, id);
+        return id;
+    }
+
+    [[nodiscard]] const Material& operator[](MaterialID id) const 
+    {
+        assert(id < m_materials.size());
+        return m_materials[id];
+    }
+
+    [[nodiscard]] std::size_t Size() const noexcept {return m_materials.size();}
+
+private:
+    struct MaterialHash
+    {
+        std::size_t operator()(const Material& m) const noexcept 
+        {
+            auto seed{std::hash<int>{}(static_cast<int>(m.m_type))};
+            const auto combine = [&seed](float f) {seed ^= std::hash<float>{}(f) + 0x9e3779b9 + (seed << 6) + (seed >> 2);};
+            for(int i = 0; i < 3; ++i) {combine(m.Kd[i]); combine(m.Ks[i]);}
+            combine(m.specular_exponent);
+            return seed;
+        }
+    };
+
+    std::vector<Material> m_materials;
+    std::unordered_map<Material, MaterialID, MaterialHash> m_ids;
 };
 
 #endif
\ No newline at end of file
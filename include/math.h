@@ -17,13 +17,14 @@
 inline std::optional<std::pair<float,float>> SolveQuadratic(float a, float b, float c) {
     const auto discr{b*b - 4.f*a*c};
     if(discr < 0.f) return std::nullopt;
-    if(discr == 0) {
+    if(discr == 0.f) {
         auto r{-0.5f*b/a}; 
         return std::make_pair(r,r);
     }
-    auto q = (b > 0) ?
-            -0.5 * (b + sqrt(discr)) :
-            -0.5 * (b - sqrt(discr));
+    //Keep this in float: a double literal or ::sqrt here would promote the whole expression to double
+    const auto q = (b > 0.f) ?
+            -0.5f * (b + std::sqrt(discr)) :
+            -0.5f * (b - std::sqrt(discr));
     
         auto x0{q / a};
         auto x1{c / q};
@@ -0,0 +1,21 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <optional>
+#include <string>
+
+#include "triangle_mesh.h"
+
+class ThreadPool;
+
+/// @brief Reads the geometry of a Wavefront OBJ file into one indexed mesh: its vertices ("v"), and its faces ("f") split
+/// @brief into fans of triangles. Texture coordinates, groups and materials are ignored.
+/// @brief The file is mapped rather than read, and parsed in two passes over one range of lines per worker: the first counts
+/// @brief what each range holds, so that the second can parse straight into its place in the final arrays.
+/// @brief OBJ indexes normals separately from positions, which MeshBuffers cannot; normals ("vn") are kept only if every
+/// @brief face corner uses the normal with the same index as its position, as exporters that write one per vertex do.
+/// @param pool If not null, the file is parsed on its workers
+/// @param error Set to a description of the problem, with its line number, if the file cannot be loaded
+std::optional<MeshBuffers> LoadOBJ(const std::string& path, ThreadPool* pool, std::string& error);
+
+#endif
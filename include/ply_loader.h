@@ -0,0 +1,30 @@
+#ifndef PLY_LOADER_H
+#define PLY_LOADER_H
+
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "triangle_mesh.h"
+
+class ThreadPool;
+
+/// @brief Mesh data whose arrays may point straight into the file it was read from. Owner keeps them alive.
+struct LoadedMesh
+{
+    MeshView view;
+    std::shared_ptr<const void> owner;
+};
+
+/// @brief Reads the vertex positions (and normals, if every vertex has nx, ny and nz) and faces of a binary little-endian
+/// @brief PLY file into one indexed mesh. Faces are split into fans of triangles; other elements and properties are skipped.
+/// @brief The file is mapped rather than read. If the vertices hold nothing but float x, y and z, and start a multiple of
+/// @brief 4 bytes into the file (writers can pad a comment in the header to arrange this), the positions are used where
+/// @brief they lie in the mapping and cost no memory of their own. Otherwise they are converted on the pool.
+/// @brief Face records interleave each vertex count with its indices, so indices are always converted: on the pool if
+/// @brief every face is a triangle with no other properties, as in most scanned meshes, and in one pass otherwise.
+/// @param pool If not null, conversions are spread over its workers
+/// @param error Set to a description of the problem if the file cannot be loaded
+std::optional<LoadedMesh> LoadPLY(const std::string& path, ThreadPool* pool, std::string& error);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef PRUNE_H
+#define PRUNE_H
+
+#include <cstdint>
+
+#include "rng.h"
+
+/// @brief Where a ray sits in the tree of rays traced for one sample of one pixel.
+/// @brief Nodes are numbered like a binary heap: 1 for the primary ray, then 2n and 2n+1 for the reflected and refracted rays
+/// @brief spawned at node n. Heap numbers stay below 2^63, so from the 63rd level down a child is numbered by hashing its
+/// @brief parent's number with which child it is instead, and marked by the top bit. The throughput is the product of the weights on the way down,
+/// @brief i.e. how much the ray's color counts towards the pixel.
+struct PathNode
+{
+    std::uint32_t pixel{0};
+    std::uint32_t sample{0};
+    std::uint64_t node{1};
+    float throughput{1.f};
+
+    [[nodiscard]] PathNode Child(std::uint32_t which, float weight) const noexcept 
+    {
+        constexpr auto kHashed{std::uint64_t{1} << 63}; //set on every hashed number and on no heap number, so the two never collide
+        const auto child{node < (kHashed >> 1) ? 2*node + which : RNG::Mix(node ^ which) | kHashed};
+        return PathNode{pixel, sample, child, throughput*weight};
+    }
+};
+
+/// @brief When to stop tracing mirror and glass rays that carry too little light to matter.
+struct PruneSettings
+{
+    float threshold{0.01f};      //rays with a lower throughput are pruned; 0 turns pruning off
+    bool russian_roulette{true}; //if false, all of them are dropped, which darkens deep reflections
+};
+
+/// @brief Applies PruneSettings to the rays traced by one thread, and counts the rays it prunes.
+/// @brief With Russian roulette a ray below the threshold survives with probability throughput/threshold and is then
+/// @brief weighted up by the inverse, so the expected color is unchanged. The draw is keyed on the ray's PathNode, so the
+/// @brief outcome does not depend on the order in which rays are traced.
+class Pruner
+{
+public:
+    explicit Pruner(const PruneSettings& settings)
+        : m_settings{settings} {}
+
+    /// @brief Returns the factor to weight a ray by: 1 if it is kept as is, 0 if it is pruned.
+    [[nodiscard]] float Survival(const PathNode& ray)
+    {
+        if(ray.throughput >= m_settings.threshold) return 1.f;
+        if(m_settings.russian_roulette) {
+            const auto p{ray.throughput / m_settings.threshold};
+            RNG rng(ray.pixel, ray.sample, ray.node);
+            if(rng.GenerateFloat(0.f,1.f) < p) return 1.f / p;
+        }
+        ++m_pruned;
+        return 0.f;
+    }
+
+    [[nodiscard]] std::uint64_t Pruned() const noexcept {return m_pruned;}
+
+private:
+    PruneSettings m_settings;
+    std::uint64_t m_pruned{0};
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include <array>
+#include <cstdint>
+
+#include "ray.h"
+#include "vec3.h"
+
+/// @brief Up to 64 rays from a common origin, e.g. one camera sample for each pixel of an 8x8 block, traced together.
+/// @brief Directions are stored SoA. The packet also carries a frustum (four planes through the origin) that contains
+/// @brief every ray, so a traversal can discard a node that lies outside it without testing the rays one by one.
+struct RayPacket
+{
+    static constexpr int kWidth{8};
+    static constexpr int kSize{kWidth * kWidth};
+
+    Point3 origin;
+    alignas(32) std::array<float, kSize> dir_x;
+    alignas(32) std::array<float, kSize> dir_y;
+    alignas(32) std::array<float, kSize> dir_z;
+    int count{0};
+
+    /// @brief Inward plane normals: p is inside the frustum iff Dot(n, p - origin) >= 0 for all four.
+    /// @brief A zero normal (e.g. for a packet of one ray) accepts everything.
+    std::array<Vec3, 4> frustum;
+
+    [[nodiscard]] Ray GetRay(int i) const {return Ray(origin, Vec3{dir_x[i], dir_y[i], dir_z[i]});}
+
+    /// @brief Bitmask with a bit set for each ray in the packet
+    [[nodiscard]] std::uint64_t AllRays() const noexcept {return count >= kSize ? ~std::uint64_t{0} : (std::uint64_t{1} << count) - 1;}
+};
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "adaptive.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "light.h"
+#include "material.h"
+#include "prune.h"
+#include "sampler.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+/// @brief How the rays of a tile are traced.
+enum class Integrator
+{
+    RECURSIVE, //each path is followed depth first, one sample at a time
+    WAVEFRONT  //all the rays of one bounce are traced together, see RenderTileWavefront()
+};
+
+/// @brief Parameters that control how an image is rendered.
+struct RenderSettings
+{
+    int samples_per_pixel{5}; //ignored with adaptive sampling
+    int first_sample{0};      //index of the first sample of each pixel, so that successive passes draw different samples
+    int max_depth{4};
+    int tile_size{32}; //width and height of a square tile, in pixels
+    bool primary_packets{true}; //trace each sample's primary rays in 8x8 packets rather than one at a time
+    Integrator integrator{Integrator::RECURSIVE};
+    SamplerType sampler{SamplerType::SOBOL}; //how the samples of a pixel are spread over it, see sampler.h
+    PruneSettings prune;
+    AdaptiveSettings adaptive;
+    const std::atomic<bool>* cancel{nullptr}; //if set, tiles not yet started once it becomes true are skipped
+
+    /// @brief The most samples a pixel can take in one pass
+    [[nodiscard]] int SamplesPerPass() const noexcept {return adaptive.enabled ? adaptive.max_samples : samples_per_pixel;}
+};
+
+/// @brief Counts gathered while rendering.
+struct RenderStats
+{
+    std::uint64_t rays_pruned{0}; //reflected and refracted rays not traced, see PruneSettings
+    std::uint64_t samples{0};     //camera samples taken, over all pixels and passes
+    int passes{0};                //passes accumulated by RenderProgressive(), including one cut short by the deadline
+};
+
+/// @brief A rectangular block of pixels [x0,x1) x [y0,y1), in framebuffer coordinates.
+struct Tile
+{
+    int x0, y0;
+    int x1, y1;
+};
+
+/// @brief Per-pixel running sums of samples, added to one tile at a time by successive render passes.
+class Accumulator
+{
+public:
+    Accumulator(int width, int height)
+        : m_width{width}, m_sums(static_cast<std::size_t>(width) * height, Color{0.f}), m_samples(static_cast<std::size_t>(width) * height, 0) {}
+
+    /// @brief Adds a tile of a pass in which pixel (x,y) is the mean of samples[y * width + x] samples.
+    /// @brief With adaptive sampling that count differs from pixel to pixel, and each pass is weighted by it.
+    void AddTile(const Tile& tile, const Framebuffer& pass, std::span<const int> samples);
+
+    [[nodiscard]] int Samples(int x, int y) const {return m_samples[static_cast<std::size_t>(y) * m_width + x];}
+
+    /// @brief Writes the mean of all samples so far into image. Pixels without samples are black.
+    void Resolve(Framebuffer& image) const;
+
+    /// @brief Resolve(), for the pixels of one tile only
+    void Resolve(const Tile& tile, Framebuffer& image) const;
+
+private:
+    int m_width;
+    std::vector<Color> m_sums;
+    std::vector<int> m_samples;
+};
+
+/// @brief When RenderProgressive() stops: after whichever limit is reached first.
+struct ProgressiveSettings
+{
+    std::optional<std::chrono::steady_clock::duration> time_budget; //none: no deadline
+    int max_passes{0};                                              //0: no limit, so a time budget is required
+};
+
+/// @brief Called after each pass of RenderProgressive() with the image so far and the number of the pass, from 0.
+using PassCallback = std::function<void(const Framebuffer& image, int pass)>;
+
+/// @brief Called as each tile is finished, with the image it was written to. Calls are serialized, but come from the 
+/// @brief worker that rendered the tile while the others carry on, so they should be quick.
+using TileCallback = std::function<void(const Framebuffer& image, const Tile& tile)>;
+
+/// @brief Splits an image into tiles of at most tile_size x tile_size pixels, ordered along a Hilbert curve
+/// @brief so that consecutive tiles are neighbours in the image.
+std::vector<Tile> MakeTiles(int width, int height, int tile_size);
+
+/// @brief Returns the viewport coordinates (u,v) of sample s of pixel (i,y), placed within the pixel by the sampler.
+/// @brief The sampler depends only on the pixel and sample, so the result does not depend on which thread runs the tile.
+std::pair<float,float> SamplePosition(const Sampler& sampler, int i, int y, int s, int width, int height);
+
+/// @brief Traces every pixel in a tile, following each path depth first, and writes the averaged color into the framebuffer.
+/// @param sample_counts If not empty, one per pixel of the image: receives how many samples each pixel of the tile took, 
+/// @param sample_counts which with adaptive sampling differs from pixel to pixel
+RenderStats RenderTile(const Tile& tile, const Camera& cam, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights, 
+                       const RenderSettings& settings, Framebuffer& image, std::span<int> sample_counts = {});
+
+/// @brief Renders the scene into the framebuffer with the integrator chosen in settings, using every worker in the pool.
+/// @brief If settings.cancel becomes true, the tiles not yet started are left as they were.
+RenderStats Render(const Camera& cam, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights, 
+                   const RenderSettings& settings, ThreadPool& pool, Framebuffer& image, const TileCallback& on_tile = {});
+
+/// @brief Renders passes of settings.samples_per_pixel samples each, with different samples every pass, and keeps the mean
+/// @brief of all of them in image. Stops at the time budget, the pass limit or cancellation, leaving the best image so far.
+/// @brief The deadline is checked before each tile. The tiles a pass finished before it are kept, so pixels may differ by one 
+/// @brief pass's worth of samples. The first pass always runs to completion, so that no pixel is left without samples.
+/// @brief With adaptive sampling each pass samples adaptively, and each pixel of a pass is weighted by the samples it took.
+/// @brief on_tile is called as each tile of each pass is added, once that tile of image holds the mean so far.
+RenderStats RenderProgressive(const Camera& cam, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights, 
+                              const RenderSettings& settings, const ProgressiveSettings& progressive, ThreadPool& pool, 
+                              Framebuffer& image, const PassCallback& on_pass = {}, const TileCallback& on_tile = {});
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "renderer.h"
+
+/// @brief Render server protocol, over a local stream socket.
+/// @brief A client sends requests, one per line, as space-separated key=value fields, all optional:
+/// @brief   width=900 height=506 spp=5 depth=4 vfov=20 from=13,2,3 at=0,0,0 up=0,1,0 sampler=sobol wavefront=0
+/// @brief The server answers each request, in order, with messages of a MessageHeader followed by `size` bytes:
+/// @brief   TILE:  uint32 x0, y0, x1, y1, then (x1-x0)*(y1-y0) RGB triples of linear floats, rows top to bottom
+/// @brief   DONE:  uint64 samples, uint64 rays_pruned, double milliseconds since the request, including any wait for
+/// @brief          other clients' jobs. Ends a job
+/// @brief   ERROR: a message as text. Ends a request that could not be parsed or was turned away; the connection stays open
+/// @brief Tiles are sent as they finish, in no particular order. A progressive job sends every tile again after each pass,
+/// @brief with the mean so far. All values are little-endian.
+enum class MessageType : std::uint32_t
+{
+    TILE = 1,
+    DONE = 2,
+    ERROR = 3
+};
+
+struct MessageHeader
+{
+    MessageType type;
+    std::uint32_t size; //bytes of payload that follow
+};
+
+/// @brief Parses a request line into a job: a copy of defaults, with the fields given in the line replaced.
+/// @brief The job's target has the requested size but no pixels yet, and the job has no callbacks.
+/// @return Nothing if a field is unknown or out of range, with the reason in error
+std::optional<RenderJob> ParseRenderRequest(std::string_view line, const RenderJob& defaults, std::string& error);
+
+/// @brief Listens on a UNIX socket at path and renders requests from any number of clients, until the process ends.
+/// @brief Each connection has its own thread; their jobs queue for the renderer and run one at a time on its pool.
+/// @brief A socket left at path by a server that has gone is replaced; anything else there is an error.
+/// @brief Each job's messages are queued and sent by a thread of its own, so a slow client never holds up the renderer.
+/// @brief A client that falls 64 MiB behind, reads nothing for 10 seconds, or disconnects, is dropped and the rest of its job skipped.
+/// @brief Requests are turned away with an ERROR while the images of queued and running jobs would exceed 16384^2 pixels.
+/// @param defaults What a request renders, apart from the fields it gives. Its target's size is used, not its pixels
+/// @return False if the socket could not be set up. Otherwise, does not return
+bool ServeRenders(Renderer& renderer, const std::string& path, const RenderJob& defaults);
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "aabb.h"
+#include "accel.h"
+#include "bvh_build.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "light.h"
+#include "render.h"
+#include "scene_cache.h"
+#include "scenes.h"
+#include "thread_pool.h"
+#include "vec3.h"
+
+/// @brief A caller-owned image that a job renders into, as rows of linear RGB floats with row 0 at the top.
+/// @brief Pixel (x,y) starts at data + y * stride + 3 * x. The stride is counted in floats and may exceed 3 * width,
+/// @brief so a job can fill a region of a larger image, or rows padded for alignment.
+struct ImageView
+{
+    float* data{nullptr};
+    int width{0};
+    int height{0};
+    std::size_t stride{0};
+
+    [[nodiscard]] bool Valid() const noexcept {return data && width > 0 && height > 0 && stride >= 3 * static_cast<std::size_t>(width);}
+};
+
+/// @brief Where the camera stands and what it looks at.
+struct CameraSettings
+{
+    Point3 look_from{13.f,2.f,3.f};
+    Point3 look_at{0.f,0.f,0.f};
+    Vec3 up{0.f,1.f,0.f};
+    float vfov{20.f};         //vertical field of view, in degrees
+    float aspect_ratio{0.f};  //0: the target's width over its height
+};
+
+/// @brief Moves the camera so that it looks at the centre of a box from far enough away to see all of it, keeping the
+/// @brief direction it looks in and its field of view. For scenes, such as loaded meshes, with no camera of their own.
+CameraSettings FrameBounds(const CameraSettings& camera, const AABB& bounds);
+
+/// @brief One image to render from a Renderer's scene.
+struct RenderJob
+{
+    ImageView target;
+    CameraSettings camera;
+    RenderSettings settings;
+    ProgressiveSettings progressive; //with neither limit set, the job is a single pass of settings.samples_per_pixel
+
+    //Called as each tile is written to target, and for progressive jobs after each pass, with target holding the image so far.
+    //Calls are serialized, but come from the renderer's workers while the others carry on, so they should be quick.
+    std::function<void(const Tile& tile)> on_tile;
+    std::function<void(int pass)> on_pass;
+};
+
+/// @brief Renders jobs from one scene, whose acceleration structure is built once when the renderer is made,
+/// @brief on a pool of workers that lives as long as the renderer. Jobs differ in camera, resolution and settings.
+class Renderer
+{
+public:
+    /// @param num_threads Number of workers. Values < 1 use the hardware concurrency.
+    Renderer(Scene scene, const PointLight& light, AccelType accel = AccelType::LINEAR, int num_threads = 0);
+
+    /// @brief Renders a scene loaded from a cache file. With the LINEAR accelerator nothing is built; any other builds
+    /// @brief just the top level over the cached objects.
+    Renderer(CachedScene cached, const PointLight& light, AccelType accel = AccelType::LINEAR, int num_threads = 0);
+
+    Renderer(const Renderer&) = delete;
+    Renderer& operator=(const Renderer&) = delete;
+
+    [[nodiscard]] int Threads() const noexcept {return m_pool.Size();}
+    [[nodiscard]] AccelType Accel() const noexcept {return m_accel;}
+    [[nodiscard]] const BVHBuildStats& BuildStats() const noexcept {return m_build_stats;}
+
+    /// @brief Renders a job into its target and returns once it is finished. Jobs submitted from several threads
+    /// @brief run one at a time, each on every worker.
+    /// @return Nothing if the target is not a valid image
+    std::optional<RenderStats> Render(const RenderJob& job);
+
+    /// @brief Writes the scene and its top-level LinearBVH to a cache file, see WriteSceneCache(). If the renderer uses
+    /// @brief another accelerator, a LinearBVH is built for the file.
+    bool SaveScene(const std::string& path, std::uint64_t input_hash);
+
+private:
+    ThreadPool m_pool;
+    Scene m_scene;
+    PointLight m_light;
+    AccelType m_accel;
+    BVHBuildStats m_build_stats;
+    std::unique_ptr<Hittable> m_root;
+
+    std::mutex m_mutex;
+    std::optional<Framebuffer> m_image; //what jobs render into before it is copied to their target, kept while the size stays the same
+};
+
+#endif
@@ -1,45 +1,52 @@
 #ifndef UTILITY_H
 #define UTILITY_H
 
-#include <random>
-/*
-TODO: I think right now it will always generate the same seed...
-*/
-
+#include <cmath>
+#include <cstdint>
+
+/// @brief A counter-based random number generator.
+/// @brief The n-th number drawn is a pure function of (key, n), computed by hashing the pair. There is no shared engine,
+/// @brief so any thread can create a generator for any key, and the same key always gives the same sequence.
+/// @brief Rendering keys generators by (pixel, sample, bounce), which makes an image independent of which thread 
+/// @brief rendered which tile.
 class RNG
 {
-    RNG() = default;
-    //inline static std::random_device rd; //Is there a way to incorporate this?
-    inline static std::mt19937 eng;
-
 public:
+    /// @brief A generator for an arbitrary stream, e.g. for scene generation.
+    constexpr explicit RNG(std::uint64_t key)
+        : m_key{Mix(key)} {}
+
+    /// @brief A generator for the given pixel, sample number and bounce (recursion depth, or a PathNode number) of a path.
+    constexpr RNG(std::uint32_t pixel, std::uint32_t sample, std::uint64_t bounce)
+        : m_key{Mix(Mix(Mix(pixel) ^ sample) ^ bounce)} {}
 
-    ~RNG() = default;
-    RNG(const RNG& other) = delete;
-    RNG& operator=(const RNG& other) = delete;
+    /// @brief Returns 32 uniformly distributed random bits.
+    constexpr std::uint32_t NextUInt() noexcept { return static_cast<std::uint32_t>(Mix(m_key + kGolden * ++m_counter) >> 32); }
 
-    static RNG& Get()
+    /// @brief Returns a uniformly distributed float in [low,high)
+    constexpr float GenerateFloat(float low, float high) noexcept
     {
-        static RNG s_instance; //Instantiate on first use
-        return s_instance;
+        //Use the top 24 bits so that every value is exactly representable, giving [0,1) without rounding up to 1
+        const auto unit{static_cast<float>(NextUInt() >> 8) * 0x1p-24f};
+        return low + unit * (high - low);
     }
-    float GenerateFloat(float low, float high) {std::uniform_real_distribution<float> dist(low,high); return dist(eng);}
-    float GenerateExponentialFloat() {std::exponential_distribution<float> dist(0.5f); return dist(eng);}
-};
-
 
-/*
+    /// @brief Returns an exponentially distributed float with rate 0.5
+    float GenerateExponentialFloat() noexcept { return -std::log(1.f - GenerateFloat(0.f,1.f)) / 0.5f; }
 
-Below is the general process 
-
-std::random_device rd; //generate a seed
-std::mt19937 engine; //Set up an engine
-engine.seed(rd); 
-std::uniform_real_distribution<> dist(0.f,1.f); //create a distribution
-dist(engine); //use the engine to generate the numbers!
-
-*/
+    /// @brief The splitmix64 finalizer. Flipping any input bit flips each output bit with probability ~1/2.
+    static constexpr std::uint64_t Mix(std::uint64_t z) noexcept
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
 
+private:
+    static constexpr std::uint64_t kGolden{0x9e3779b97f4a7c15ull};
 
+    std::uint64_t m_key;
+    std::uint64_t m_counter{0};
+};
 
-#endif
\ No newline at end of file
+#endif
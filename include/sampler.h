@@ -0,0 +1,50 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+/// @brief Identifies one sample of one pixel.
+/// @brief Pixel is the pixel's index in the whole image (y * width + x), which keys any per-pixel randomisation.
+struct PixelSample
+{
+    std::uint32_t x, y;
+    std::uint32_t pixel;
+    std::uint32_t sample;
+};
+
+/// @brief Generates the sample points of each pixel: a point in [0,1)^2 for each pair of dimensions of each sample.
+/// @brief A point depends only on the pixel, the sample number and the dimension, never on what was generated before,
+/// @brief so tiles and passes can be rendered in any order, on any thread or machine, with the same result.
+class Sampler
+{
+public:
+    virtual ~Sampler() = default;
+
+    /// @param dimension Which pair of dimensions: 0 is the position within the pixel, the others are free for e.g. light sampling
+    [[nodiscard]] virtual std::pair<float,float> Get2D(const PixelSample& at, std::uint32_t dimension) const = 0;
+};
+
+/// @brief The sample generators a render can use.
+enum class SamplerType
+{
+    RANDOM,     //independent uniform points
+    STRATIFIED, //correlated multi-jittered: one point per cell of a grid, and per row and column of its projections
+    HALTON,     //Halton sequence, shifted by a random offset per pixel
+    SOBOL,      //Sobol sequence with hash-based Owen scrambling per pixel
+    BLUE_NOISE  //Sobol sequence shifted per pixel by a blue-noise tile, so that the error is spread as high-frequency noise
+};
+
+/// @brief Parses "random", "stratified", "halton", "sobol" or "bluenoise"
+std::optional<SamplerType> ParseSamplerType(std::string_view name);
+
+std::string_view SamplerName(SamplerType type);
+
+/// @brief Makes a sampler of the given type
+/// @param samples_per_pixel How many samples a pixel is expected to take. The stratified sampler stratifies runs of that many
+std::unique_ptr<Sampler> MakeSampler(SamplerType type, int samples_per_pixel);
+
+#endif
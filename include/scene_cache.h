@@ -0,0 +1,39 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "linear_bvh.h"
+#include "scenes.h"
+
+/// @brief Scene cache files store a scene ready to trace: the material table, every object with its built BVH, and the
+/// @brief top-level LinearBVH over the objects. Arrays are referred to by offset and laid out as they are in memory, so
+/// @brief loading maps the file and points the objects into it, with nothing to parse or build. Pages are read as rays
+/// @brief first touch them, and processes that load the same file share one copy in the page cache.
+/// @brief A file is only used if it has this version and was written for the same input hash by a build with the same
+/// @brief kSceneGeneratorVersion, kBVHBuilderVersion and kAccelLeafSize; otherwise it is rebuilt.
+/// @brief Loading checks that every array lies within the file, and that node, primitive, vertex and material indices
+/// @brief are in range, so a damaged file is rebuilt rather than read out of bounds. Other values, e.g. bounds, are trusted.
+inline constexpr std::uint32_t kSceneCacheVersion{1};
+
+/// @brief A scene restored from a cache file. Its objects keep the mapping alive.
+struct CachedScene
+{
+    Scene scene;                     //world holds the objects in the order of root's leaves
+    std::unique_ptr<LinearBVH> root;
+};
+
+/// @brief Writes a scene and the LinearBVH over its objects to path. The file is written under a unique temporary name
+/// @brief and then renamed, so that a process loading it never sees it half written, and concurrent writers never mix.
+/// @brief Objects may be Spheres, Triangles, SphereSets and TriangleMeshes. Vertex buffers shared by meshes are stored once.
+/// @param input_hash Identifies whatever the scene was made from, see ContentHash
+/// @return False if the scene holds an object of another type, or the file could not be written
+bool WriteSceneCache(const std::string& path, const Scene& scene, const LinearBVH& root, std::uint64_t input_hash);
+
+/// @return Nothing if there is no readable cache at path, or it has another version or input hash, or is malformed
+std::optional<CachedScene> LoadSceneCache(const std::string& path, std::uint64_t input_hash);
+
+#endif
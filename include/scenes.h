@@ -0,0 +1,71 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "hittable_list.h"
+#include "material.h"
+#include "triangle_mesh.h"
+
+class ThreadPool;
+
+/// @brief The geometry of a scene together with the materials its primitives refer to by ID.
+struct Scene
+{
+    HittableList world;
+    MaterialTable materials;
+};
+
+/// @brief The final scene from Shirley's "Ray Tracing in One Weekend": a field of small random spheres around three large ones.
+/// @brief The scene is generated from a fixed seed, so it is the same on every run.
+Scene RandomScene();
+
+/// @brief RandomScene's layout with most of the small spheres glass, so that most paths refract and reflect to full depth.
+Scene GlassScene();
+
+/// @brief The finest terrain TerrainScene() makes: 2*resolution^2 triangles must fit the 32-bit primitive counts of the BVH.
+inline constexpr int kMaxTerrainResolution{1 << 14};
+
+/// @brief Bump whenever a change here changes the scenes MakeScene() makes from a spec, including the options their
+/// @brief SphereSets and TriangleMeshes are built with, so that scene caches holding old ones are rebuilt
+inline constexpr std::uint32_t kSceneGeneratorVersion{1};
+
+/// @brief A rolling heightfield of resolution x resolution quads (2*resolution^2 triangles), centred on the origin in the y=0 plane.
+/// @param resolution At most kMaxTerrainResolution
+/// @param mesh_layout If set, the terrain is one TriangleMesh with smooth normals and this layout, rather than separate Triangles
+Scene TerrainScene(int resolution, std::optional<TriangleLayout> mesh_layout = std::nullopt);
+
+/// @brief A cloud of count small spheres (held in one SphereSet) floating over a ground sphere, in a 20 x 4 x 20 box centred above the origin.
+/// @brief The sphere radius shrinks as count grows so the cloud stays about as dense. Like RandomScene, the scene is the same on every run.
+/// @param pool If not null, the SphereSet's BVH is built on it
+Scene ParticleScene(std::size_t count, ThreadPool* pool = nullptr);
+
+/// @brief A loaded mesh on its own, as one double-sided indexed TriangleMesh with a plain diffuse material.
+/// @brief Double-sided because files do not reliably wind every face the same way.
+/// @param owner Keeps the memory behind view alive
+/// @param pool If not null, the mesh's BVH is built on it
+Scene MeshScene(MeshView view, std::shared_ptr<const void> owner, ThreadPool* pool = nullptr);
+
+/// @brief Makes a scene from a spec: "random", "glass", "terrain[:RESOLUTION]", "particles[:COUNT]", or "obj:PATH" or "ply:PATH" for
+/// @brief a mesh loaded with LoadOBJ() or LoadPLY(). The terrain is one indexed mesh.
+/// @param error Set to why, if no scene could be made
+/// @return Nothing if the spec is not recognised, asks for a terrain finer than kMaxTerrainResolution, or its file cannot be loaded
+std::optional<Scene> MakeScene(std::string_view spec, std::string& error, ThreadPool* pool = nullptr);
+
+/// @return True if the spec names a file to load. Such scenes are not laid out for any particular camera.
+bool IsFileScene(std::string_view spec);
+
+/// @brief A hash of everything the scene made from a spec depends on: the spec itself, and any file it names.
+/// @brief Generated scenes are the same on every run, so this can stand in for the scene, e.g. as the key of a scene cache.
+/// @brief By default a file is identified by its size, modification time, device and inode, which costs one stat() however 
+/// @brief large it is, but misses an edit that restores the old mtime. 
+/// @param hash_contents If true, the file's contents are hashed instead, which reads all of it
+/// @return Nothing if a file named by the spec cannot be read
+std::optional<std::uint64_t> SceneKey(std::string_view spec, bool hash_contents = false);
+
+#endif
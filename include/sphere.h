@@ -16,17 +16,22 @@ class Sphere : public Hittable
 private:
     float m_radius;
     Point3 m_centre;
-    std::shared_ptr<Material> m_mat_ptr;
+    MaterialID m_mat_id;
+
+    [[nodiscard]] std::optional<float> Intersect(const Ray& r, float t_low, float t_high) const;
 public:
     //Constructor
-    Sphere(const Vec3& centre, float radius, std::shared_ptr<Material> mat)
-        :m_centre{centre}, m_radius{radius},  m_mat_ptr{std::move(mat)} {} //{ assert(m_radius_>0);}
+    Sphere(const Vec3& centre, float radius, MaterialID mat)
+        :m_centre{centre}, m_radius{radius},  m_mat_id{mat} {} //{ assert(m_radius_>0);}
 
     [[nodiscard]] constexpr Vec3 Centre() const noexcept {return m_centre;}
     [[nodiscard]] constexpr float Radius() const noexcept {return m_radius;}
+    [[nodiscard]] constexpr MaterialID MaterialId() const noexcept {return m_mat_id;}
 
     [[nodiscard]] std::optional<HitData> Hit(const Ray& r, float t_low, float t_high) const override;
 
+    [[nodiscard]] bool Occluded(const Ray& r, float t_low, float t_high) const override { return Intersect(r, t_low, t_high).has_value(); }
+
     [[nodiscard]] AABB BoundingBox() const override {
         const auto min = Vec3{m_centre.X() - m_radius, m_centre.Y() - m_radius, m_centre.Z() - m_radius};
         const auto max = Vec3{m_centre.X() + m_radius, m_centre.Y() + m_radius, m_centre.Z() + m_radius}; 
@@ -0,0 +1,92 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "aabb.h"
+#include "bvh_build.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "ray.h"
+
+/// @brief Spheres stored as structure-of-arrays: the input to a SphereSet.
+struct SphereArrays
+{
+    std::vector<float> centre_x, centre_y, centre_z;
+    std::vector<float> radius;
+    std::vector<MaterialID> material;
+
+    void Add(const Point3& centre, float r, MaterialID mat)
+    {
+        centre_x.push_back(centre.X());
+        centre_y.push_back(centre.Y());
+        centre_z.push_back(centre.Z());
+        radius.push_back(r);
+        material.push_back(mat);
+    }
+
+    void Reserve(std::size_t count)
+    {
+        centre_x.reserve(count); centre_y.reserve(count); centre_z.reserve(count);
+        radius.reserve(count);
+        material.reserve(count);
+    }
+
+    [[nodiscard]] std::size_t Size() const noexcept {return radius.size();}
+};
+
+/// @brief What a SphereSet traces, as views: the spheres in leaf order and the BVH over them.
+/// @brief Saving these lets a SphereSet be restored, e.g. from a mapped file, without rebuilding it.
+struct SphereSetData
+{
+    std::span<const float> centre_x, centre_y, centre_z, radius; //one per sphere, then kLanes-1 zeros of padding
+    std::span<const MaterialID> material;                         //one per sphere
+    std::span<const LinearBVHNode> nodes;
+};
+
+/// @brief A large group of spheres behind one Hittable, for particle-style scenes.
+/// @brief There is no object (or vtable, or pointer) per sphere: a sphere costs 20 bytes plus its share of an internal BVH,
+/// @brief whose leaves hold up to 8 spheres that are intersected together (8 lanes of AVX2 when compiled with it).
+class SphereSet : public Hittable
+{
+public:
+    static constexpr int kLanes{8};
+
+    explicit SphereSet(SphereArrays spheres, const BVHBuildOptions& options = BVHBuildOptions{.max_prims_in_leaf = kLanes, .traversal_cost = 4.f});
+
+    /// @brief Restores a set from the Data() of one built earlier, without building anything
+    /// @param owner Keeps the memory behind data alive for as long as the set exists
+    SphereSet(const SphereSetData& data, std::shared_ptr<const void> owner);
+
+    [[nodiscard]] std::optional<HitData> Hit(const Ray& ray, float t_low, float t_high) const override;
+
+    [[nodiscard]] bool Occluded(const Ray& ray, float t_low, float t_high) const override;
+
+    void HitPacket(const RayPacket& packet, std::uint64_t active, float t_low, std::span<float> t_max, std::span<std::optional<HitData>> hits) const override;
+
+    [[nodiscard]] AABB BoundingBox() const override {return m_data.nodes.empty() ? AABB{} : m_data.nodes[0].bounds;}
+
+    [[nodiscard]] std::size_t Size() const noexcept {return m_data.material.size();}
+
+    [[nodiscard]] std::size_t NodeCount() const noexcept {return m_data.nodes.size();}
+
+    [[nodiscard]] const SphereSetData& Data() const noexcept {return m_data;}
+
+private:
+    /// @brief Finds the closest of spheres [first, first+count) hit by the ray in [t_low,t_high].
+    /// @brief On a hit, lowers t_high to it and sets hit_index.
+    bool IntersectLeaf(const Ray& ray, int first, int count, float t_low, float& t_high, int& hit_index) const;
+
+    [[nodiscard]] HitData MakeHitData(const Ray& ray, float t, int index) const;
+
+    SphereSetData m_data; //spheres in leaf order, padded by kLanes-1 so that a leaf can always be loaded as whole vectors
+    std::shared_ptr<const void> m_owner; //the memory behind m_data
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// @brief A fixed set of worker threads that live for the whole program.
+/// @brief Work is submitted as a single job which every worker runs (with its own worker index), 
+/// @brief so the threads are created once rather than once per frame.
+class ThreadPool
+{
+public:
+    /// @param num_threads Number of workers. Values < 1 use the hardware concurrency.
+    explicit ThreadPool(int num_threads = 0) 
+    {
+        if(num_threads < 1) {num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));}
+        m_workers.reserve(num_threads);
+        for(int i = 0; i < num_threads; ++i) {
+            m_workers.emplace_back([this, i] { WorkerLoop(i); });
+        }
+    }
+
+    ~ThreadPool() 
+    {
+        {
+            std::lock_guard lock{m_mutex};
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for(auto& worker : m_workers) {worker.join();}
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    [[nodiscard]] int Size() const noexcept {return static_cast<int>(m_workers.size());}
+
+    /// @brief Runs job(worker_index) once on every worker and blocks until all of them have returned.
+    /// @brief Must not be called from inside a job.
+    void Run(const std::function<void(int)>& job) 
+    {
+        std::unique_lock lock{m_mutex};
+        m_job = &job;
+        m_busy = Size();
+        ++m_generation;
+        m_wake.notify_all();
+        m_done.wait(lock, [this] { return m_busy == 0; });
+        m_job = nullptr;
+    }
+
+    /// @brief Splits [0,count) into one contiguous chunk per worker and runs body(begin, end, worker_index) on each.
+    void ParallelFor(std::size_t count, const std::function<void(std::size_t, std::size_t, int)>& body) 
+    {
+        const auto workers{static_cast<std::size_t>(Size())};
+        Run([&](int w) {
+            const auto begin = count * w / workers;
+            const auto end = count * (w + 1) / workers;
+            if(begin < end) {body(begin, end, w);}
+        });
+    }
+
+private:
+    void WorkerLoop(int index) 
+    {
+        std::uint64_t seen_generation{0};
+        while(true)
+        {
+            const std::function<void(int)>* job{nullptr};
+            {
+                std::unique_lock lock{m_mutex};
+                m_wake.wait(lock, [&] { return m_stop || m_generation != seen_generation; });
+                if(m_stop) return;
+                seen_generation = m_generation;
+                job = m_job;
+            }
+
+            (*job)(index);
+
+            {
+                std::lock_guard lock{m_mutex};
+                if(--m_busy == 0) {m_done.notify_one();}
+            }
+        }
+    }
+
+private:
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake; //signals workers that a new job (or shutdown) is available
+    std::condition_variable m_done; //signals Run() that the last worker has finished
+    const std::function<void(int)>* m_job{nullptr};
+    std::uint64_t m_generation{0};
+    int m_busy{0};
+    bool m_stop{false};
+};
+
+#endif
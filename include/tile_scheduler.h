@@ -0,0 +1,99 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+/// @brief Returns the distance of cell (x,y) along a Hilbert curve that fills an n x n grid.
+/// @param n Side length of the grid, must be a power of 2
+inline std::uint64_t HilbertIndex(std::uint32_t n, std::uint32_t x, std::uint32_t y) 
+{
+    std::uint64_t d{0};
+    for(auto s = n / 2; s > 0; s /= 2) 
+    {
+        const std::uint32_t rx = (x & s) > 0;
+        const std::uint32_t ry = (y & s) > 0;
+        d += static_cast<std::uint64_t>(s) * s * ((3 * rx) ^ ry);
+
+        //Rotate the quadrant so the curve stays continuous
+        if(ry == 0) {
+            if(rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+/// @brief Hands out tile indices to a fixed number of workers.
+/// @brief Every worker owns a deque which is seeded with a contiguous run of tiles. Workers take tiles from 
+/// @brief the front of their own deque, and when it is empty they steal from the back of another worker's.
+/// @brief If tiles are given in space-filling-curve order, each worker starts on a compact region of the image
+/// @brief (and so of the BVH), while thieves take the tiles furthest away from where the owner is working.
+class TileScheduler
+{
+public:
+    TileScheduler(std::size_t num_tiles, int num_workers)
+        : m_num_workers{num_workers}, m_queues{std::make_unique<WorkQueue[]>(num_workers)}
+    {
+        assert(num_workers > 0);
+        for(int w = 0; w < num_workers; ++w) {
+            const auto begin = num_tiles * w / num_workers;
+            const auto end = num_tiles * (w + 1) / num_workers;
+            for(auto t = begin; t < end; ++t) {m_queues[w].tiles.push_back(t);}
+        }
+    }
+
+    /// @brief Returns the next tile for a worker to render, or null once every tile has been handed out.
+    [[nodiscard]] std::optional<std::size_t> Next(int worker) 
+    {
+        assert(worker >= 0 && worker < m_num_workers);
+
+        //#1 Own work first, in order
+        {
+            auto& own = m_queues[worker];
+            std::lock_guard lock{own.mutex};
+            if(!own.tiles.empty()) {
+                const auto tile = own.tiles.front();
+                own.tiles.pop_front();
+                return tile;
+            }
+        }
+
+        //#2 Steal from the other end of someone else's queue
+        for(int i = 1; i < m_num_workers; ++i) 
+        {
+            auto& victim = m_queues[(worker + i) % m_num_workers];
+            std::lock_guard lock{victim.mutex};
+            if(!victim.tiles.empty()) {
+                const auto tile = victim.tiles.back();
+                victim.tiles.pop_back();
+                return tile;
+            }
+        }
+
+        //Tiles are never added once scheduling starts, so if every queue is empty then we are done
+        return std::nullopt;
+    }
+
+private:
+    //Each queue gets its own cache line so that workers popping their own queue do not contend
+    struct alignas(64) WorkQueue 
+    {
+        std::mutex mutex;
+        std::deque<std::size_t> tiles;
+    };
+
+    int m_num_workers;
+    std::unique_ptr<WorkQueue[]> m_queues;
+};
+
+#endif
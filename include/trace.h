@@ -1,11 +1,18 @@
 #ifndef TRACE_H
 #define TRACE_H
 
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <utility>
+
 #include "bvh.h"
 #include "vec3.h"
 #include "hittable_list.h"
+#include "light.h"
 #include "math.h"
 #include "material.h"
+#include "prune.h"
 
 //sorry
 static constexpr auto mat_eta{1.5f}; //refractive index of materials
@@ -13,94 +20,135 @@ static constexpr Color kBackGroundColor = Vec3(0.235294, 0.67451, 0.843137); //b
 static constexpr auto eps{0.001f}; //bias to prevent self-intersection
 
 
-// Algorithm.
-Color RayColor(const Ray& ray, Hittable* scene, const PointLight& light, float t_low, float t_high, int depth) {
-    assert(t_low <  t_high);
-
-    //No more rays to trace, return background color
-    if(depth<=0) return kBackGroundColor; 
-
-    auto hit_data{ scene->Hit(ray, t_low, t_high) };
+/// @brief A ray spawned at a mirror or glass surface, and the fraction of the light along it that is passed back.
+struct SpecularRay
+{
+    Ray ray;
+    float weight;
+};
 
-    //The ray didn't intersect anything
-    if(!hit_data) {return kBackGroundColor;}
+/// @brief Returns the rays spawned where a ray hits a MIRROR or DIELECTRIC surface: the reflected ray,
+/// @brief and for glass the refracted ray as well unless there is total internal reflection.
+inline std::pair<SpecularRay, std::optional<SpecularRay>> SpecularBounce(const Ray& ray, const HitData& hit, Material::MaterialType type) {
+    const auto& [hit_param, hit_point, hit_normal, mat_id] = hit;
 
-    //Unwrap
-    const auto& [hit_param, hit_point, hit_normal, mat_ptr] = hit_data.value();
-
-    if(mat_ptr->m_type == Material::MaterialType::MIRROR)
+    if(type == Material::MaterialType::MIRROR)
     {
         const auto reflected_dir{ Reflected(ray.Direction(),hit_normal)};
-        const auto reflected_ray = Ray{ hit_point, reflected_dir}; 
         const auto reflectance{ Fresnel(Norm3(ray.Direction()), hit_normal, mat_eta)}; //A measure of 'what % of the ray gets reflected'
-        return reflectance * RayColor(reflected_ray, scene, light, eps, std::numeric_limits<float>::max(), depth-1);
+        return {SpecularRay{Ray{hit_point, reflected_dir}, reflectance}, std::nullopt};
     }
 
-    // //Glassy (refractive) surface
-    if(mat_ptr->m_type == Material::MaterialType::DIELECTRIC)
-    {
+    assert(type == Material::MaterialType::DIELECTRIC);
 
-        //There is always at least some amount of reflection, so we can compute the reflected ray immediately
-        const auto reflected_dir = Norm3{Reflected(ray.Direction(), hit_normal)};
-        const auto reflected_ray = Ray{reflected_dir, hit_point};
+    //There is always at least some amount of reflection, so we can compute the reflected ray immediately
+    const auto reflected_ray = Ray{hit_point, Norm3{Reflected(ray.Direction(), hit_normal)}};
 
-        //Did the intersection produce refraction?                            
-        const auto refracted_dir = std::optional<Vec3>{Refracted(Norm3(ray.Direction()), hit_normal, mat_eta)};     
+    //Did the intersection produce refraction?
+    const auto refracted_dir = std::optional<Vec3>{Refracted(Norm3(ray.Direction()), hit_normal, mat_eta)};
 
-        //No refraction(TIR) so we can return early
-        if(!refracted_dir) { 
-            return RayColor(reflected_ray, scene, light, eps, std::numeric_limits<float>::max(), depth-1);
-        }   
+    //No refraction(TIR), so all of the light is reflected
+    if(!refracted_dir) {return {SpecularRay{reflected_ray, 1.f}, std::nullopt};}
 
-        //There is refraction, so we can generate the refracted ray
-        const auto refracted_ray = Ray{hit_point, refracted_dir.value()};  
-                                                  
-        //The Fresnel equations dictate "how much" of the light is refracted vs reflected
-        //compute reflectance using schlick approximation 
-        auto reflectance = Fresnel(Norm3(ray.Direction()), hit_normal, mat_eta);
-        return reflectance * RayColor(reflected_ray, scene, light, eps, std::numeric_limits<float>::max(), depth-1) + 
-                            (1 - reflectance) * RayColor(refracted_ray, scene, light, eps, std::numeric_limits<float>::max(), depth-1);
+    //The Fresnel equations dictate "how much" of the light is refracted vs reflected
+    //compute reflectance using schlick approximation
+    const auto reflectance = Fresnel(Norm3(ray.Direction()), hit_normal, mat_eta);
+    return {SpecularRay{reflected_ray, reflectance}, SpecularRay{Ray{hit_point, refracted_dir.value()}, 1 - reflectance}};
+}
 
-    }
+/// @brief A shadow ray from a hit point towards the light. The point is lit if nothing is hit in [eps, dist_to_light].
+struct ShadowRay
+{
+    Ray ray;
+    float dist_to_light;
+};
+
+inline ShadowRay ShadowRayTo(const PointLight& light, const Point3& hit_point) {
+    //To avoid any self-intersections the shadow ray is only tested from eps onwards.
+    //It's ok if the shadow ray hits another object IF the light source is closer than the occluding object,
+    //so only look for occluders between the surface and the light. Any one of them will do.
+    const auto light_dir = Norm3{light.position - hit_point};
+    return ShadowRay{Ray{hit_point, light_dir}, (light.position - hit_point).Length()};
+}
 
-    //Shade diffuse surface using Blinn-Phong model    
-    else 
-    {
+/// @brief Blinn-Phong shading of a diffuse surface that the light reaches unoccluded.
+inline Color BlinnPhong(const Ray& ray, const HitData& hit, const Material& material, const PointLight& light) {
+    const auto& hit_normal = hit.hit_normal;
 
-        //Check if ray is a shadow ray by generating a ray from the hit point and casting it to all light sources 
-        //To avoid any self-intersections we add some bias to the shadow ray (the direction depends on whether ray hits inside or outside of surface)
-        // Direction vector from intersection point to light source
-        const auto light_dir = Norm3{light.position - hit_point};                                                                        
-        const auto secondary_ray = Ray{ hit_point, light_dir};
-
-        //It's ok if the shadow ray hits another object IF the light source is closer than the occluding object
-        if(const auto param = scene->Hit( secondary_ray, eps, std::numeric_limits<float>::max()); param) //TODO Modify for multiple lights
-        {
-            //Is this occluding object closer than the light source?
-            const auto vec_surf_to_light{light.position - hit_point};
-            const auto vec_surf_to_occ{param.value().hit_point - ray.Origin()};
-            if(vec_surf_to_occ.LengthSquared() < vec_surf_to_light.LengthSquared() )
-
-            return Color(0.f,0.f,0.f); 
-        }
+    // Direction vector from intersection point to light source
+    const auto light_dir = Norm3{light.position - hit.hit_point};
+
+    //Ambient
+    // constexpr auto ambient_strength{0.1f};
+    // const auto ambient_light{ ambient_strength*light.intensity };
+
+    //Diffuse
+    const auto diffuse_angle = std::max(0.f,Dot(hit_normal, light_dir));
+    const auto diffuse_light = Color{light.intensity * diffuse_angle }; // * surface color?
+
+    //Specular
+    const auto v = Norm3{-ray.Direction()};
+    const auto h = Norm3{light_dir+v}; //vector that bisects the light direction and eye direction
+    const auto spec_angle{ std::max(0.f, Dot(hit_normal, h))};
+    const Color specular_color{light.intensity*(std::pow(spec_angle, material.specular_exponent))};
+
+    return diffuse_light*(material.Kd) + specular_color * (material.Ks);
+}
+
+
+inline Color RayColor(const Ray& ray, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights, float t_low, float t_high, int depth,
+                      const PathNode& path = {}, Pruner* pruner = nullptr);
+
+/// @brief Returns the color seen along a ray, given what the ray hit (if anything).
+/// @brief Reflected, refracted and shadow rays are traced from here, so the hit itself can come from a single ray or a packet.
+/// @brief If a pruner is given, it decides which of the reflected and refracted rays are worth tracing.
+inline Color Shade(const Ray& ray, const std::optional<HitData>& hit_data, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights, int depth,
+                   const PathNode& path = {}, Pruner* pruner = nullptr) {
+    //No more rays to trace, return background color
+    if(depth<=0) return kBackGroundColor;
 
-        //Ambient 
-        // constexpr auto ambient_strength{0.1f};
-        // const auto ambient_light{ ambient_strength*light.intensity };
-
-        //Diffuse 
-        const auto diffuse_angle = std::max(0.f,Dot(hit_normal, light_dir));
-        const auto diffuse_light = Color{light.intensity * diffuse_angle }; // * surface color?
-
-        //Specular  
-        const auto v = Norm3{-ray.Direction()};
-        const auto h = Norm3{light_dir+v}; //vector that bisects the light direction and eye direction
-        const auto spec_angle{ std::max(0.f, Dot(hit_normal, h))};
-        const Color specular_color{light.intensity*(std::pow(spec_angle, mat_ptr->specular_exponent))};
-        
-        return diffuse_light*(mat_ptr->Kd) + specular_color * (mat_ptr->Ks); 
+    //The ray didn't intersect anything
+    if(!hit_data) {return kBackGroundColor;}
+
+    const auto& material = materials[hit_data->mat_id];
+
+    //Shade diffuse surface using Blinn-Phong model, summed over the lights it can see
+    if(material.m_type == Material::MaterialType::DIFFUSE)
+    {
+        auto color = Color(0.f,0.f,0.f);
+        for(const auto& light : lights) {
+            const auto shadow = ShadowRayTo(light, hit_data->hit_point);
+            if(scene->Occluded(shadow.ray, eps, shadow.dist_to_light)) continue;
+            color += BlinnPhong(ray, hit_data.value(), material, light);
+        }
+        return color;
     }
-    
+
+    //Mirror or glass: follow the reflected (and refracted) rays.
+    //A ray spawned at depth 1 only sees the background, which costs nothing, so only deeper rays are pruned
+    const auto trace = [&](const SpecularRay& spawned, std::uint32_t which) {
+        auto child = path.Child(which, spawned.weight);
+        const auto survival{pruner && depth > 1 ? pruner->Survival(child) : 1.f};
+        if(survival == 0.f) return Color{0.f,0.f,0.f};
+        child.throughput *= survival;
+        return (spawned.weight * survival) * RayColor(spawned.ray, scene, materials, lights, eps, std::numeric_limits<float>::max(), depth-1, child, pruner);
+    };
+
+    const auto [reflected, refracted] = SpecularBounce(ray, hit_data.value(), material.m_type);
+    auto color = trace(reflected, 0);
+    if(refracted) {color += trace(refracted.value(), 1);}
+    return color;
+}
+
+// Algorithm.
+inline Color RayColor(const Ray& ray, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights, float t_low, float t_high, int depth,
+                      const PathNode& path, Pruner* pruner) {
+    assert(t_low <  t_high);
+
+    //No more rays to trace, return background color
+    if(depth<=0) return kBackGroundColor;
+
+    return Shade(ray, scene->Hit(ray, t_low, t_high), scene, materials, lights, depth, path, pruner);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -17,7 +17,10 @@ class Triangle : public Hittable
     std::array<Point3,3> m_vertices;
     Norm3 m_normal;
     bool b_double_sided;
-    std::shared_ptr<Material> mat_ptr;
+    MaterialID mat_id;
+
+    /// @brief Returns the ray parameter of the intersection if it lies in [low,high]
+    std::optional<float> Intersect(const Ray& r, float low, float high) const;
 public:
 
     //Special members
@@ -29,13 +32,23 @@ public:
     Triangle& operator=(Triangle&&) noexcept = default;
 
     //Constructors
-    Triangle(const Point3& a, const Point3& b, const Point3& c, std::shared_ptr<Material> material, bool double_sided = false) 
-        : m_vertices{a,b,c}, m_normal{(Cross(b-a,c-a))}, mat_ptr{std::move(material)}, b_double_sided{double_sided} {}
+    Triangle(const Point3& a, const Point3& b, const Point3& c, MaterialID material, bool double_sided = false) 
+        : m_vertices{a,b,c}, m_normal{(Cross(b-a,c-a))}, mat_id{material}, b_double_sided{double_sided} {}
 
     
     virtual std::optional<HitData> Hit(const Ray& r, float low, float high) const override;
 
+    [[nodiscard]] bool Occluded(const Ray& r, float low, float high) const override { return Intersect(r, low, high).has_value(); }
+
+    [[nodiscard]] AABB BoundingBox() const override {
+        AABB box;
+        for(const auto& v : m_vertices) {box.Extend(v);}
+        return box;
+    }
+
     constexpr Point3 V_1() const noexcept { return m_vertices[0];}
     constexpr Point3 V_2() const noexcept { return m_vertices[1];}
     constexpr Point3 V_3() const noexcept { return m_vertices[2];}
+    constexpr MaterialID MaterialId() const noexcept { return mat_id;}
+    constexpr bool DoubleSided() const noexcept { return b_double_sided;}
 };
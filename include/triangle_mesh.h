@@ -0,0 +1,154 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include <cstddef>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "aabb.h"
+#include "bvh_build.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "ray.h"
+
+/// @brief Vertex and index data for one or more TriangleMeshes.
+struct MeshBuffers
+{
+    std::vector<Point3> positions;
+    std::vector<Vec3> normals;          //optional: either empty or one per position
+    std::vector<std::uint32_t> indices; //three per triangle, counter-clockwise seen from the front
+};
+
+/// @brief Read-only views of mesh data, which may live in MeshBuffers or anywhere else (e.g. a mapped file).
+struct MeshView
+{
+    std::span<const Point3> positions;
+    std::span<const Vec3> normals;
+    std::span<const std::uint32_t> indices;
+
+    [[nodiscard]] std::size_t TriangleCount() const noexcept {return indices.size() / 3;}
+};
+
+/// @brief How a TriangleMesh stores what its intersection test reads.
+enum class TriangleLayout
+{
+    INDEXED,    //read the shared vertex buffers through the index buffer: about 16 bytes per triangle plus the BVH
+    PRECOMPUTED //also keep a 48-byte record per triangle, in leaf order and SoA, intersected 8 at a time
+};
+
+/// @brief A triangle's plane and two barycentric planes (Havel & Herout, "Yet Faster Ray-Triangle Intersection").
+/// @brief For a hit point P: u = Dot(n1,P) + d1, v = Dot(n2,P) + d2, and the ray parameter follows from the plane (n,d).
+template<typename Array>
+struct BasicTriangleRecords
+{
+    Array nx, ny, nz, d;
+    Array n1x, n1y, n1z, d1;
+    Array n2x, n2y, n2z, d2;
+
+    [[nodiscard]] std::array<Array*, 12> Fields() noexcept {return {&nx, &ny, &nz, &d, &n1x, &n1y, &n1z, &d1, &n2x, &n2y, &n2z, &d2};}
+    [[nodiscard]] std::array<const Array*, 12> Fields() const noexcept {return {&nx, &ny, &nz, &d, &n1x, &n1y, &n1z, &d1, &n2x, &n2y, &n2z, &d2};}
+};
+
+using TriangleRecords = BasicTriangleRecords<std::vector<float>>;
+using TriangleRecordsView = BasicTriangleRecords<std::span<const float>>;
+
+/// @brief What a TriangleMesh builds over its MeshView, as views. Saving these with the mesh data lets a mesh be restored, 
+/// @brief e.g. from a mapped file, without rebuilding it.
+struct TriangleMeshBVH
+{
+    std::span<const LinearBVHNode> nodes;
+    std::span<const std::uint32_t> triangles; //triangle indices in leaf order
+    TriangleRecordsView records;              //PRECOMPUTED only: one per entry of triangles, then kLanes-1 zeros of padding
+};
+
+/// @brief An indexed triangle mesh with one material, behind a single Hittable.
+/// @brief Vertex data is shared rather than copied per triangle, so several meshes (e.g. with different materials) can use
+/// @brief the same buffers. The mesh adds only its own BVH and a 4-byte triangle index per triangle on top of them.
+/// @brief Single-sided meshes cull back faces; per-vertex normals, if present, are interpolated for shading.
+/// @brief The layout trades memory for speed per mesh; see TriangleLayout.
+class TriangleMesh : public Hittable
+{
+public:
+    static constexpr int kLanes{8};
+
+    /// @param options BVH build options, DefaultBuildOptions(layout) if not given
+    TriangleMesh(std::shared_ptr<const MeshBuffers> buffers, MaterialID material, bool double_sided = false,
+                 TriangleLayout layout = TriangleLayout::INDEXED, std::optional<BVHBuildOptions> options = std::nullopt);
+
+    /// @param owner Keeps the memory behind view alive for as long as the mesh exists
+    TriangleMesh(MeshView view, std::shared_ptr<const void> owner, MaterialID material, bool double_sided = false,
+                 TriangleLayout layout = TriangleLayout::INDEXED, std::optional<BVHBuildOptions> options = std::nullopt);
+
+    /// @brief Restores a mesh from the View() and BVH() of one built earlier, without building anything
+    /// @param owner Keeps the memory behind both view and bvh alive for as long as the mesh exists
+    TriangleMesh(MeshView view, const TriangleMeshBVH& bvh, std::shared_ptr<const void> owner, MaterialID material, bool double_sided,
+                 TriangleLayout layout);
+
+    /// @brief Leaves of 4 for indexed meshes. Precomputed records are tested 8 at a time, so their leaves hold up to 8, 
+    /// @brief and a node visit is priced higher relative to a triangle test to fill them.
+    [[nodiscard]] static BVHBuildOptions DefaultBuildOptions(TriangleLayout layout)
+    {
+        return layout == TriangleLayout::PRECOMPUTED ? BVHBuildOptions{.max_prims_in_leaf = kLanes, .traversal_cost = 4.f} 
+                                                     : BVHBuildOptions{.max_prims_in_leaf = 4};
+    }
+
+    [[nodiscard]] std::optional<HitData> Hit(const Ray& ray, float t_low, float t_high) const override;
+
+    [[nodiscard]] bool Occluded(const Ray& ray, float t_low, float t_high) const override;
+
+    void HitPacket(const RayPacket& packet, std::uint64_t active, float t_low, std::span<float> t_max, std::span<std::optional<HitData>> hits) const override;
+
+    [[nodiscard]] AABB BoundingBox() const override {return m_bvh.nodes.empty() ? AABB{} : m_bvh.nodes[0].bounds;}
+
+    [[nodiscard]] std::size_t TriangleCount() const noexcept {return m_view.TriangleCount();}
+
+    [[nodiscard]] std::size_t NodeCount() const noexcept {return m_bvh.nodes.size();}
+
+    [[nodiscard]] TriangleLayout Layout() const noexcept {return m_layout;}
+
+    [[nodiscard]] const MeshView& View() const noexcept {return m_view;}
+
+    [[nodiscard]] const TriangleMeshBVH& BVH() const noexcept {return m_bvh;}
+
+    [[nodiscard]] MaterialID MaterialId() const noexcept {return m_material;}
+
+    [[nodiscard]] bool DoubleSided() const noexcept {return b_double_sided;}
+
+private:
+    struct TriangleHit
+    {
+        float t;
+        float u, v; //barycentric coordinates of the hit along edges v0->v1 and v0->v2
+    };
+
+    /// @brief Moller-Trumbore test of triangle tri against the ray, within [t_low,t_high]
+    [[nodiscard]] std::optional<TriangleHit> IntersectTriangle(std::uint32_t tri, const Ray& ray, float t_low, float t_high) const;
+
+    /// @brief Finds the closest hit among leaf slots [first, first+count), using the precomputed records. 
+    /// @brief On a hit, lowers t_high to it and sets hit and slot.
+    bool IntersectRecords(const Ray& ray, int first, int count, float t_low, float& t_high, TriangleHit& hit, int& slot) const;
+
+    /// @brief Tests the leaf slots [first, first+count) with whichever layout the mesh uses.
+    bool IntersectLeaf(const Ray& ray, int first, int count, float t_low, float& t_high, TriangleHit& hit, int& slot) const;
+
+    /// @brief Fills in the shading data for the hit found in leaf slot `slot`
+    [[nodiscard]] HitData MakeHitData(const Ray& ray, const TriangleHit& hit, int slot) const;
+
+    /// @brief Computes the record of each triangle in leaf order
+    [[nodiscard]] TriangleRecords BuildRecords(std::span<const std::uint32_t> triangles) const;
+
+    MeshView m_view;
+    std::shared_ptr<const void> m_owner;
+    MaterialID m_material;
+    bool b_double_sided;
+    TriangleLayout m_layout;
+    TriangleMeshBVH m_bvh;
+    std::shared_ptr<const void> m_bvh_owner; //the memory behind m_bvh, if not the same as m_owner
+};
+
+#endif
@@ -7,7 +7,6 @@
 #include <cassert>
 #include <iostream>
 #include <optional>
-#include <random>
 
 #include "rng.h"
 
@@ -50,10 +49,14 @@ public:
     constexpr float LengthSquared() const noexcept {return elem[0]*elem[0]+ elem[1]*elem[1]+ elem[2]*elem[2];};
     constexpr float Length() const {return sqrtf(LengthSquared());}
 
-    static Vec3 Random() { return Vec3(RNG::Get().GenerateFloat(0.f,1.f), RNG::Get().GenerateFloat(0.f,1.f), RNG::Get().GenerateFloat(0.f,1.f));}
+    static Vec3 Random(RNG& rng) { return Random(rng, 0.f, 1.f); }
 
-    static Vec3 Random(float min, float max) {
-        return Vec3(RNG::Get().GenerateFloat(min,max), RNG::Get().GenerateFloat(min,max), RNG::Get().GenerateFloat(min,max));
+    static Vec3 Random(RNG& rng, float min, float max) {
+        //Draw in a fixed order (argument evaluation order is unspecified)
+        const auto x{rng.GenerateFloat(min,max)};
+        const auto y{rng.GenerateFloat(min,max)};
+        const auto z{rng.GenerateFloat(min,max)};
+        return Vec3(x,y,z);
         }
 
     constexpr auto& Data() const noexcept{return elem;}
@@ -145,29 +148,4 @@ public:
 
 
 
-/// @brief Scales the color of a pixel to fit the file format, and prints it to a buffer
-/// @param out Out buffer
-/// @param pixel_color 
-/// @param samples_per_pixel The number of samples (rays) taken per pixel
-inline void PrintColor(std::ostream &out, const Color& pixel_color, int samples) {
-
-    using std::clamp;
-
-    auto r = pixel_color.X();
-    auto g = pixel_color.Y();
-    auto b = pixel_color.Z();
-
-    //Each sample ray can add an amount of color between 0 and 1, so we need to divide by the number of samples to scale color to [0,1]
-    // Divide the color by the number of samples with a gamma correction value of 2
-    const auto scale = 1.f / samples;
-    r = sqrtf(r*scale);
-    g = sqrtf(g*scale);
-    b = sqrtf(b*scale);
-
-    // Write the translated [0,255] value of each color component.
-    out << static_cast<int>(256 * clamp(r, 0.f, 0.999f)) << ' '
-        << static_cast<int>(256 * clamp(g, 0.f, 0.999f)) << ' '
-        << static_cast<int>(256 * clamp(b, 0.f, 0.999f)) << '\n';
-}
-
 #endif
\ No newline at end of file
@@ -0,0 +1,65 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "adaptive.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "light.h"
+#include "material.h"
+#include "prune.h"
+#include "ray.h"
+#include "render.h"
+
+/// @brief A ray waiting to be traced, and the pixel that receives what it finds.
+struct PathRay
+{
+    Ray ray;
+    PathNode node;       //node.throughput weights what the ray finds
+    std::uint32_t pixel; //index into the tile
+};
+
+/// @brief A PathRay that hit something.
+struct PathHit
+{
+    PathRay path;
+    HitData hit;
+};
+
+/// @brief A shadow ray, and what its pixel receives if the light is not occluded.
+struct PathShadow
+{
+    Ray ray;
+    float dist_to_light;
+    Color contribution;
+    std::uint32_t pixel;
+};
+
+/// @brief The queues of one wavefront, kept from tile to tile so that a worker allocates them only once.
+struct WavefrontQueues
+{
+    std::vector<PathRay> rays;       //rays of the next bounce
+    std::vector<PathHit> hits;       //rays of this bounce that hit something, in the order they were traced
+    std::vector<std::uint32_t> by_type; //indices into hits, grouped by material type
+    std::vector<PathShadow> shadows; //shadow rays of this bounce
+    std::vector<Color> pixels;       //sum of color over the samples being traced, for each pixel of the tile
+    std::vector<std::uint8_t> active; //for each pixel of the tile, whether it still takes samples
+    std::vector<PixelEstimate> estimates; //adaptive sampling only: each pixel's samples so far
+    std::array<std::size_t, 3> type_begin{}; //where each MaterialType starts in by_type
+};
+
+/// @brief Renders a tile breadth first: all of its primary rays are traced, then all of the rays they spawn, and so on.
+/// @brief Each bounce intersects its whole queue, keeps only the rays that hit something, and shades those grouped by
+/// @brief material type, so no stage has to wait on another and each runs the same code over many rays.
+/// @brief With adaptive sampling there is one wavefront per sample, of the pixels that have not converged yet.
+/// @brief The result equals RenderTile's up to the order in which contributions are summed.
+/// @param sample_counts As for RenderTile()
+RenderStats RenderTileWavefront(const Tile& tile, const Camera& cam, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights,
+                                const RenderSettings& settings, Framebuffer& image, WavefrontQueues& queues, std::span<int> sample_counts = {});
+
+#endif
@@ -0,0 +1,380 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#if defined(__SSE2__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#include "aabb.h"
+#include "bvh_build.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "ray.h"
+#include "ray_packet.h"
+
+/// @brief A node with up to N children, whose bounds are stored SoA so that all N can be tested at once.
+/// @brief Unused slots have inverted (empty) bounds, so they never report a hit.
+template<int N>
+struct alignas(32) WideBVHNode
+{
+    std::array<float,N> min_x, min_y, min_z;
+    std::array<float,N> max_x, max_y, max_z;
+    std::array<std::int32_t,N> child;       //interior children: node index; leaves: index of the first primitive
+    std::array<std::uint16_t,N> prim_count; //0 for interior children and empty slots
+};
+
+/// @brief Ray data shared by every box test in one traversal
+struct WideRay
+{
+    std::array<float,3> origin;
+    std::array<float,3> inv_dir;
+    std::array<int,3> dir_is_neg;
+};
+
+/// @brief Tests the ray against every child box of a node.
+/// @param t_entry Receives the entry distance of each child that is hit
+/// @return Bitmask with bit i set if child i is hit within [t_low,t_high]
+template<int N>
+inline std::uint32_t IntersectChildren(const WideBVHNode<N>& node, const WideRay& r, float t_low, float t_high, std::array<float,N>& t_entry)
+{
+    //Pick the planes the ray meets first/last on each axis once for the whole node
+    const float* near_x = r.dir_is_neg[0] ? node.max_x.data() : node.min_x.data();
+    const float* far_x  = r.dir_is_neg[0] ? node.min_x.data() : node.max_x.data();
+    const float* near_y = r.dir_is_neg[1] ? node.max_y.data() : node.min_y.data();
+    const float* far_y  = r.dir_is_neg[1] ? node.min_y.data() : node.max_y.data();
+    const float* near_z = r.dir_is_neg[2] ? node.max_z.data() : node.min_z.data();
+    const float* far_z  = r.dir_is_neg[2] ? node.min_z.data() : node.max_z.data();
+
+#if defined(__AVX__)
+    if constexpr(N == 8) {
+        const auto ox = _mm256_set1_ps(r.origin[0]), oy = _mm256_set1_ps(r.origin[1]), oz = _mm256_set1_ps(r.origin[2]);
+        const auto ix = _mm256_set1_ps(r.inv_dir[0]), iy = _mm256_set1_ps(r.inv_dir[1]), iz = _mm256_set1_ps(r.inv_dir[2]);
+
+        //max/min return their second operand when either is NaN, so keep the running interval second
+        auto t0 = _mm256_set1_ps(t_low);
+        auto t1 = _mm256_set1_ps(t_high);
+        t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(near_x), ox), ix), t0);
+        t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(far_x), ox), ix), t1);
+        t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(near_y), oy), iy), t0);
+        t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(far_y), oy), iy), t1);
+        t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(near_z), oz), iz), t0);
+        t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(far_z), oz), iz), t1);
+
+        _mm256_storeu_ps(t_entry.data(), t0);
+        return static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)));
+    }
+#endif
+#if defined(__SSE2__)
+    if constexpr(N == 4) {
+        const auto ox = _mm_set1_ps(r.origin[0]), oy = _mm_set1_ps(r.origin[1]), oz = _mm_set1_ps(r.origin[2]);
+        const auto ix = _mm_set1_ps(r.inv_dir[0]), iy = _mm_set1_ps(r.inv_dir[1]), iz = _mm_set1_ps(r.inv_dir[2]);
+
+        auto t0 = _mm_set1_ps(t_low);
+        auto t1 = _mm_set1_ps(t_high);
+        t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_x), ox), ix), t0);
+        t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_x), ox), ix), t1);
+        t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_y), oy), iy), t0);
+        t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_y), oy), iy), t1);
+        t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_z), oz), iz), t0);
+        t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_z), oz), iz), t1);
+
+        _mm_storeu_ps(t_entry.data(), t0);
+        return static_cast<std::uint32_t>(_mm_movemask_ps(_mm_cmple_ps(t0, t1)));
+    }
+#endif
+
+    //Portable fallback, with the same NaN behaviour as the SIMD paths
+    std::uint32_t mask{0};
+    for(int i = 0; i < N; ++i) {
+        auto t0{t_low};
+        auto t1{t_high};
+        const auto tnx{(near_x[i] - r.origin[0]) * r.inv_dir[0]}, tfx{(far_x[i] - r.origin[0]) * r.inv_dir[0]};
+        const auto tny{(near_y[i] - r.origin[1]) * r.inv_dir[1]}, tfy{(far_y[i] - r.origin[1]) * r.inv_dir[1]};
+        const auto tnz{(near_z[i] - r.origin[2]) * r.inv_dir[2]}, tfz{(far_z[i] - r.origin[2]) * r.inv_dir[2]};
+        t0 = tnx > t0 ? tnx : t0;  t1 = tfx < t1 ? tfx : t1;
+        t0 = tny > t0 ? tny : t0;  t1 = tfy < t1 ? tfy : t1;
+        t0 = tnz > t0 ? tnz : t0;  t1 = tfz < t1 ? tfz : t1;
+        t_entry[i] = t0;
+        if(t0 <= t1) {mask |= 1u << i;}
+    }
+    return mask;
+}
+
+/// @brief A BVH with N children per node (BVH4 for SSE, BVH8 for AVX), built by collapsing the binary SAH tree.
+/// @brief Like LinearBVH it traces primary rays as packets; without that the wide trees lost to it on every render.
+template<int N>
+class WideBVH : public Hittable
+{
+    static_assert(N >= 2 && N <= 8);
+
+public:
+    explicit WideBVH(const HittableList& h, const BVHBuildOptions& options = BVHBuildOptions{.max_prims_in_leaf = 4})
+    {
+        const auto& objects = h.m_objects;
+
+        auto prims = ComputePrimitiveInfo(objects, options);
+        const auto binary = BuildBVH(prims, options);
+
+        const auto start{std::chrono::steady_clock::now()};
+        m_primitives.reserve(prims.size());
+        for(const auto& prim : prims) {m_primitives.push_back(objects[prim.index]);}
+        if(!binary.empty()) {
+            m_bounds = binary[0].bounds;
+            if(binary[0].IsLeaf()) {m_root = ChildRef{binary[0].first_prim, static_cast<std::uint16_t>(binary[0].prim_count)};}
+            else {m_root = ChildRef{Collapse(binary, 0), 0};}
+        }
+        if(options.stats) {options.stats->finalize_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();}
+    }
+
+    [[nodiscard]] std::optional<HitData> Hit(const Ray& ray, float t_low, float t_high) const override
+    {
+        std::optional<HitData> data;
+        Traverse<false>(ray, t_low, t_high, [&](int first, int count, float& closest_so_far) {
+            bool found{false};
+            for(int i = first; i < first + count; ++i) {
+                if(auto tmp_data = m_primitives[i]->Hit(ray, t_low, closest_so_far); tmp_data) {
+                    closest_so_far = tmp_data.value().hit_param;
+                    data = std::move(tmp_data);
+                    found = true;
+                }
+            }
+            return found;
+        });
+        return data;
+    }
+
+    [[nodiscard]] bool Occluded(const Ray& ray, float t_low, float t_high) const override
+    {
+        return Traverse<true>(ray, t_low, t_high, [&](int first, int count, float& t_max) {
+            for(int i = first; i < first + count; ++i) {
+                if(m_primitives[i]->Occluded(ray, t_low, t_max)) return true;
+            }
+            return false;
+        });
+    }
+
+    void HitPacket(const RayPacket& packet, std::uint64_t active, float t_low, std::span<float> t_max, std::span<std::optional<HitData>> hits) const override
+    {
+        TraversePacket(packet, active, t_low, t_max, [&](int first, int count, std::uint64_t rays) {
+            for(int i = first; i < first + count; ++i) {m_primitives[i]->HitPacket(packet, rays, t_low, t_max, hits);}
+        });
+    }
+
+    [[nodiscard]] AABB BoundingBox() const override {return m_bounds;}
+
+    [[nodiscard]] std::size_t NodeCount() const noexcept {return m_nodes.size();}
+
+private:
+    /// @brief Refers to either an interior node (prim_count == 0) or a leaf's primitive range.
+    /// @brief Kept trivial so that the traversal stack is not zeroed on every ray.
+    struct ChildRef
+    {
+        std::int32_t index;
+        std::uint16_t prim_count;
+    };
+
+    struct StackEntry
+    {
+        ChildRef ref;
+        float t_entry;
+    };
+
+    /// @brief Visits the leaves the ray reaches, nearest first. Same contract as TraverseLinearBVH: 
+    /// @brief intersect_leaf(first_prim, prim_count, t_high) returns whether it found a hit, and lowers t_high to it.
+    template<bool kAnyHit, typename LeafFn>
+    bool Traverse(const Ray& ray, float t_low, float t_high, LeafFn&& intersect_leaf) const
+    {
+        if(m_primitives.empty()) return false;
+
+        const auto wray{MakeWideRay(ray)};
+        bool hit{false};
+
+        //Children are pushed far to near, so the nearest is always popped next
+        //Collapsing never deepens the tree, so each of at most kMaxBVHDepth levels leaves at most N-1 siblings behind
+        std::array<StackEntry, kMaxBVHDepth * (N-1) + 1> stack;
+        int stack_size{0};
+        stack[stack_size++] = StackEntry{m_root, t_low};
+
+        while(stack_size > 0)
+        {
+            const auto entry{stack[--stack_size]};
+            if(entry.t_entry > t_high) continue; //a closer hit has been found since this was pushed
+
+            if(entry.ref.prim_count > 0) {
+                if(intersect_leaf(entry.ref.index, static_cast<int>(entry.ref.prim_count), t_high)) {
+                    hit = true;
+                    if constexpr(kAnyHit) {return true;}
+                }
+                continue;
+            }
+
+            const auto& node = m_nodes[entry.ref.index];
+            std::array<float,N> t_entry;
+            auto mask{IntersectChildren<N>(node, wray, t_low, t_high, t_entry)};
+
+            //Push the hit children, insertion sorting them (there are at most N) so the nearest ends up on top.
+            //Sorting in place on the stack avoids a block copy, which compilers tend to turn into a slow rep movs.
+            assert(stack_size + std::popcount(mask) <= static_cast<int>(stack.size()));
+            const auto base{stack_size};
+            while(mask) {
+                const auto i{std::countr_zero(mask)};
+                mask &= mask - 1;
+                const auto candidate = StackEntry{ChildRef{node.child[i], node.prim_count[i]}, t_entry[i]};
+                int j{stack_size++};
+                for(; j > base && stack[j-1].t_entry < candidate.t_entry; --j) {stack[j] = stack[j-1];}
+                stack[j] = candidate;
+            }
+        }
+        return hit;
+    }
+
+    struct PacketStackEntry
+    {
+        ChildRef ref;
+        std::uint64_t rays; //leaves: the rays that hit them; interior nodes: those that may, all of the parent's if the lead ray does
+        int lead;           //the ray that orders this child's children
+        float t_entry;      //where the lead ray enters, to sort siblings
+    };
+
+    /// @brief Walks the tree with a whole packet, like TraverseLinearBVHPacket. All N child boxes of a node are tested against
+    /// @brief one lead ray at once; only the children it misses are culled against the frustum and then tested ray by ray.
+    /// @param intersect_leaf Called as intersect_leaf(first_prim, prim_count, rays), where rays is the bitmask of active rays 
+    /// @param intersect_leaf that hit the leaf. It should lower t_max for each ray it finds a hit for.
+    template<typename LeafFn>
+    void TraversePacket(const RayPacket& packet, std::uint64_t active, float t_low, std::span<float> t_max, LeafFn&& intersect_leaf) const
+    {
+        if(m_primitives.empty()) return;
+        const auto rays{MakePacketRays(packet)};
+        active = IntersectPacket(m_bounds, rays, active, t_low, t_max);
+        if(active == 0) return;
+
+        std::array<PacketStackEntry, kMaxBVHDepth * (N-1) + 1> stack;
+        int stack_size{0};
+        stack[stack_size++] = PacketStackEntry{m_root, active, std::countr_zero(active), t_low};
+
+        while(stack_size > 0)
+        {
+            const auto entry{stack[--stack_size]};
+            if(entry.ref.prim_count > 0) {
+                intersect_leaf(entry.ref.index, static_cast<int>(entry.ref.prim_count), entry.rays);
+                continue;
+            }
+
+            const auto& node = m_nodes[entry.ref.index];
+            const auto lead{entry.lead};
+            WideRay wray{{packet.origin.X(), packet.origin.Y(), packet.origin.Z()}, {rays.inv_x[lead], rays.inv_y[lead], rays.inv_z[lead]}, {}};
+            for(int i = 0; i < 3; ++i) {wray.dir_is_neg[i] = wray.inv_dir[i] < 0.f;}
+
+            //The lead ray's entry distances order the children even for those it misses
+            std::array<float,N> t_entry;
+            const auto lead_mask{IntersectChildren<N>(node, wray, t_low, t_max[lead], t_entry)};
+
+            const auto base{stack_size};
+            for(int i = 0; i < N && node.child[i] >= 0; ++i)
+            {
+                auto candidate = PacketStackEntry{ChildRef{node.child[i], node.prim_count[i]}, entry.rays, lead, t_entry[i]};
+                const auto lead_hits{(lead_mask & (1u << i)) != 0};
+                //Leaves are only handed the rays that reach them, so they are always tested in full
+                if(!lead_hits || candidate.ref.prim_count > 0) {
+                    const auto box = AABB{Vec3{node.min_x[i], node.min_y[i], node.min_z[i]}, Vec3{node.max_x[i], node.max_y[i], node.max_z[i]}};
+                    if(!lead_hits && !FrustumOverlaps(packet, box)) continue;
+                    candidate.rays = IntersectPacket(box, rays, entry.rays, t_low, t_max);
+                    if(candidate.rays == 0) continue;
+                    candidate.lead = std::countr_zero(candidate.rays);
+                }
+
+                //Insertion sort far to near, as in Traverse()
+                assert(stack_size < static_cast<int>(stack.size()));
+                int j{stack_size++};
+                for(; j > base && stack[j-1].t_entry < candidate.t_entry; --j) {stack[j] = stack[j-1];}
+                stack[j] = candidate;
+            }
+        }
+    }
+
+    static WideRay MakeWideRay(const Ray& ray) 
+    {
+        const auto o{ray.Origin()};
+        const auto d{ray.Direction()};
+        WideRay r{{o.X(), o.Y(), o.Z()}, {1.f/d.X(), 1.f/d.Y(), 1.f/d.Z()}, {}};
+        for(int i = 0; i < 3; ++i) {r.dir_is_neg[i] = r.inv_dir[i] < 0.f;}
+        return r;
+    }
+
+    /// @brief Turns the binary subtree rooted at an interior node into wide nodes, and returns the index of the top one.
+    /// @brief Children are gathered by repeatedly opening the interior child with the largest surface area, 
+    /// @brief since that is the one a ray is most likely to have to enter anyway.
+    int Collapse(const std::vector<BVHBuildNode>& binary, int root) 
+    {
+        assert(!binary[root].IsLeaf());
+        std::array<int,N> children{root + 1, binary[root].right_child};
+        int child_count{2};
+
+        while(child_count < N) {
+            int best{-1};
+            float best_area{-1.f};
+            for(int i = 0; i < child_count; ++i) {
+                const auto& c = binary[children[i]];
+                if(!c.IsLeaf() && c.bounds.SurfaceArea() > best_area) {
+                    best = i;
+                    best_area = c.bounds.SurfaceArea();
+                }
+            }
+            if(best < 0) break; //only leaves left
+
+            const auto opened{children[best]};
+            children[best] = opened + 1;
+            children[child_count++] = binary[opened].right_child;
+        }
+
+        const auto index{static_cast<int>(m_nodes.size())};
+        m_nodes.emplace_back();
+
+        //Fill a local copy, since recursing below may reallocate m_nodes
+        WideBVHNode<N> node;
+        constexpr auto inf{std::numeric_limits<float>::infinity()};
+        node.min_x.fill(inf);  node.min_y.fill(inf);  node.min_z.fill(inf);
+        node.max_x.fill(-inf); node.max_y.fill(-inf); node.max_z.fill(-inf);
+        node.child.fill(-1);
+        node.prim_count.fill(0);
+
+        for(int i = 0; i < child_count; ++i) {
+            const auto& c = binary[children[i]];
+            node.min_x[i] = c.bounds.min.X(); node.min_y[i] = c.bounds.min.Y(); node.min_z[i] = c.bounds.min.Z();
+            node.max_x[i] = c.bounds.max.X(); node.max_y[i] = c.bounds.max.Y(); node.max_z[i] = c.bounds.max.Z();
+            if(c.IsLeaf()) {
+                node.child[i] = c.first_prim;
+                node.prim_count[i] = static_cast<std::uint16_t>(c.prim_count);
+            }
+            else {
+                node.child[i] = Collapse(binary, children[i]);
+            }
+        }
+        m_nodes[index] = node;
+        return index;
+    }
+
+private:
+    std::vector<std::shared_ptr<Hittable>> m_primitives;
+    std::vector<WideBVHNode<N>> m_nodes;
+    ChildRef m_root{0, 0};
+    AABB m_bounds;
+};
+
+using BVH4 = WideBVH<4>;
+using BVH8 = WideBVH<8>;
+
+#endif
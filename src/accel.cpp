@@ -0,0 +1,36 @@
+#include "accel.h"
+#include "bvh.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
+
+std::optional<AccelType> ParseAccelType(std::string_view name)
+{
+    if(name == "bvhnode") return AccelType::BVH_NODE;
+    if(name == "linear") return AccelType::LINEAR;
+    if(name == "bvh4") return AccelType::BVH4;
+    if(name == "bvh8") return AccelType::BVH8;
+    return std::nullopt;
+}
+
+std::string_view AccelName(AccelType type)
+{
+    switch(type) {
+        case AccelType::BVH_NODE: return "bvhnode";
+        case AccelType::LINEAR: return "linear";
+        case AccelType::BVH4: return "bvh4";
+        case AccelType::BVH8: return "bvh8";
+    }
+    return "unknown";
+}
+
+std::unique_ptr<Hittable> BuildAccelerator(AccelType type, const HittableList& world, ThreadPool* pool, BVHBuildStats* stats)
+{
+    const auto options = BVHBuildOptions{.max_prims_in_leaf = kAccelLeafSize, .pool = pool, .stats = stats};
+    switch(type) {
+        case AccelType::BVH_NODE: return std::make_unique<BVHNode>(world, options);
+        case AccelType::LINEAR: return std::make_unique<LinearBVH>(world, options);
+        case AccelType::BVH4: return std::make_unique<BVH4>(world, options);
+        case AccelType::BVH8: return std::make_unique<BVH8>(world, options);
+    }
+    return nullptr;
+}
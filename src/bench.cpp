@@ -0,0 +1,683 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <numbers>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "accel.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "light.h"
+#include "render.h"
+#include "renderer.h"
+#include "scenes.h"
+#include "sphere_set.h"
+#include "triangle_mesh.h"
+#include "thread_pool.h"
+#include "tile_scheduler.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/// @brief The scenes of the suite, in the order they are run
+constexpr std::array kSuite{
+    std::string_view{"random"},      //RandomScene(), as the renderer draws it by default
+    std::string_view{"glass"},       //GlassScene(): mostly refraction and reflection
+    std::string_view{"mesh"},        //one large indexed TriangleMesh
+    std::string_view{"particles"},   //millions of small spheres in one SphereSet
+    std::string_view{"many_lights"}  //RandomScene() lit by a ring of point lights, so shadow rays dominate
+};
+
+struct BenchOptions
+{
+    int num_threads{0};
+    int width{640};
+    int height{360};
+    int samples_per_pixel{4};
+    int max_depth{5};
+    int repeats{3};
+    AccelType accel{AccelType::LINEAR};
+    std::size_t particle_count{10'000'000};
+    int terrain_resolution{1024};
+    std::string mesh_spec; //if set, the mesh scene is made from this spec (e.g. "ply:FILE") instead of the terrain
+    int light_count{32};
+};
+
+/// @brief A scene of the suite, with the view and the lights it is rendered with
+struct BenchScene
+{
+    Scene scene;
+    Camera cam;
+    std::vector<PointLight> lights;
+};
+
+/// @brief The light the renderer uses by default
+constexpr PointLight kDefaultLight{Point3{0.f,70.f,20.f}, Color{0.5f,0.5f,0.5f}};
+
+std::optional<BenchScene> MakeBenchScene(std::string_view name, const BenchOptions& options, ThreadPool& pool, std::string& error)
+{
+    const auto aspect_ratio{static_cast<float>(options.width) / static_cast<float>(options.height)};
+    const auto camera = [&](const CameraSettings& s) {return Camera(s.look_from, s.look_at, s.up, s.vfov, aspect_ratio);};
+    const CameraSettings default_view;
+
+    if(name == "random") return BenchScene{RandomScene(), camera(default_view), {kDefaultLight}};
+    if(name == "glass") return BenchScene{GlassScene(), camera(default_view), {kDefaultLight}};
+    if(name == "particles") {
+        return BenchScene{ParticleScene(options.particle_count, &pool),
+                          camera(CameraSettings{Point3{0.f,5.f,16.f}, Point3{0.f,2.f,0.f}, Vec3{0.f,1.f,0.f}, 50.f}), {kDefaultLight}};
+    }
+    if(name == "many_lights") {
+        //Spread the default light's intensity over a ring above the scene, so the image stays about as bright
+        const auto count{std::max(options.light_count, 1)};
+        std::vector<PointLight> lights;
+        for(int l = 0; l < count; ++l) {
+            const auto angle{2.f * std::numbers::pi_v<float> * static_cast<float>(l) / static_cast<float>(count)};
+            lights.push_back(PointLight{Point3{30.f * std::cos(angle), 40.f, 30.f * std::sin(angle)}, Color{1.f / static_cast<float>(count)}});
+        }
+        return BenchScene{RandomScene(), camera(default_view), std::move(lights)};
+    }
+    if(name == "mesh") {
+        if(options.mesh_spec.empty()) {
+            return BenchScene{TerrainScene(options.terrain_resolution, TriangleLayout::INDEXED),
+                              camera(CameraSettings{Point3{0.f,6.f,14.f}, Point3{0.f,0.f,0.f}, Vec3{0.f,1.f,0.f}, 50.f}), {kDefaultLight}};
+        }
+        auto scene = MakeScene(options.mesh_spec, error, &pool);
+        if(!scene) return std::nullopt;
+        //Frame it the way the renderer frames scenes loaded from files
+        const auto view{FrameBounds(default_view, scene->world.BoundingBox())};
+        const auto light = PointLight{view.look_from + (view.look_from - view.look_at).Length() * view.up, kDefaultLight.intensity};
+        return BenchScene{std::move(*scene), camera(view), {light}};
+    }
+    error = "unknown scene " + std::string(name);
+    return std::nullopt;
+}
+
+/// @brief Counts the spheres in a SphereSet and the triangles in a TriangleMesh individually, and every other object as one primitive
+std::size_t CountPrimitives(const HittableList& world)
+{
+    std::size_t count{0};
+    for(const auto& object : world.m_objects) {
+        if(const auto* set = dynamic_cast<const SphereSet*>(object.get())) {count += set->Size();}
+        else if(const auto* mesh = dynamic_cast<const TriangleMesh*>(object.get())) {count += mesh->TriangleCount();}
+        else {++count;}
+    }
+    return count;
+}
+
+int TracePacketTile(const Hittable& accel, const Camera& cam, const Tile& tile, int width, int height)
+{
+    constexpr auto block{RayPacket::kWidth};
+    std::array<float, RayPacket::kSize> us, vs, t_max;
+    std::array<std::optional<HitData>, RayPacket::kSize> packet_hits;
+    int hits{0};
+    for(int by = tile.y0; by < tile.y1; by += block) {
+        for(int bx = tile.x0; bx < tile.x1; bx += block) {
+            std::size_t count{0};
+            for(int y = by; y < std::min(by + block, tile.y1); ++y) {
+                for(int x = bx; x < std::min(bx + block, tile.x1); ++x, ++count) {
+                    us[count] = (static_cast<float>(x) + 0.5f) / static_cast<float>(width);
+                    vs[count] = (static_cast<float>(height - 1 - y) + 0.5f) / static_cast<float>(height);
+                }
+            }
+            const auto packet = cam.GetRayPacket(std::span{us.data(), count}, std::span{vs.data(), count});
+            t_max.fill(std::numeric_limits<float>::max());
+            packet_hits.fill(std::nullopt);
+            accel.HitPacket(packet, packet.AllRays(), 0.f, t_max, packet_hits);
+            for(std::size_t k = 0; k < count; ++k) {hits += packet_hits[k].has_value();}
+        }
+    }
+    return hits;
+}
+
+/// @brief Traces one closest-hit primary ray through the centre of every pixel and returns the rate in millions of rays per second.
+/// @brief The rays are traced in tiles on the pool, like a render, so this measures the structure under a realistic access pattern.
+/// @param packets If true, each 8x8 block of pixels is traced as one RayPacket
+double TracePrimaryRays(const Hittable& accel, const Camera& cam, int width, int height, ThreadPool& pool, bool packets, int& hit_count)
+{
+    const auto tiles = MakeTiles(width, height, 32);
+    TileScheduler scheduler(tiles.size(), pool.Size());
+    std::vector<int> hits_per_worker(pool.Size(), 0);
+
+    const auto start{Clock::now()};
+    pool.Run([&](int worker) {
+        int hits{0};
+        while(const auto t = scheduler.Next(worker)) {
+            const auto& tile = tiles[t.value()];
+            if(packets) {
+                hits += TracePacketTile(accel, cam, tile, width, height);
+                continue;
+            }
+            for(int y = tile.y0; y < tile.y1; ++y) {
+                for(int x = tile.x0; x < tile.x1; ++x) {
+                    const auto u{(static_cast<float>(x) + 0.5f) / static_cast<float>(width)};
+                    const auto v{(static_cast<float>(height - 1 - y) + 0.5f) / static_cast<float>(height)};
+                    if(accel.Hit(cam.GetRay(u,v), 0.f, std::numeric_limits<float>::max())) {++hits;}
+                }
+            }
+        }
+        hits_per_worker[worker] = hits;
+    });
+    const std::chrono::duration<double> elapsed{Clock::now() - start};
+
+    hit_count = 0;
+    for(const auto h : hits_per_worker) {hit_count += h;}
+    return static_cast<double>(width) * height / elapsed.count() / 1e6;
+}
+
+/// @brief A ray as it was traced during a render
+struct RecordedRay
+{
+    Ray ray;
+    float t_low;
+    float t_high;
+};
+
+/// @brief An evenly spaced sample of a stream of rays, in the order they came, of at most capacity rays.
+/// @brief Every stride-th ray is kept; when the sample fills up, every other ray in it is dropped and the stride doubles.
+class RaySample
+{
+public:
+    explicit RaySample(std::size_t capacity) : m_capacity{std::max<std::size_t>(capacity, 2)} {}
+
+    void Add(const RecordedRay& ray)
+    {
+        if(m_seen++ % m_stride != 0) return;
+        m_rays.push_back(ray);
+        if(m_rays.size() < m_capacity) return;
+        for(std::size_t i = 0; 2 * i < m_rays.size(); ++i) {m_rays[i] = m_rays[2 * i];}
+        m_rays.erase(m_rays.begin() + static_cast<std::ptrdiff_t>((m_rays.size() + 1) / 2), m_rays.end());
+        m_stride *= 2;
+    }
+
+    [[nodiscard]] std::uint64_t Seen() const noexcept {return m_seen;}
+    [[nodiscard]] const std::vector<RecordedRay>& Rays() const noexcept {return m_rays;}
+
+private:
+    std::size_t m_capacity;
+    std::uint64_t m_seen{0};
+    std::uint64_t m_stride{1};
+    std::vector<RecordedRay> m_rays;
+};
+
+/// @brief Passes every query through to the scene, and counts and samples the rays by kind on the way.
+/// @brief The renderer traces primary rays in packets, reflected and refracted rays with Hit() and shadow rays with Occluded(),
+/// @brief so the three kinds can be told apart by the call alone. Each thread records into its own buffers.
+class RayRecorder : public Hittable
+{
+public:
+    /// @param capacity Most rays of each kind kept per thread
+    RayRecorder(const Hittable& scene, std::size_t capacity) : m_scene{scene}, m_capacity{capacity}, m_id{++s_last_id} {}
+
+    std::optional<HitData> Hit(const Ray& ray, float t_low, float t_high) const override
+    {
+        Buffers().secondary.Add(RecordedRay{ray, t_low, t_high});
+        return m_scene.Hit(ray, t_low, t_high);
+    }
+
+    bool Occluded(const Ray& ray, float t_low, float t_high) const override
+    {
+        Buffers().shadow.Add(RecordedRay{ray, t_low, t_high});
+        return m_scene.Occluded(ray, t_low, t_high);
+    }
+
+    void HitPacket(const RayPacket& packet, std::uint64_t active, float t_low, std::span<float> t_max, std::span<std::optional<HitData>> hits) const override
+    {
+        Buffers().primary += static_cast<std::uint64_t>(std::popcount(active));
+        m_scene.HitPacket(packet, active, t_low, t_max, hits);
+    }
+
+    AABB BoundingBox() const override {return m_scene.BoundingBox();}
+
+    struct Totals
+    {
+        std::uint64_t primary{0};
+        std::uint64_t secondary{0};
+        std::uint64_t shadow{0};
+        std::vector<RecordedRay> secondary_rays;
+        std::vector<RecordedRay> shadow_rays;
+    };
+
+    /// @brief The counts and samples of every thread put together
+    [[nodiscard]] Totals Collect() const
+    {
+        Totals totals;
+        std::lock_guard lock{m_mutex};
+        for(const auto& b : m_buffers) {
+            totals.primary += b.primary;
+            totals.secondary += b.secondary.Seen();
+            totals.shadow += b.shadow.Seen();
+            totals.secondary_rays.insert(totals.secondary_rays.end(), b.secondary.Rays().begin(), b.secondary.Rays().end());
+            totals.shadow_rays.insert(totals.shadow_rays.end(), b.shadow.Rays().begin(), b.shadow.Rays().end());
+        }
+        return totals;
+    }
+
+private:
+    struct ThreadBuffers
+    {
+        std::uint64_t primary{0};
+        RaySample secondary;
+        RaySample shadow;
+    };
+
+    /// @brief The calling thread's buffers, made on its first call. The cache is keyed by m_id rather than by address, since
+    /// @brief a later recorder may be made where an earlier one was destroyed, and must not pick up its freed buffers.
+    ThreadBuffers& Buffers() const
+    {
+        thread_local std::uint64_t owner{0};
+        thread_local ThreadBuffers* buffers{nullptr};
+        if(owner != m_id) {
+            std::lock_guard lock{m_mutex};
+            buffers = &m_buffers.emplace_back(ThreadBuffers{0, RaySample(m_capacity), RaySample(m_capacity)});
+            owner = m_id;
+        }
+        return *buffers;
+    }
+
+    static inline std::atomic<std::uint64_t> s_last_id{0};
+
+    const Hittable& m_scene;
+    std::size_t m_capacity;
+    std::uint64_t m_id; //unique to this recorder, never 0
+    mutable std::mutex m_mutex;
+    mutable std::deque<ThreadBuffers> m_buffers; //a deque, so buffers stay put as threads add theirs
+};
+
+/// @brief Traces recorded rays again on the pool and returns the rate in millions of rays per second
+/// @param shadow If true the rays are traced with Occluded(), otherwise with Hit()
+double ReplayRays(const Hittable& accel, std::span<const RecordedRay> rays, ThreadPool& pool, bool shadow)
+{
+    if(rays.empty()) return 0.0;
+    std::vector<std::uint64_t> hits_per_worker(pool.Size(), 0); //kept, so the queries cannot be optimised away
+    const auto start{Clock::now()};
+    pool.ParallelFor(rays.size(), [&](std::size_t begin, std::size_t end, int worker) {
+        std::uint64_t hits{0};
+        for(auto i = begin; i < end; ++i) {
+            const auto& [ray, t_low, t_high] = rays[i];
+            hits += shadow ? accel.Occluded(ray, t_low, t_high) : accel.Hit(ray, t_low, t_high).has_value();
+        }
+        hits_per_worker[worker] = hits;
+    });
+    const std::chrono::duration<double> elapsed{Clock::now() - start};
+    return static_cast<double>(rays.size()) / elapsed.count() / 1e6;
+}
+
+/// @brief Peak resident set size of this process so far, in megabytes
+double PeakRSSMegabytes()
+{
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<double>(usage.ru_maxrss) / 1024.0; //kilobytes on Linux
+}
+
+double Milliseconds(Clock::duration d) {return std::chrono::duration<double, std::milli>(d).count();}
+
+/// @brief Writes "key": value lines of a JSON object
+class JsonFields
+{
+public:
+    JsonFields(std::ostream& out, std::string_view indent) : m_out{out}, m_indent{indent} {}
+
+    template<typename T>
+    JsonFields& Add(std::string_view key, const T& value)
+    {
+        m_out << (m_first ? "" : ",\n") << m_indent << '"' << key << "\": ";
+        if constexpr(std::is_convertible_v<T, std::string_view>) {m_out << '"' << value << '"';}
+        else if constexpr(std::is_floating_point_v<T>) {m_out << std::fixed << std::setprecision(3) << value;}
+        else {m_out << value;}
+        m_first = false;
+        return *this;
+    }
+
+private:
+    std::ostream& m_out;
+    std::string_view m_indent;
+    bool m_first{true};
+};
+
+/// @brief Most rays of each kind kept for replay, over all threads
+constexpr std::size_t kReplayRays{1 << 22};
+
+/// @brief Makes, builds, traces and renders one scene of the suite, and returns its results as a JSON object
+std::optional<std::string> RunScene(std::string_view name, const BenchOptions& options)
+{
+    ThreadPool pool(options.num_threads);
+    std::string error;
+
+    //Generating the scene includes building the BVHs inside SphereSets and TriangleMeshes
+    const auto scene_start{Clock::now()};
+    auto bench = MakeBenchScene(name, options, pool, error);
+    if(!bench) {
+        std::cerr << error << '\n';
+        return std::nullopt;
+    }
+    const auto scene_time{Clock::now() - scene_start};
+    const auto& [scene, cam, lights] = *bench;
+
+    const auto build_start{Clock::now()};
+    const auto accel = BuildAccelerator(options.accel, scene.world, &pool);
+    const auto build_time{Clock::now() - build_start};
+
+    double primary{0.0}, primary_packets{0.0};
+    int hits{0}, packet_hits{0};
+    for(int r = 0; r < options.repeats; ++r) {
+        primary = std::max(primary, TracePrimaryRays(*accel, cam, options.width, options.height, pool, false, hits));
+        primary_packets = std::max(primary_packets, TracePrimaryRays(*accel, cam, options.width, options.height, pool, true, packet_hits));
+    }
+    if(packet_hits != hits) {std::cerr << "warning: packets hit " << packet_hits << " times, single rays " << hits << '\n';}
+
+    RenderSettings settings;
+    settings.samples_per_pixel = options.samples_per_pixel;
+    settings.max_depth = options.max_depth;
+    Framebuffer image(options.width, options.height);
+    auto render_time{Clock::duration::max()};
+    for(int r = 0; r < options.repeats; ++r) {
+        const auto start{Clock::now()};
+        Render(cam, accel.get(), scene.materials, lights, settings, pool, image);
+        render_time = std::min(render_time, Clock::now() - start);
+    }
+    //Before the recorded rays add to it
+    const auto peak_rss{PeakRSSMegabytes()};
+
+    //Render once more through a recorder to count the rays of each kind, then time samples of them on their own
+    RayRecorder recorder(*accel, kReplayRays / static_cast<std::size_t>(pool.Size()));
+    Render(cam, &recorder, scene.materials, lights, settings, pool, image);
+    const auto rays = recorder.Collect();
+    double secondary{0.0}, shadow{0.0};
+    for(int r = 0; r < options.repeats; ++r) {
+        secondary = std::max(secondary, ReplayRays(*accel, rays.secondary_rays, pool, false));
+        shadow = std::max(shadow, ReplayRays(*accel, rays.shadow_rays, pool, true));
+    }
+    const auto total_rays{rays.primary + rays.secondary + rays.shadow};
+    const auto render_seconds{std::chrono::duration<double>(render_time).count()};
+
+    std::ostringstream out;
+    out << "    {\n";
+    JsonFields(out, "      ")
+        .Add("name", name)
+        .Add("primitives", CountPrimitives(scene.world))
+        .Add("lights", lights.size())
+        .Add("scene_ms", Milliseconds(scene_time))
+        .Add("build_ms", Milliseconds(build_time))
+        .Add("render_ms", Milliseconds(render_time))
+        .Add("primary_rays", rays.primary)
+        .Add("secondary_rays", rays.secondary)
+        .Add("shadow_rays", rays.shadow)
+        .Add("render_mrays", static_cast<double>(total_rays) / render_seconds / 1e6)
+        .Add("primary_mrays", primary)
+        .Add("primary_packet_mrays", primary_packets)
+        .Add("secondary_mrays", secondary)
+        .Add("shadow_mrays", shadow)
+        .Add("peak_rss_mb", peak_rss);
+    out << "\n    }";
+    return out.str();
+}
+
+/// @brief Runs fn in a child process, so that what it allocates cannot add to what later runs measure, and returns what it returned
+std::optional<std::string> RunIsolated(const std::function<std::optional<std::string>()>& fn)
+{
+    int fds[2];
+    if(pipe(fds) != 0) return std::nullopt;
+    std::cout.flush();
+    const auto pid{fork()};
+    if(pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return std::nullopt;
+    }
+    if(pid == 0) {
+        close(fds[0]);
+        const auto result{fn()};
+        std::string_view left{result ? *result : std::string_view{}};
+        while(!left.empty()) {
+            const auto written{write(fds[1], left.data(), left.size())};
+            if(written <= 0) break;
+            left.remove_prefix(static_cast<std::size_t>(written));
+        }
+        close(fds[1]);
+        _exit(result && left.empty() ? 0 : 1);
+    }
+
+    close(fds[1]);
+    std::string text;
+    std::array<char, 4096> chunk;
+    while(true) {
+        const auto got{read(fds[0], chunk.data(), chunk.size())};
+        if(got <= 0) break;
+        text.append(chunk.data(), static_cast<std::size_t>(got));
+    }
+    close(fds[0]);
+    int status{0};
+    waitpid(pid, &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) return std::nullopt;
+    return text;
+}
+
+/// @brief The numbers reported for one scene, or with an empty name, for the run as a whole
+struct Metrics
+{
+    std::string name;
+    std::vector<std::pair<std::string, double>> values;
+
+    [[nodiscard]] std::optional<double> Find(std::string_view key) const
+    {
+        for(const auto& [k, v] : values) {if(k == key) return v;}
+        return std::nullopt;
+    }
+};
+
+/// @brief Reads the results written by this program back: every "key": number pair, grouped by the "name" before it.
+/// @brief This is no general JSON parser, but it reads any file this program writes, even after reformatting.
+std::vector<Metrics> ParseMetrics(std::string_view json)
+{
+    std::vector<Metrics> metrics(1);
+    const auto skip_space = [&](std::size_t p) {
+        while(p < json.size() && std::isspace(static_cast<unsigned char>(json[p]))) {++p;}
+        return p;
+    };
+    std::size_t p{0};
+    while((p = json.find('"', p)) != std::string_view::npos) {
+        const auto key_end{json.find('"', p + 1)};
+        if(key_end == std::string_view::npos) break;
+        const auto key{json.substr(p + 1, key_end - p - 1)};
+        p = skip_space(key_end + 1);
+        if(p >= json.size() || json[p] != ':') continue; //a string value, not a key
+        p = skip_space(p + 1);
+        if(p < json.size() && json[p] == '"') {
+            const auto value_end{json.find('"', p + 1)};
+            if(value_end == std::string_view::npos) break;
+            if(key == "name") {metrics.push_back(Metrics{std::string(json.substr(p + 1, value_end - p - 1)), {}});}
+            p = value_end + 1;
+            continue;
+        }
+        double value{0.0};
+        const auto parsed{std::from_chars(json.data() + p, json.data() + json.size(), value)};
+        if(parsed.ec == std::errc{}) {metrics.back().values.emplace_back(std::string(key), value);}
+    }
+    return metrics;
+}
+
+/// @brief Whether a larger value of a metric is better or worse, or if neither, it describes the workload
+enum class Direction
+{
+    HIGHER_IS_BETTER,
+    LOWER_IS_BETTER,
+    WORKLOAD
+};
+
+Direction MetricDirection(std::string_view key)
+{
+    if(key.ends_with("_mrays")) return Direction::HIGHER_IS_BETTER;
+    if(key.ends_with("_ms") || key.ends_with("_mb")) return Direction::LOWER_IS_BETTER;
+    return Direction::WORKLOAD;
+}
+
+/// @brief Prints how each metric compares with the baseline, and returns false if any is worse by more than the tolerance
+bool CompareWithBaseline(const std::vector<Metrics>& current, const std::vector<Metrics>& baseline, double tolerance)
+{
+    bool ok{true};
+    for(const auto& run : current) {
+        const auto base = std::find_if(baseline.begin(), baseline.end(), [&](const Metrics& m) {return m.name == run.name;});
+        if(base == baseline.end()) {
+            std::cerr << run.name << ": not in the baseline\n";
+            continue;
+        }
+        for(const auto& [key, value] : run.values) {
+            const auto old{base->Find(key)};
+            if(!old) continue;
+            const auto direction{MetricDirection(key)};
+            if(direction == Direction::WORKLOAD) {
+                if(value != *old) {
+                    std::cerr << std::defaultfloat << (run.name.empty() ? "settings" : run.name) << ": " << key << " is " << value
+                              << " but was " << *old << " in the baseline, so the results are not comparable\n";
+                }
+                continue;
+            }
+            if(*old <= 0.0 || value <= 0.0) continue;
+            //Above 1 is an improvement, whichever way the metric goes
+            const auto ratio{direction == Direction::HIGHER_IS_BETTER ? value / *old : *old / value};
+            //Timings of under a millisecond are mostly noise, so they are shown but never fail the comparison
+            const auto negligible{key.ends_with("_ms") && std::max(value, *old) < 1.0};
+            const auto regressed{!negligible && ratio < 1.0 / (1.0 + tolerance)};
+            ok = ok && !regressed;
+            std::cerr << std::left << std::setw(12) << run.name << std::setw(22) << key << std::right << std::fixed << std::setprecision(3)
+                      << std::setw(14) << *old << std::setw(14) << value << std::setw(8) << std::setprecision(2) << ratio << 'x'
+                      << (regressed ? "  REGRESSION" : "") << '\n';
+        }
+    }
+    return ok;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    std::vector<std::string_view> scenes(kSuite.begin(), kSuite.end());
+    std::string json_path;     //if set, the results are written here rather than to stdout
+    std::string baseline_path; //if set, the results are compared with those in this file
+    double tolerance{0.1};     //how much worse than the baseline a metric may be before it counts as a regression
+    for(int a = 1; a < argc; ++a) {
+        const std::string_view arg{argv[a]};
+        if(arg == "--threads" && a + 1 < argc) {options.num_threads = std::atoi(argv[++a]);}
+        else if(arg == "--size" && a + 2 < argc) {options.width = std::atoi(argv[++a]); options.height = std::atoi(argv[++a]);}
+        else if(arg == "--spp" && a + 1 < argc) {options.samples_per_pixel = std::atoi(argv[++a]);}
+        else if(arg == "--depth" && a + 1 < argc) {options.max_depth = std::atoi(argv[++a]);}
+        else if(arg == "--repeats" && a + 1 < argc) {options.repeats = std::max(std::atoi(argv[++a]), 1);}
+        else if(arg == "--terrain" && a + 1 < argc) {options.terrain_resolution = std::atoi(argv[++a]);}
+        else if(arg == "--particles" && a + 1 < argc) {options.particle_count = std::strtoull(argv[++a], nullptr, 10);}
+        else if(arg == "--mesh" && a + 1 < argc) {options.mesh_spec = argv[++a];}
+        else if(arg == "--lights" && a + 1 < argc) {options.light_count = std::atoi(argv[++a]);}
+        else if(arg == "--json" && a + 1 < argc) {json_path = argv[++a];}
+        else if(arg == "--baseline" && a + 1 < argc) {baseline_path = argv[++a];}
+        else if(arg == "--tolerance" && a + 1 < argc) {tolerance = std::strtod(argv[++a], nullptr);}
+        else if(arg == "--accel" && a + 1 < argc) {
+            const auto type = ParseAccelType(argv[++a]);
+            if(!type) {
+                std::cerr << "unknown acceleration structure " << argv[a] << '\n';
+                return 1;
+            }
+            options.accel = type.value();
+        }
+        else if(arg == "--scene" && a + 1 < argc) {
+            //Repeated to run several; the first replaces the whole suite
+            const std::string_view name{argv[++a]};
+            if(std::find(kSuite.begin(), kSuite.end(), name) == kSuite.end()) {
+                std::cerr << "unknown scene " << name << '\n';
+                return 1;
+            }
+            if(scenes.size() == kSuite.size() && std::equal(scenes.begin(), scenes.end(), kSuite.begin())) {scenes.clear();}
+            scenes.push_back(name);
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--threads N] [--size W H] [--spp N] [--depth N] [--repeats N] [--accel bvhnode|linear|bvh4|bvh8]"
+                         " [--scene random|glass|mesh|particles|many_lights]... [--terrain RESOLUTION] [--mesh obj:FILE|ply:FILE]"
+                         " [--particles COUNT] [--lights N] [--json FILE] [--baseline FILE [--tolerance FRACTION]]\n";
+            return 1;
+        }
+    }
+    if(options.width <= 0 || options.height <= 0 || options.samples_per_pixel <= 0) {
+        std::cerr << "size and samples per pixel must be positive\n";
+        return 1;
+    }
+    if(options.terrain_resolution <= 0 || options.terrain_resolution > kMaxTerrainResolution) {
+        std::cerr << "terrain resolution must be between 1 and " << kMaxTerrainResolution << '\n';
+        return 1;
+    }
+
+    //Each scene runs in its own process, so that its peak RSS is its own. No threads may be started here before the forks.
+    std::ostringstream json;
+    JsonFields(json, "  ")
+        .Add("threads", options.num_threads > 0 ? options.num_threads : static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u)))
+        .Add("width", options.width)
+        .Add("height", options.height)
+        .Add("samples_per_pixel", options.samples_per_pixel)
+        .Add("max_depth", options.max_depth)
+        .Add("repeats", options.repeats)
+        .Add("accel", AccelName(options.accel));
+    json << ",\n  \"scenes\": [\n";
+    bool first{true};
+    for(const auto name : scenes) {
+        std::cerr << "running " << name << "...\n";
+        const auto result = RunIsolated([&] {return RunScene(name, options);});
+        if(!result) {
+            std::cerr << name << " failed\n";
+            return 1;
+        }
+        json << (first ? "" : ",\n") << *result;
+        first = false;
+    }
+    const auto text{"{\n" + json.str() + "\n  ]\n}\n"};
+
+    if(json_path.empty()) {std::cout << text;}
+    else if(!(std::ofstream(json_path) << text)) {
+        std::cerr << "cannot write " << json_path << '\n';
+        return 1;
+    }
+
+    if(!baseline_path.empty()) {
+        std::ifstream file(baseline_path);
+        if(!file) {
+            std::cerr << "cannot read " << baseline_path << '\n';
+            return 1;
+        }
+        std::stringstream baseline;
+        baseline << file.rdbuf();
+        std::cerr << std::left << std::setw(12) << "scene" << std::setw(22) << "metric" << std::right
+                  << std::setw(14) << "baseline" << std::setw(14) << "now" << std::setw(9) << "ratio" << '\n';
+        if(!CompareWithBaseline(ParseMetrics(text), ParseMetrics(baseline.str()), tolerance)) {
+            std::cerr << "slower than the baseline by more than " << tolerance * 100.0 << "%\n";
+            return 2;
+        }
+    }
+    return 0;
+}
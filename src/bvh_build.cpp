@@ -0,0 +1,422 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+
+#include "bvh_build.h"
+#include "thread_pool.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kMaxBins{32};
+
+//Ranges smaller than this are not worth spreading over threads
+constexpr std::size_t kMinParallelPrims{1 << 14};
+
+struct Bin
+{
+    AABB bounds;
+    int count{0};
+};
+
+using AxisBins = std::array<std::array<Bin, kMaxBins>, 3>;
+
+/// @brief Bounds of a range of primitives and of their centroids
+struct RangeBounds
+{
+    AABB bounds;
+    AABB centroid_bounds;
+};
+
+/// @brief The best split found for a range of primitives
+struct Split
+{
+    int axis{-1};
+    int bin{0}; //primitives in bins [0,bin] go left
+    float cost{std::numeric_limits<float>::max()};
+};
+
+/// @brief True if a node at depth with count primitives has to be halved by count to keep its leaves within kMaxBVHDepth.
+/// @brief Halving takes ceil(log2(count)) levels, and any other split at least as many from the level below.
+bool MustHalve(int depth, int count)
+{
+    return depth + 1 + static_cast<int>(std::bit_width(static_cast<unsigned>(count - 1))) > kMaxBVHDepth;
+}
+
+double MillisecondsSince(Clock::time_point start) 
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+class Builder
+{
+public:
+    Builder(std::vector<BVHPrimitiveInfo>& prims, const BVHBuildOptions& options)
+        : m_prims{prims}, m_options{options} {}
+
+    /// @brief Appends the subtree for prims [begin,end) to nodes and returns the index of its root.
+    /// @brief Only touches prims in [begin,end), so disjoint ranges can be built concurrently.
+    /// @param depth Depth of the subtree's root in the whole tree
+    int BuildRecursive(std::vector<BVHBuildNode>& nodes, int begin, int end, int depth)
+    {
+        assert(begin < end);
+        const auto node_index{static_cast<int>(nodes.size())};
+        nodes.emplace_back();
+
+        const auto range{ComputeBounds(begin, end)};
+        nodes[node_index].bounds = range.bounds;
+        if(end - begin == 1) {
+            MakeLeaf(nodes[node_index], begin, end);
+            return node_index;
+        }
+
+        //#1 Pick a split plane
+        AxisBins bins{};
+        BinRange(begin, end, range.centroid_bounds, bins);
+        auto split{EvaluateSplit(bins, range)};
+        if(ShouldMakeLeaf(end - begin, split)) {
+            MakeLeaf(nodes[node_index], begin, end);
+            return node_index;
+        }
+        if(MustHalve(depth, end - begin)) {split = Split{};}
+
+        //#2 Partition in place, then recurse. The left child is always node_index+1, so only the right child needs to be recorded.
+        int axis{0};
+        const auto mid{Partition(begin, end, split, range.centroid_bounds, axis)};
+        nodes[node_index].split_axis = axis;
+        BuildRecursive(nodes, begin, mid, depth + 1);
+        const auto right{BuildRecursive(nodes, mid, end, depth + 1)};
+        nodes[node_index].right_child = right;
+        return node_index;
+    }
+
+    RangeBounds ComputeBounds(int begin, int end) const
+    {
+        RangeBounds range;
+        for(int p = begin; p < end; ++p) {
+            range.bounds.Extend(m_prims[p].bounds);
+            range.centroid_bounds.Extend(m_prims[p].centroid);
+        }
+        return range;
+    }
+
+    /// @brief Adds the centroids of prims [begin,end) to the bins of each axis
+    void BinRange(int begin, int end, const AABB& centroid_bounds, AxisBins& bins) const
+    {
+        for(int axis = 0; axis < 3; ++axis)
+        {
+            const auto cmin{centroid_bounds.min[axis]};
+            const auto extent{centroid_bounds.max[axis] - cmin};
+            if(!(extent > 0.f)) continue; //all centroids coincide on this axis, so it cannot separate them
+
+            for(int p = begin; p < end; ++p) {
+                auto& bin = bins[axis][BinIndex(m_prims[p].centroid[axis], cmin, extent)];
+                bin.bounds.Extend(m_prims[p].bounds);
+                ++bin.count;
+            }
+        }
+    }
+
+    /// @brief Returns the split with the lowest SAH cost over the binned planes of every axis
+    Split EvaluateSplit(const AxisBins& bins, const RangeBounds& range) const
+    {
+        const auto num_bins{m_options.num_bins};
+        const auto area{range.bounds.SurfaceArea()};
+        const auto inv_area{area > 0.f ? 1.f / area : 0.f};
+        Split best;
+
+        for(int axis = 0; axis < 3; ++axis)
+        {
+            if(!(range.centroid_bounds.max[axis] - range.centroid_bounds.min[axis] > 0.f)) continue;
+
+            //Sweep from the right to get the area and count of everything right of each plane...
+            std::array<float, kMaxBins> right_area{};
+            std::array<int, kMaxBins> right_count{};
+            AABB acc;
+            int count{0};
+            for(int b = num_bins - 1; b > 0; --b) {
+                acc.Extend(bins[axis][b].bounds);
+                count += bins[axis][b].count;
+                right_area[b-1] = acc.SurfaceArea();
+                right_count[b-1] = count;
+            }
+
+            //...then from the left, evaluating the SAH at each plane
+            acc = AABB{};
+            count = 0;
+            for(int b = 0; b < num_bins - 1; ++b) {
+                acc.Extend(bins[axis][b].bounds);
+                count += bins[axis][b].count;
+                if(count == 0 || right_count[b] == 0) continue;
+
+                const auto cost{m_options.traversal_cost + 
+                                (count * acc.SurfaceArea() + right_count[b] * right_area[b]) * inv_area};
+                if(cost < best.cost) {best = Split{axis, b, cost};}
+            }
+        }
+        return best;
+    }
+
+    bool ShouldMakeLeaf(int count, const Split& split) const
+    {
+        const auto leaf_cost{static_cast<float>(count)};
+        return count <= m_options.max_prims_in_leaf && !(split.cost < leaf_cost);
+    }
+
+    /// @brief Partitions prims [begin,end) about the split and returns the start of the right half.
+    /// @brief A split without an axis halves the range by count.
+    /// @param axis Receives the axis that was split along
+    int Partition(int begin, int end, const Split& split, const AABB& centroid_bounds, int& axis)
+    {
+        int mid{0};
+        axis = split.axis;
+        if(axis >= 0) {
+            const auto cmin{centroid_bounds.min[axis]};
+            const auto extent{centroid_bounds.max[axis] - cmin};
+            const auto it = std::partition(m_prims.begin() + begin, m_prims.begin() + end, [&](const BVHPrimitiveInfo& p) {
+                return BinIndex(p.centroid[axis], cmin, extent) <= split.bin;
+            });
+            mid = static_cast<int>(it - m_prims.begin());
+        }
+        else {
+            //Every centroid is in the same place so binning cannot separate them, or the tree is near its depth limit.
+            //Just halve the range.
+            axis = centroid_bounds.MaxExtentAxis();
+            mid = begin + (end - begin) / 2;
+            std::nth_element(m_prims.begin() + begin, m_prims.begin() + mid, m_prims.begin() + end, [axis](auto&& a, auto&& b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+        }
+        assert(begin < mid && mid < end);
+        return mid;
+    }
+
+private:
+    /// @brief Maps a centroid coordinate to one of num_bins bins spanning [cmin, cmin+extent]
+    int BinIndex(float c, float cmin, float extent) const 
+    {
+        const auto b{static_cast<int>(m_options.num_bins * ((c - cmin) / extent))};
+        return std::clamp(b, 0, m_options.num_bins - 1);
+    }
+
+    static void MakeLeaf(BVHBuildNode& node, int begin, int end)
+    {
+        node.first_prim = begin;
+        node.prim_count = end - begin;
+    }
+
+private:
+    std::vector<BVHPrimitiveInfo>& m_prims;
+    const BVHBuildOptions& m_options;
+};
+
+}
+
+namespace {
+
+/// @brief Builds the top of the tree serially (but with parallel binning) until the remaining ranges are small 
+/// @brief enough to hand out as tasks, builds those subtrees concurrently, and then stitches the pieces together.
+class ParallelBuilder
+{
+public:
+    ParallelBuilder(std::vector<BVHPrimitiveInfo>& prims, const BVHBuildOptions& options, ThreadPool& pool)
+        : m_builder{prims, options}, m_prims{prims}, m_pool{pool}
+    {
+        //Aim for several tasks per worker so that uneven subtrees still balance out
+        m_task_size = std::max<std::size_t>(kMinParallelPrims / 4, prims.size() / (8 * static_cast<std::size_t>(pool.Size())));
+    }
+
+    std::vector<BVHBuildNode> Build(BVHBuildStats* stats)
+    {
+        //#1 Top of the tree
+        auto start{Clock::now()};
+        BuildTop(0, static_cast<int>(m_prims.size()), 0);
+        if(stats) {stats->top_ms = MillisecondsSince(start);}
+
+        //#2 Subtrees, biggest first, each into its own array
+        start = Clock::now();
+        std::vector<std::size_t> order(m_tasks.size());
+        for(std::size_t t = 0; t < order.size(); ++t) {order[t] = t;}
+        std::sort(order.begin(), order.end(), [&](auto a, auto b) {return m_tasks[a].Size() > m_tasks[b].Size();});
+
+        std::atomic<std::size_t> next{0};
+        m_pool.Run([&](int) {
+            for(auto i = next.fetch_add(1); i < order.size(); i = next.fetch_add(1)) {
+                auto& task = m_tasks[order[i]];
+                task.nodes.reserve(2 * task.Size());
+                m_builder.BuildRecursive(task.nodes, task.begin, task.end, task.depth);
+            }
+        });
+        if(stats) {
+            stats->subtree_ms = MillisecondsSince(start);
+            stats->subtree_tasks = static_cast<int>(m_tasks.size());
+        }
+
+        //#3 One depth-first array
+        start = Clock::now();
+        std::size_t total{m_top.size()};
+        for(const auto& task : m_tasks) {total += task.nodes.size();}
+        std::vector<BVHBuildNode> nodes;
+        nodes.reserve(total);
+        Stitch(nodes, 0);
+        if(stats) {stats->stitch_ms = MillisecondsSince(start);}
+        return nodes;
+    }
+
+private:
+    struct Task
+    {
+        int begin;
+        int end;
+        int depth; //of the subtree's root in the whole tree
+        std::vector<BVHBuildNode> nodes;
+
+        [[nodiscard]] std::size_t Size() const noexcept {return static_cast<std::size_t>(end - begin);}
+    };
+
+    /// @brief Like Builder::BuildRecursive, but stops at ranges of at most m_task_size and records them as tasks.
+    /// @brief The top nodes are also depth-first, with a task standing in for each unbuilt subtree.
+    int BuildTop(int begin, int end, int depth)
+    {
+        const auto node_index{static_cast<int>(m_top.size())};
+        m_top.emplace_back();
+        m_task_of.push_back(-1);
+
+        const auto count{static_cast<std::size_t>(end - begin)};
+        if(count <= m_task_size) {
+            m_task_of[node_index] = static_cast<int>(m_tasks.size());
+            m_tasks.push_back(Task{begin, end, depth, {}});
+            return node_index;
+        }
+
+        //Large ranges: compute bounds and bins in parallel, one chunk per worker, then merge
+        const auto workers{static_cast<std::size_t>(m_pool.Size())};
+        std::vector<RangeBounds> partial_bounds(workers);
+        m_pool.ParallelFor(count, [&](std::size_t b, std::size_t e, int w) {
+            partial_bounds[w] = m_builder.ComputeBounds(begin + static_cast<int>(b), begin + static_cast<int>(e));
+        });
+        RangeBounds range;
+        for(const auto& partial : partial_bounds) {
+            range.bounds.Extend(partial.bounds);
+            range.centroid_bounds.Extend(partial.centroid_bounds);
+        }
+        m_top[node_index].bounds = range.bounds;
+
+        std::vector<AxisBins> partial_bins(workers, AxisBins{});
+        m_pool.ParallelFor(count, [&](std::size_t b, std::size_t e, int w) {
+            m_builder.BinRange(begin + static_cast<int>(b), begin + static_cast<int>(e), range.centroid_bounds, partial_bins[w]);
+        });
+        AxisBins bins{};
+        for(const auto& partial : partial_bins) {
+            for(int axis = 0; axis < 3; ++axis) {
+                for(int b = 0; b < kMaxBins; ++b) {
+                    bins[axis][b].bounds.Extend(partial[axis][b].bounds);
+                    bins[axis][b].count += partial[axis][b].count;
+                }
+            }
+        }
+
+        //A range this large is never a leaf, so always split
+        int axis{0};
+        const auto split{MustHalve(depth, end - begin) ? Split{} : m_builder.EvaluateSplit(bins, range)};
+        const auto mid{m_builder.Partition(begin, end, split, range.centroid_bounds, axis)};
+        m_top[node_index].split_axis = axis;
+        BuildTop(begin, mid, depth + 1);
+        const auto right{BuildTop(mid, end, depth + 1)};
+        m_top[node_index].right_child = right;
+        return node_index;
+    }
+
+    /// @brief Appends the subtree under top node `top` to nodes, splicing in task subtrees, and returns its root index
+    int Stitch(std::vector<BVHBuildNode>& nodes, int top)
+    {
+        const auto base{static_cast<int>(nodes.size())};
+        if(const auto t = m_task_of[top]; t >= 0) {
+            //Task subtrees are depth-first from index 0, so shift their child links
+            for(auto node : m_tasks[t].nodes) {
+                if(!node.IsLeaf()) {node.right_child += base;}
+                nodes.push_back(node);
+            }
+            return base;
+        }
+
+        nodes.push_back(m_top[top]);
+        Stitch(nodes, top + 1);
+        const auto right{Stitch(nodes, m_top[top].right_child)};
+        nodes[base].right_child = right;
+        return base;
+    }
+
+private:
+    Builder m_builder;
+    std::vector<BVHPrimitiveInfo>& m_prims;
+    ThreadPool& m_pool;
+    std::size_t m_task_size;
+
+    std::vector<BVHBuildNode> m_top;
+    std::vector<int> m_task_of; //for each top node, the task that replaces it, or -1
+    std::vector<Task> m_tasks;
+};
+
+}
+
+std::vector<BVHPrimitiveInfo> ComputePrimitiveInfo(const std::vector<std::shared_ptr<Hittable>>& objects, const BVHBuildOptions& options)
+{
+    const auto start{Clock::now()};
+    std::vector<BVHPrimitiveInfo> prims(objects.size());
+    const auto compute = [&](std::size_t begin, std::size_t end, int) {
+        for(auto i = begin; i < end; ++i) {
+            const auto bounds{objects[i]->BoundingBox()};
+            prims[i] = BVHPrimitiveInfo{bounds, bounds.Centroid(), static_cast<std::uint32_t>(i)};
+        }
+    };
+
+    if(options.pool && objects.size() >= kMinParallelPrims) {options.pool->ParallelFor(objects.size(), compute);}
+    else {compute(0, objects.size(), 0);}
+
+    if(options.stats) {options.stats->info_ms = MillisecondsSince(start);}
+    return prims;
+}
+
+std::vector<BVHBuildNode> BuildBVH(std::vector<BVHPrimitiveInfo>& prims, const BVHBuildOptions& options)
+{
+    assert(options.num_bins >= 2 && options.num_bins <= kMaxBins);
+    assert(options.max_prims_in_leaf >= 1);
+
+    std::vector<BVHBuildNode> nodes;
+    if(prims.empty()) return nodes;
+
+    if(options.pool && options.pool->Size() > 1 && prims.size() >= kMinParallelPrims) {
+        nodes = ParallelBuilder(prims, options, *options.pool).Build(options.stats);
+    }
+    else {
+        const auto start{Clock::now()};
+        //A balanced tree has fewer than 2n nodes
+        nodes.reserve(2 * prims.size());
+        Builder(prims, options).BuildRecursive(nodes, 0, static_cast<int>(prims.size()), 0);
+        if(options.stats) {options.stats->subtree_ms = MillisecondsSince(start);}
+    }
+
+    if(options.stats) {options.stats->node_count = nodes.size();}
+    return nodes;
+}
+
+std::ostream& operator<<(std::ostream& out, const BVHBuildStats& stats)
+{
+    const auto flags{out.flags()};
+    const auto precision{out.precision()};
+    out << std::fixed << std::setprecision(1)
+        << "info " << stats.info_ms << " ms, top " << stats.top_ms << " ms, subtrees " << stats.subtree_ms 
+        << " ms (" << stats.subtree_tasks << " tasks), stitch " << stats.stitch_ms << " ms, finalize " << stats.finalize_ms 
+        << " ms, total " << stats.TotalMs() << " ms, " << stats.node_count << " nodes";
+    out.flags(flags);
+    out.precision(precision);
+    return out;
+}
@@ -0,0 +1,61 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include "framebuffer.h"
+
+namespace {
+
+/// @brief Maps a linear color component to [0,255] with a gamma correction value of 2
+unsigned char ToByte(float c) 
+{
+    return static_cast<unsigned char>(256 * std::clamp(sqrtf(std::max(c, 0.f)), 0.f, 0.999f));
+}
+
+/// @brief Writes a header followed by the pixel payload in one call
+bool WriteFile(const std::string& path, const std::string& header, const char* data, std::size_t size) 
+{
+    std::ofstream out(path, std::ios::binary);
+    if(!out) return false;
+    out.write(header.data(), static_cast<std::streamsize>(header.size()));
+    out.write(data, static_cast<std::streamsize>(size));
+    return static_cast<bool>(out);
+}
+
+}
+
+bool Framebuffer::WriteP6(const std::string& path) const
+{
+    std::vector<unsigned char> bytes(m_pixels.size() * 3);
+    for(std::size_t p = 0; p < m_pixels.size(); ++p) {
+        bytes[3*p + 0] = ToByte(m_pixels[p].X());
+        bytes[3*p + 1] = ToByte(m_pixels[p].Y());
+        bytes[3*p + 2] = ToByte(m_pixels[p].Z());
+    }
+
+    const auto header = "P6\n" + std::to_string(m_width) + ' ' + std::to_string(m_height) + "\n255\n";
+    return WriteFile(path, header, reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+bool Framebuffer::WritePFM(const std::string& path) const
+{
+    static_assert(sizeof(float) == 4);
+
+    //PFM stores rows bottom to top, whereas the framebuffer is top to bottom
+    std::vector<float> floats(m_pixels.size() * 3);
+    auto out = floats.begin();
+    for(int y = m_height - 1; y >= 0; --y) {
+        for(int x = 0; x < m_width; ++x) {
+            const auto& c = At(x,y);
+            *out++ = c.X();
+            *out++ = c.Y();
+            *out++ = c.Z();
+        }
+    }
+
+    //A negative scale marks the data as little-endian, which is the host byte order on every platform we target
+    const auto header = "PF\n" + std::to_string(m_width) + ' ' + std::to_string(m_height) + "\n-1.0\n";
+    return WriteFile(path, header, reinterpret_cast<const char*>(floats.data()), floats.size() * sizeof(float));
+}
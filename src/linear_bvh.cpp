@@ -0,0 +1,153 @@
+#include <chrono>
+#include <limits>
+#include <utility>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#include "linear_bvh.h"
+
+std::vector<LinearBVHNode> FlattenBVH(const std::vector<BVHBuildNode>& nodes)
+{
+    std::vector<LinearBVHNode> linear;
+    linear.reserve(nodes.size());
+    for(const auto& node : nodes) 
+    {
+        assert(node.prim_count <= std::numeric_limits<std::uint16_t>::max());
+        linear.push_back(LinearBVHNode{
+            node.bounds,
+            node.IsLeaf() ? node.first_prim : node.right_child,
+            static_cast<std::uint16_t>(node.prim_count),
+            static_cast<std::uint8_t>(node.split_axis),
+            0
+        });
+    }
+    return linear;
+}
+
+PacketRays MakePacketRays(const RayPacket& packet)
+{
+    PacketRays rays;
+    rays.origin = {packet.origin.X(), packet.origin.Y(), packet.origin.Z()};
+    for(int i = 0; i < RayPacket::kSize; ++i) {
+        //Unused slots get a harmless direction; they are never in a candidate mask
+        const auto in_packet{i < packet.count};
+        rays.inv_x[i] = in_packet ? 1.f / packet.dir_x[i] : 0.f;
+        rays.inv_y[i] = in_packet ? 1.f / packet.dir_y[i] : 0.f;
+        rays.inv_z[i] = in_packet ? 1.f / packet.dir_z[i] : 0.f;
+    }
+    return rays;
+}
+
+std::uint64_t IntersectPacket(const AABB& box, const PacketRays& rays, std::uint64_t candidates, float t_low, std::span<const float> t_max)
+{
+    std::uint64_t hits{0};
+#if defined(__AVX__)
+    //The same test as AABB::Intersects, 8 rays at a time: pick the near/far plane by the sign of each ray's inverse direction,
+    //and keep the running interval as the second operand of max/min so a NaN leaves it unchanged
+    const auto lo = _mm256_set1_ps(t_low);
+    const auto slab = [](float plane, float origin) {return _mm256_set1_ps(plane - origin);};
+    const auto min_x = slab(box.min.X(), rays.origin[0]), max_x = slab(box.max.X(), rays.origin[0]);
+    const auto min_y = slab(box.min.Y(), rays.origin[1]), max_y = slab(box.max.Y(), rays.origin[1]);
+    const auto min_z = slab(box.min.Z(), rays.origin[2]), max_z = slab(box.max.Z(), rays.origin[2]);
+
+    for(int group = 0; group < RayPacket::kSize / 8; ++group)
+    {
+        const auto group_mask{static_cast<std::uint32_t>((candidates >> (8 * group)) & 0xff)};
+        if(group_mask == 0) continue;
+
+        auto t0 = lo;
+        auto t1 = _mm256_loadu_ps(&t_max[8 * group]);
+        const auto axis = [&](__m256 inv, __m256 plane_min, __m256 plane_max) {
+            const auto to_min = _mm256_mul_ps(plane_min, inv);
+            const auto to_max = _mm256_mul_ps(plane_max, inv);
+            t0 = _mm256_max_ps(_mm256_blendv_ps(to_min, to_max, inv), t0);
+            t1 = _mm256_min_ps(_mm256_blendv_ps(to_max, to_min, inv), t1);
+        };
+        axis(_mm256_load_ps(&rays.inv_x[8 * group]), min_x, max_x);
+        axis(_mm256_load_ps(&rays.inv_y[8 * group]), min_y, max_y);
+        axis(_mm256_load_ps(&rays.inv_z[8 * group]), min_z, max_z);
+
+        const auto lanes{static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)))};
+        hits |= static_cast<std::uint64_t>(lanes & group_mask) << (8 * group);
+    }
+#else
+    const auto origin = Point3{rays.origin[0], rays.origin[1], rays.origin[2]};
+    while(candidates) {
+        const auto i{std::countr_zero(candidates)};
+        candidates &= candidates - 1;
+        const auto inv_dir = Vec3{rays.inv_x[i], rays.inv_y[i], rays.inv_z[i]};
+        const std::array<int,3> dir_is_neg{inv_dir.X() < 0.f, inv_dir.Y() < 0.f, inv_dir.Z() < 0.f};
+        if(box.Intersects(origin, inv_dir, dir_is_neg, t_low, t_max[i])) {hits |= std::uint64_t{1} << i;}
+    }
+#endif
+    return hits;
+}
+
+bool FrustumOverlaps(const RayPacket& packet, const AABB& box)
+{
+    for(const auto& n : packet.frustum) {
+        //The box corner furthest along the inward normal: if even that is outside, the whole box is
+        const auto corner = Point3{n.X() >= 0.f ? box.max.X() : box.min.X(), 
+                                   n.Y() >= 0.f ? box.max.Y() : box.min.Y(), 
+                                   n.Z() >= 0.f ? box.max.Z() : box.min.Z()};
+        if(Dot(n, corner - packet.origin) < 0.f) return false;
+    }
+    return true;
+}
+
+LinearBVH::LinearBVH(const HittableList& h, const BVHBuildOptions& options)
+{
+    const auto& objects = h.m_objects;
+
+    auto prims = ComputePrimitiveInfo(objects, options);
+    const auto nodes = BuildBVH(prims, options);
+
+    const auto start{std::chrono::steady_clock::now()};
+    auto linear = std::make_shared<const std::vector<LinearBVHNode>>(FlattenBVH(nodes));
+    m_nodes = *linear;
+    m_owner = std::move(linear);
+
+    //Store the primitives in the order the builder left them in, so leaves can index them directly
+    m_primitives.reserve(prims.size());
+    for(const auto& prim : prims) {m_primitives.push_back(objects[prim.index]);}
+    if(options.stats) {options.stats->finalize_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();}
+}
+
+LinearBVH::LinearBVH(std::vector<std::shared_ptr<Hittable>> primitives, std::span<const LinearBVHNode> nodes, std::shared_ptr<const void> owner)
+    : m_primitives{std::move(primitives)}, m_nodes{nodes}, m_owner{std::move(owner)} {}
+
+std::optional<HitData> LinearBVH::Hit(const Ray& ray, float t_low, float t_high) const
+{
+    std::optional<HitData> data;
+    TraverseLinearBVH(m_nodes, ray, t_low, t_high, [&](int first, int count, float& closest_so_far) {
+        bool found{false};
+        for(int i = first; i < first + count; ++i) {
+            if(auto tmp_data = m_primitives[i]->Hit(ray, t_low, closest_so_far); tmp_data) {
+                closest_so_far = tmp_data.value().hit_param;
+                data = std::move(tmp_data);
+                found = true;
+            }
+        }
+        return found;
+    });
+    return data;
+}
+
+bool LinearBVH::Occluded(const Ray& ray, float t_low, float t_high) const
+{
+    return TraverseLinearBVH<true>(m_nodes, ray, t_low, t_high, [&](int first, int count, float& t_max) {
+        for(int i = first; i < first + count; ++i) {
+            if(m_primitives[i]->Occluded(ray, t_low, t_max)) return true;
+        }
+        return false;
+    });
+}
+
+void LinearBVH::HitPacket(const RayPacket& packet, std::uint64_t active, float t_low, std::span<float> t_max, std::span<std::optional<HitData>> hits) const
+{
+    TraverseLinearBVHPacket(m_nodes, packet, active, t_low, t_max, [&](int first, int count, std::uint64_t rays) {
+        for(int i = first; i < first + count; ++i) {m_primitives[i]->HitPacket(packet, rays, t_low, t_max, hits);}
+    });
+}
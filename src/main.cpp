@@ -1,128 +1,197 @@
-#include <cassert>
-
-#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
-#include <fstream>
-#include <memory>
-#include <numbers>
-#include <numeric>
-#include <vector>
+#include <optional>
+#include <string>
+#include <string_view>
 
-#include "bvh.h"
-#include "camera.h"
-#include "hittable.h"
-#include "hittable_list.h"
+#include "accel.h"
+#include "framebuffer.h"
 #include "light.h"
-#include "material.h"
-#include "math.h"
-#include "ray.h"
-#include "sphere.h"
-#include "trace.h"
-#include "triangle.h"
-#include "rng.h"
+#include "render.h"
+#include "render_server.h"
+#include "renderer.h"
+#include "sampler.h"
+#include "scene_cache.h"
+#include "scenes.h"
+#include "thread_pool.h"
 #include "vec3.h"
 
-//Create the same scene as the final one from Shirley.
-HittableList RandomScene() {
-    HittableList world;
-    const auto mat_ground = std::make_shared<Material>(Material::MaterialType::DIFFUSE, Color(0.5f, 0.5f, 0.5f));
-    world.Add(std::make_shared<Sphere>(Point3(0.f,-1000.f,0.f), 1000.f, mat_ground));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            const auto choose_mat = RNG::Get().GenerateFloat(0.f,1.f);
-            const Point3 center(a + 0.9*RNG::Get().GenerateFloat(0.f,1.f), 0.2, b + 0.9*RNG::Get().GenerateFloat(0.f,1.f));
-
-            if ((center - Point3(4.f, 0.2f, 0.f)).Length() > 0.9f) {
-                std::shared_ptr<Material> sphere_material;
-
-                if (choose_mat < 0.8f) {
-                    // diffuse
-                    const auto albedo = Color::Random() * Color::Random();
-                    sphere_material = std::make_shared<Material>(Material::MaterialType::DIFFUSE, albedo);
-                    world.Add(std::make_shared<Sphere>(center, 0.2f, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    const auto albedo = Color::Random(0.5f, 1.f);
-                    sphere_material = std::make_shared<Material>(Material::MaterialType::MIRROR, albedo);
-                    world.Add(std::make_shared<Sphere>(center, 0.2f, sphere_material));
-                } else {
-                    // glass
-                    const auto sphere_material = std::make_shared<Material>(Material::MaterialType::DIELECTRIC,Vec3(0.5f,0.5f,0.5f));
-                    world.Add(std::make_shared<Sphere>(center, 0.2, sphere_material));
-                }
+int main(int argc, char* argv[])
+{
+    //Number of rendering threads (0 = one per hardware thread)
+    int num_threads{0};
+    auto accel{AccelType::LINEAR};
+    auto integrator{Integrator::RECURSIVE};
+    auto sampler{RenderSettings{}.sampler};
+    PruneSettings prune;
+    //Progressive rendering: passes of samples_per_pixel samples until either limit is reached
+    ProgressiveSettings progressive;
+    AdaptiveSettings adaptive;
+    //Output file. A .pfm extension writes a float HDR image, anything else a binary PPM
+    std::string out_path{"image.ppm"};
+    //Server mode: keep the scene built and render requests from a UNIX socket at this path, see render_server.h
+    std::string socket_path;
+    //What to render, see MakeScene()
+    std::string scene_spec{"random"};
+    //If set, the built scene is loaded from this file, or written to it when the file is missing or stale
+    std::string cache_path;
+    //If set, a scene file is identified in the cache by its contents rather than by its size and modification time
+    bool cache_hash_contents{false};
+    for(int a = 1; a < argc; ++a) {
+        const std::string_view arg{argv[a]};
+        if(arg == "--threads" && a + 1 < argc) {num_threads = std::atoi(argv[++a]);}
+        else if(arg == "--wavefront") {integrator = Integrator::WAVEFRONT;}
+        else if(arg == "--prune" && a + 1 < argc) {prune.threshold = std::strtof(argv[++a], nullptr);}
+        else if(arg == "--no-roulette") {prune.russian_roulette = false;}
+        else if(arg == "--time-budget" && a + 1 < argc) {
+            progressive.time_budget = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(std::strtod(argv[++a], nullptr)));
+        }
+        else if(arg == "--passes" && a + 1 < argc) {progressive.max_passes = std::atoi(argv[++a]);}
+        else if(arg == "--adaptive") {adaptive.enabled = true;}
+        else if(arg == "--min-samples" && a + 1 < argc) {adaptive.min_samples = std::atoi(argv[++a]);}
+        else if(arg == "--max-samples" && a + 1 < argc) {adaptive.max_samples = std::atoi(argv[++a]);}
+        else if(arg == "--max-error" && a + 1 < argc) {adaptive.max_error = std::strtof(argv[++a], nullptr);}
+        else if(arg == "-o" && a + 1 < argc) {out_path = argv[++a];}
+        else if(arg == "--serve" && a + 1 < argc) {socket_path = argv[++a];}
+        else if(arg == "--scene" && a + 1 < argc) {scene_spec = argv[++a];}
+        else if(arg == "--scene-cache" && a + 1 < argc) {cache_path = argv[++a];}
+        else if(arg == "--scene-cache-hash-contents") {cache_hash_contents = true;}
+        else if(arg == "--accel" && a + 1 < argc) {
+            const auto type = ParseAccelType(argv[++a]);
+            if(!type) {
+                std::cerr << "unknown acceleration structure " << argv[a] << '\n';
+                return 1;
+            }
+            accel = type.value();
+        }
+        else if(arg == "--sampler" && a + 1 < argc) {
+            const auto type = ParseSamplerType(argv[++a]);
+            if(!type) {
+                std::cerr << "unknown sampler " << argv[a] << '\n';
+                return 1;
             }
+            sampler = type.value();
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--threads N] [--scene random|glass|terrain[:N]|particles[:N]|obj:FILE|ply:FILE] [--scene-cache FILE [--scene-cache-hash-contents]] [--accel bvhnode|linear|bvh4|bvh8] [--wavefront]"
+                         " [--sampler random|stratified|halton|sobol|bluenoise] [--prune THRESHOLD] [--no-roulette]"
+                         " [--time-budget SECONDS] [--passes N] [--adaptive [--min-samples N] [--max-samples N] [--max-error E]]"
+                         " [-o image.ppm|image.pfm | --serve SOCKET]\n";
+            return 1;
         }
     }
 
-    auto material1 = std::make_shared<Material>(Material::MaterialType::DIELECTRIC,Color(0.2f,0.2f,0.2f));
-    world.Add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = std::make_shared<Material>(Material::MaterialType::DIFFUSE, Color(0.4, 0.2, 0.1));
-    world.Add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = std::make_shared<Material>(Material::MaterialType::MIRROR,  Color(0.7, 0.6, 0.5));
-    world.Add(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
-
-    return world;
-}
-
-
-int main()
-{
-
     //Define Image properties.
     constexpr auto aspect_ratio{16.f/9.f};
     constexpr auto image_width{900}; 
     constexpr auto image_height = static_cast<int>(static_cast<float>(image_width)/aspect_ratio);
-    //Initialise Camera.
-    constexpr auto lookfrom = Vec3{13.f,2.f,3.f};
-    constexpr auto lookat = Vec3{0.f,0.f,0.f};
-    constexpr auto vup = Vec3{0.f,1.f,0.f};
-    constexpr auto vfov{20.f};
-    Camera cam(lookfrom, lookat, vup, vfov, aspect_ratio);
 
     //---------------------
     //Add geometry to scene
     //-----------------------
-    HittableList world = RandomScene();
-    auto root = std::make_unique<BVHNode>(world);
-    constexpr auto light = PointLight{Point3{0.f,70.f,20.f}, Color{0.5f,0.5f,0.5f}};
-    
-    constexpr auto samples_per_pixel{5};
-    constexpr auto max_depth{4};
-
+    auto light = PointLight{Point3{0.f,70.f,20.f}, Color{0.5f,0.5f,0.5f}};
+    CameraSettings camera;
+    //Scenes loaded from files are not laid out for the default view: look at the whole scene, lit from above the camera
+    const auto place_camera = [&](const Scene& scene) {
+        if(!IsFileScene(scene_spec)) return;
+        camera = FrameBounds(camera, scene.world.BoundingBox());
+        light.position = camera.look_from + (camera.look_from - camera.look_at).Length() * camera.up;
+    };
+    //The cache is keyed by everything the scene is made from
+    std::optional<std::uint64_t> key;
+    if(!cache_path.empty()) {key = SceneKey(scene_spec, cache_hash_contents);}
+
+    //Renderer is not movable, so it is made in place once we know where the scene comes from
+    std::optional<Renderer> renderer;
+    const auto start{std::chrono::steady_clock::now()};
+    if(key) {
+        if(auto cached = LoadSceneCache(cache_path, *key)) {
+            place_camera(cached->scene);
+            renderer.emplace(std::move(*cached), light, accel, num_threads);
+            std::cerr << "Loaded scene cache " << cache_path << " in "
+                      << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+        }
+    }
+    if(!renderer) {
+        std::optional<Scene> scene;
+        std::string error;
+        {
+            ThreadPool pool(num_threads);
+            scene = MakeScene(scene_spec, error, &pool);
+        }
+        if(!scene) {
+            std::cerr << error << '\n';
+            return 1;
+        }
+        place_camera(*scene);
+        renderer.emplace(std::move(*scene), light, accel, num_threads);
+        std::cerr << "Made scene " << scene_spec << " in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+        if(key && !renderer->SaveScene(cache_path, *key)) {
+            std::cerr << "warning: could not write scene cache " << cache_path << '\n';
+        }
+    }
+    std::cerr << "Built " << AccelName(renderer->Accel()) << ": " << renderer->BuildStats() << '\n';
+
+    Framebuffer image(image_width, image_height);
+    RenderJob job;
+    job.target = ImageView{image.Data(), image_width, image_height, 3 * static_cast<std::size_t>(image_width)};
+    job.camera = camera;
+    job.camera.aspect_ratio = aspect_ratio;
+    job.settings.samples_per_pixel = 5;
+    job.settings.max_depth = 4;
+    job.settings.integrator = integrator;
+    job.settings.sampler = sampler;
+    job.settings.prune = prune;
+    job.settings.adaptive = adaptive;
+    job.progressive = progressive;
+    if(!socket_path.empty()) {return ServeRenders(*renderer, socket_path, job) ? 0 : 1;}
 
     //---------------------
     //Draw image
     //--------------------
-    std::ofstream out_file("image.ppm");
-    if(!out_file) {
-        std::cerr<<"error opening file\n;";
-        return 1;
+    std::cerr << "Rendering with " << renderer->Threads() << " threads, " << SamplerName(job.settings.sampler) << " sampler\n";
+
+    //Written to a temporary file first, so that whoever watches out_path never sees a partial image
+    const auto write_image = [&] {
+        const bool is_pfm{out_path.ends_with(".pfm")};
+        const auto tmp_path{out_path + ".tmp"};
+        if(!(is_pfm ? image.WritePFM(tmp_path) : image.WriteP6(tmp_path))) return false;
+        std::error_code error;
+        std::filesystem::rename(tmp_path, out_path, error);
+        return !error;
+    };
+
+    const auto progressive_job{progressive.time_budget || progressive.max_passes > 0};
+    bool written{true};
+    if(progressive_job) {
+        job.on_pass = [&](int pass) {
+            std::cerr << "\rPass " << pass + 1 << ": " << (pass + 1) * job.settings.samples_per_pixel << " samples per pixel " << std::flush;
+            written = write_image() && written;
+        };
+    }
+    else {
+        const auto tile_count{MakeTiles(image_width, image_height, job.settings.tile_size).size()};
+        std::size_t tiles_done{0};
+        job.on_tile = [tile_count, tiles_done](const Tile&) mutable {
+            ++tiles_done;
+            std::cerr << "\rTiles Remaining: " << tile_count - tiles_done << ' ' << std::flush;
+        };
     }
 
-
-    out_file << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-
-    for(int j = image_height-1; j >= 0;--j )
-    {
-        std::cerr<<"\rRows Remaining: " << j << ' '<<std::flush;
-        for(int i=0;i < image_width;++i)
-        {
-            Color sum_col{0.f,0.f,0.f}; //Sum of color over all samples (likely to be greater than 1)
-            for(auto s = 0; s < samples_per_pixel; ++s)
-            {
-                //Sample in a random area around pixel for antialiasing
-                const auto u{(static_cast<float>(i) + RNG::Get().GenerateFloat(0.f,1.f)) / static_cast<float>(image_width-1)}; 
-                const auto v{(static_cast<float>(j) + RNG::Get().GenerateFloat(0.f,1.f) )/ static_cast<float>(image_height-1)};
-                const Ray r = cam.GetRay(u,v);
-                sum_col +=RayColor(r, root.get(), light, 0.f, std::numeric_limits<float>::max(), max_depth );
-            }
-            PrintColor(out_file,sum_col, samples_per_pixel);
-        }
-
+    const auto stats = renderer->Render(job).value();
+    if(!progressive_job) {written = write_image();}
+    if(!written) {
+        std::cerr<<"\nerror writing " << out_path << '\n';
+        return 1;
     }
+    std::cerr << "\nRays pruned: " << stats.rays_pruned;
+    std::cerr << "\nSamples per pixel: " << static_cast<double>(stats.samples) / (static_cast<double>(image_width) * image_height);
+
     std::cerr<<"\nDone.\n";
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,33 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file.h"
+
+std::shared_ptr<const MappedFile> MappedFile::Open(const std::string& path)
+{
+    const auto fd{open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+    if(fd < 0) return nullptr;
+
+    struct stat info{};
+    if(fstat(fd, &info) < 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return nullptr;
+    }
+
+    const auto size{static_cast<std::size_t>(info.st_size)};
+    void* data{nullptr};
+    if(size > 0) {
+        data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    //The mapping stays valid after the descriptor is closed
+    close(fd);
+    if(data == MAP_FAILED) return nullptr;
+    return std::shared_ptr<const MappedFile>(new MappedFile(static_cast<const std::byte*>(data), size));
+}
+
+MappedFile::~MappedFile()
+{
+    if(m_size > 0) {munmap(const_cast<std::byte*>(m_data), m_size);}
+}
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "mapped_file.h"
+#include "obj_loader.h"
+#include "thread_pool.h"
+
+namespace {
+
+/// @brief What one range of lines holds, or in the second pass, where its elements start in the whole file
+struct Counts
+{
+    std::size_t positions{0};
+    std::size_t normals{0};
+    std::size_t triangles{0};
+    std::size_t lines{0};
+};
+
+/// @brief The result of parsing one range of lines
+struct RangeResult
+{
+    bool normals_match{true}; //every corner's normal index equals its position index
+    std::string error;
+};
+
+constexpr bool IsSpace(char c) noexcept {return c == ' ' || c == '\t' || c == '\r';}
+
+/// @brief The kinds of line the loader reads. Anything else, including comments, is skipped.
+enum class LineKind
+{
+    POSITION,
+    NORMAL,
+    FACE,
+    OTHER
+};
+
+/// @brief Identifies the line at p, and moves p past its keyword
+LineKind ReadKeyword(const char*& p, const char* end) noexcept
+{
+    while(p < end && IsSpace(*p)) {++p;}
+    const auto left{end - p};
+    if(left >= 2 && p[0] == 'v' && IsSpace(p[1])) {p += 2; return LineKind::POSITION;}
+    if(left >= 3 && p[0] == 'v' && p[1] == 'n' && IsSpace(p[2])) {p += 3; return LineKind::NORMAL;}
+    if(left >= 2 && p[0] == 'f' && IsSpace(p[1])) {p += 2; return LineKind::FACE;}
+    return LineKind::OTHER;
+}
+
+/// @brief Calls fn(begin, end) for each line of [begin, end), without its newline
+template<typename Fn>
+void ForEachLine(const char* begin, const char* end, Fn&& fn)
+{
+    while(begin < end) {
+        const auto* newline = static_cast<const char*>(std::memchr(begin, '\n', static_cast<std::size_t>(end - begin)));
+        const auto* line_end{newline ? newline : end};
+        fn(begin, line_end);
+        begin = line_end + 1;
+    }
+}
+
+/// @brief Number of whitespace-separated words before the end of the line or a comment
+std::size_t CountWords(const char* p, const char* end) noexcept
+{
+    std::size_t words{0};
+    while(true) {
+        while(p < end && IsSpace(*p)) {++p;}
+        if(p == end || *p == '#') return words;
+        ++words;
+        while(p < end && !IsSpace(*p)) {++p;}
+    }
+}
+
+bool ReadFloat(const char*& p, const char* end, float& value) noexcept
+{
+    while(p < end && IsSpace(*p)) {++p;}
+    if(p < end && *p == '+') {++p;}
+    const auto [next, error] = std::from_chars(p, end, value);
+    if(error != std::errc{}) return false;
+    p = next;
+    return true;
+}
+
+bool ReadVector(const char*& p, const char* end, Vec3& v) noexcept
+{
+    float x, y, z;
+    if(!ReadFloat(p, end, x) || !ReadFloat(p, end, y) || !ReadFloat(p, end, z)) return false;
+    v = Vec3{x, y, z};
+    return true;
+}
+
+/// @brief Converts a 1-based OBJ index, or a negative one counting back from the last element read, to a 0-based index
+/// @param read Number of elements of this kind read so far in the whole file
+/// @param total Number of elements of this kind in the whole file
+std::optional<std::uint32_t> ResolveIndex(std::int64_t index, std::size_t read, std::size_t total) noexcept
+{
+    const auto resolved{index > 0 ? index - 1 : static_cast<std::int64_t>(read) + index};
+    if(index == 0 || resolved < 0 || static_cast<std::uint64_t>(resolved) >= total) return std::nullopt;
+    return static_cast<std::uint32_t>(resolved);
+}
+
+/// @brief Parses one range of lines into the final arrays, starting at the offsets in start
+RangeResult ParseRange(const char* begin, const char* end, Counts start, const Counts& totals, bool keep_normals, MeshBuffers& mesh)
+{
+    RangeResult result;
+    auto at{start};
+    std::size_t line{start.lines};
+    const auto fail = [&](std::string_view what) {
+        result.error = "line " + std::to_string(line) + ": " + std::string(what);
+    };
+
+    ForEachLine(begin, end, [&](const char* p, const char* line_end) {
+        ++line;
+        if(!result.error.empty()) return;
+        switch(ReadKeyword(p, line_end))
+        {
+        case LineKind::POSITION:
+            if(!ReadVector(p, line_end, mesh.positions[at.positions++])) {fail("expected three coordinates"); return;}
+            break;
+        case LineKind::NORMAL:
+            if(keep_normals && !ReadVector(p, line_end, mesh.normals[at.normals])) {fail("expected three coordinates"); return;}
+            ++at.normals;
+            break;
+        case LineKind::FACE: {
+            //Split into a fan of triangles around the first corner
+            std::uint32_t first{0}, previous{0};
+            std::size_t corners{0};
+            while(true) {
+                while(p < line_end && IsSpace(*p)) {++p;}
+                if(p == line_end || *p == '#') break;
+
+                std::int64_t v{0}, n{0};
+                const auto parsed_v{std::from_chars(p, line_end, v)};
+                if(parsed_v.ec != std::errc{}) {fail("expected a vertex index"); return;}
+                p = parsed_v.ptr;
+                if(p < line_end && *p == '/') {
+                    //Skip the texture coordinate, if any, then read the normal, if any
+                    ++p;
+                    while(p < line_end && *p != '/' && !IsSpace(*p)) {++p;}
+                    if(p < line_end && *p == '/') {
+                        const auto parsed_n{std::from_chars(p + 1, line_end, n)};
+                        if(parsed_n.ec != std::errc{}) {fail("expected a normal index"); return;}
+                        p = parsed_n.ptr;
+                    }
+                }
+                if(p < line_end && !IsSpace(*p)) {fail("malformed face corner"); return;}
+
+                const auto position{ResolveIndex(v, at.positions, totals.positions)};
+                if(!position) {fail("vertex index out of range"); return;}
+                if(n != 0) {
+                    const auto normal{ResolveIndex(n, at.normals, totals.normals)};
+                    if(!normal) {fail("normal index out of range"); return;}
+                    result.normals_match = result.normals_match && *normal == *position;
+                }
+                else {
+                    result.normals_match = false;
+                }
+
+                if(corners == 0) {first = *position;}
+                else if(corners >= 2) {
+                    auto* triangle = &mesh.indices[3 * at.triangles++];
+                    triangle[0] = first;
+                    triangle[1] = previous;
+                    triangle[2] = *position;
+                }
+                previous = *position;
+                ++corners;
+            }
+            if(corners < 3) {fail("a face needs at least three corners"); return;}
+            break;
+        }
+        case LineKind::OTHER:
+            break;
+        }
+    });
+    return result;
+}
+
+}
+
+std::optional<MeshBuffers> LoadOBJ(const std::string& path, ThreadPool* pool, std::string& error)
+{
+    const auto file = MappedFile::Open(path);
+    if(!file) {
+        error = "cannot open " + path;
+        return std::nullopt;
+    }
+    const auto* text = reinterpret_cast<const char*>(file->Bytes().data());
+    const auto size{file->Size()};
+
+    //One range per worker, each starting at the beginning of a line
+    const auto range_count{static_cast<std::size_t>(pool ? pool->Size() : 1)};
+    std::vector<std::size_t> bounds(range_count + 1, size);
+    bounds[0] = 0;
+    for(std::size_t r = 1; r < range_count; ++r) {
+        auto offset{std::max(size * r / range_count, bounds[r - 1])};
+        const auto* newline = offset < size ? static_cast<const char*>(std::memchr(text + offset, '\n', size - offset)) : nullptr;
+        bounds[r] = newline ? static_cast<std::size_t>(newline - text) + 1 : size;
+    }
+    const auto for_each_range = [&](const std::function<void(std::size_t)>& fn) {
+        if(pool) {pool->ParallelFor(range_count, [&](std::size_t begin, std::size_t end, int) {for(auto r = begin; r < end; ++r) {fn(r);}});}
+        else {fn(0);}
+    };
+
+    //First pass: count what each range holds
+    std::vector<Counts> counts(range_count);
+    for_each_range([&](std::size_t r) {
+        auto& c = counts[r];
+        ForEachLine(text + bounds[r], text + bounds[r + 1], [&](const char* p, const char* line_end) {
+            ++c.lines;
+            switch(ReadKeyword(p, line_end))
+            {
+            case LineKind::POSITION: ++c.positions; break;
+            case LineKind::NORMAL: ++c.normals; break;
+            case LineKind::FACE: c.triangles += std::max<std::size_t>(CountWords(p, line_end), 2) - 2; break;
+            case LineKind::OTHER: break;
+            }
+        });
+    });
+
+    //Where each range's elements start in the whole file
+    std::vector<Counts> starts(range_count);
+    Counts totals;
+    for(std::size_t r = 0; r < range_count; ++r) {
+        starts[r] = totals;
+        totals.positions += counts[r].positions;
+        totals.normals += counts[r].normals;
+        totals.triangles += counts[r].triangles;
+        totals.lines += counts[r].lines;
+    }
+    if(totals.positions > std::numeric_limits<std::uint32_t>::max()) {
+        error = "too many vertices for 32-bit indices";
+        return std::nullopt;
+    }
+    if(totals.triangles == 0) {
+        error = "no faces";
+        return std::nullopt;
+    }
+
+    //Second pass: parse each range into its place
+    MeshBuffers mesh;
+    const auto keep_normals{totals.normals == totals.positions};
+    mesh.positions.resize(totals.positions);
+    if(keep_normals) {mesh.normals.resize(totals.normals);}
+    mesh.indices.resize(3 * totals.triangles);
+
+    std::vector<RangeResult> results(range_count);
+    for_each_range([&](std::size_t r) {
+        results[r] = ParseRange(text + bounds[r], text + bounds[r + 1], starts[r], totals, keep_normals, mesh);
+    });
+
+    bool normals_match{keep_normals};
+    for(const auto& result : results) {
+        if(!result.error.empty()) {
+            error = result.error;
+            return std::nullopt;
+        }
+        normals_match = normals_match && result.normals_match;
+    }
+    if(!normals_match) {mesh.normals = {};}
+    return mesh;
+}
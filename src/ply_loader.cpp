@@ -0,0 +1,405 @@
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "mapped_file.h"
+#include "ply_loader.h"
+#include "thread_pool.h"
+
+namespace {
+
+enum class PlyType
+{
+    INT8,
+    UINT8,
+    INT16,
+    UINT16,
+    INT32,
+    UINT32,
+    FLOAT32,
+    FLOAT64
+};
+
+/// @brief Accepts both the original type names ("uchar") and the sized ones ("uint8")
+std::optional<PlyType> ParsePlyType(std::string_view name)
+{
+    if(name == "char" || name == "int8") return PlyType::INT8;
+    if(name == "uchar" || name == "uint8") return PlyType::UINT8;
+    if(name == "short" || name == "int16") return PlyType::INT16;
+    if(name == "ushort" || name == "uint16") return PlyType::UINT16;
+    if(name == "int" || name == "int32") return PlyType::INT32;
+    if(name == "uint" || name == "uint32") return PlyType::UINT32;
+    if(name == "float" || name == "float32") return PlyType::FLOAT32;
+    if(name == "double" || name == "float64") return PlyType::FLOAT64;
+    return std::nullopt;
+}
+
+constexpr std::size_t TypeSize(PlyType type) noexcept
+{
+    switch(type) {
+        case PlyType::INT8: case PlyType::UINT8: return 1;
+        case PlyType::INT16: case PlyType::UINT16: return 2;
+        case PlyType::INT32: case PlyType::UINT32: case PlyType::FLOAT32: return 4;
+        case PlyType::FLOAT64: return 8;
+    }
+    return 0;
+}
+
+template<typename T>
+T Load(const std::byte* p) noexcept
+{
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+/// @brief Reads one little-endian scalar as a double, which holds every PLY type exactly
+double ReadScalar(PlyType type, const std::byte* p) noexcept
+{
+    switch(type) {
+        case PlyType::INT8: return Load<std::int8_t>(p);
+        case PlyType::UINT8: return Load<std::uint8_t>(p);
+        case PlyType::INT16: return Load<std::int16_t>(p);
+        case PlyType::UINT16: return Load<std::uint16_t>(p);
+        case PlyType::INT32: return Load<std::int32_t>(p);
+        case PlyType::UINT32: return Load<std::uint32_t>(p);
+        case PlyType::FLOAT32: return Load<float>(p);
+        case PlyType::FLOAT64: return Load<double>(p);
+    }
+    return 0.;
+}
+
+struct Property
+{
+    std::string name;
+    PlyType type;                    //of the value, or of each entry of a list
+    std::optional<PlyType> list_count; //set for lists: the type of the entry count that precedes them
+};
+
+struct Element
+{
+    std::string name;
+    std::uint64_t count{0};
+    std::vector<Property> properties;
+
+    /// @return The size of one record, or nothing if its size varies because it holds a list
+    [[nodiscard]] std::optional<std::size_t> FixedSize() const noexcept
+    {
+        std::size_t size{0};
+        for(const auto& property : properties) {
+            if(property.list_count) return std::nullopt;
+            size += TypeSize(property.type);
+        }
+        return size;
+    }
+
+    /// @return The index of the named property, or nothing
+    [[nodiscard]] std::optional<std::size_t> Find(std::string_view name) const noexcept
+    {
+        for(std::size_t i = 0; i < properties.size(); ++i) {
+            if(properties[i].name == name) return i;
+        }
+        return std::nullopt;
+    }
+};
+
+/// @brief Splits the next line of the header into words, and moves past it
+std::vector<std::string_view> NextHeaderLine(std::string_view& header)
+{
+    const auto newline{header.find('\n')};
+    auto line{header.substr(0, newline)};
+    header.remove_prefix(newline == std::string_view::npos ? header.size() : newline + 1);
+
+    std::vector<std::string_view> words;
+    while(!line.empty()) {
+        const auto start{line.find_first_not_of(" \t\r")};
+        if(start == std::string_view::npos) break;
+        line.remove_prefix(start);
+        const auto end{std::min(line.find_first_of(" \t\r"), line.size())};
+        words.push_back(line.substr(0, end));
+        line.remove_prefix(end);
+    }
+    return words;
+}
+
+/// @brief Parses the header at the start of the file
+/// @param data_offset Set to where the data after the header starts
+std::optional<std::vector<Element>> ParseHeader(std::span<const std::byte> bytes, std::size_t& data_offset, std::string& error)
+{
+    //The header is text, ended by a line "end_header"
+    const std::string_view text{reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+    constexpr std::string_view kEnd{"end_header"};
+    auto end{text.find(kEnd)};
+    while(end != std::string_view::npos && end > 0 && text[end - 1] != '\n') {end = text.find(kEnd, end + 1);}
+    const auto newline{end == std::string_view::npos ? end : text.find('\n', end)};
+    if(!text.starts_with("ply") || newline == std::string_view::npos) {
+        error = "not a PLY file";
+        return std::nullopt;
+    }
+    data_offset = newline + 1;
+
+    auto header{text.substr(0, end)};
+    NextHeaderLine(header); //"ply"
+    std::vector<Element> elements;
+    bool little_endian{false};
+    while(!header.empty()) {
+        const auto words{NextHeaderLine(header)};
+        if(words.empty() || words[0] == "comment" || words[0] == "obj_info") continue;
+
+        if(words[0] == "format" && words.size() >= 2) {
+            if(words[1] != "binary_little_endian") {
+                error = "only binary little-endian PLY files are supported, not " + std::string(words[1]);
+                return std::nullopt;
+            }
+            little_endian = true;
+        }
+        else if(words[0] == "element" && words.size() == 3) {
+            Element element;
+            element.name = std::string(words[1]);
+            const auto [ptr, parse_error] = std::from_chars(words[2].data(), words[2].data() + words[2].size(), element.count);
+            if(parse_error != std::errc{}) {
+                error = "bad count for element " + element.name;
+                return std::nullopt;
+            }
+            elements.push_back(std::move(element));
+        }
+        else if(words[0] == "property" && !elements.empty()) {
+            const auto is_list{words.size() == 5 && words[1] == "list"};
+            const auto type{ParsePlyType(words[is_list ? 3 : 1])};
+            const auto count_type{is_list ? ParsePlyType(words[2]) : std::nullopt};
+            if((!is_list && words.size() != 3) || !type || (is_list && (!count_type || *count_type == PlyType::FLOAT32 || *count_type == PlyType::FLOAT64))) {
+                error = "bad property in element " + elements.back().name;
+                return std::nullopt;
+            }
+            elements.back().properties.push_back(Property{std::string(words.back()), *type, count_type});
+        }
+        else {
+            error = "unexpected header line starting " + std::string(words[0]);
+            return std::nullopt;
+        }
+    }
+    if(!little_endian) {
+        error = "missing format line";
+        return std::nullopt;
+    }
+    return elements;
+}
+
+/// @brief Walks the records of an element one at a time, for elements whose records differ in size
+class RecordReader
+{
+public:
+    RecordReader(std::span<const std::byte> bytes, std::size_t offset) : m_bytes{bytes}, m_offset{offset} {}
+
+    /// @brief Moves past one record. For each list property, calls on_list(property_index, count, first_entry).
+    /// @return False if the record runs past the end of the file
+    template<typename ListFn>
+    bool Next(const Element& element, ListFn&& on_list)
+    {
+        for(std::size_t i = 0; i < element.properties.size(); ++i) {
+            const auto& property = element.properties[i];
+            if(!property.list_count) {
+                if(!Skip(TypeSize(property.type))) return false;
+                continue;
+            }
+            const auto count_size{TypeSize(*property.list_count)};
+            if(m_bytes.size() - m_offset < count_size) return false;
+            const auto count{ReadScalar(*property.list_count, m_bytes.data() + m_offset)};
+            if(count < 0.) return false;
+            m_offset += count_size;
+            const auto* first = m_bytes.data() + m_offset;
+            if(!Skip(static_cast<std::size_t>(count) * TypeSize(property.type))) return false;
+            on_list(i, static_cast<std::size_t>(count), first);
+        }
+        return true;
+    }
+
+    [[nodiscard]] std::size_t Offset() const noexcept {return m_offset;}
+
+private:
+    bool Skip(std::size_t size) noexcept
+    {
+        if(m_bytes.size() - m_offset < size) return false;
+        m_offset += size;
+        return true;
+    }
+
+    std::span<const std::byte> m_bytes;
+    std::size_t m_offset;
+};
+
+/// @brief Runs fn(begin, end) over [0, count), on the pool's workers if there is a pool
+void ForRanges(ThreadPool* pool, std::size_t count, const std::function<void(std::size_t, std::size_t)>& fn)
+{
+    if(pool) {pool->ParallelFor(count, [&](std::size_t begin, std::size_t end, int) {fn(begin, end);});}
+    else if(count > 0) {fn(0, count);}
+}
+
+/// @brief Owns whatever the loader had to convert, and keeps the mapping alive for whatever it did not
+struct Storage
+{
+    std::shared_ptr<const MappedFile> file;
+    MeshBuffers converted;
+};
+
+}
+
+std::optional<LoadedMesh> LoadPLY(const std::string& path, ThreadPool* pool, std::string& error)
+{
+    auto storage = std::make_shared<Storage>();
+    storage->file = MappedFile::Open(path);
+    if(!storage->file) {
+        error = "cannot open " + path;
+        return std::nullopt;
+    }
+    const auto bytes{storage->file->Bytes()};
+    std::size_t offset{0};
+    const auto elements{ParseHeader(bytes, offset, error)};
+    if(!elements) return std::nullopt;
+    const auto fail = [&](std::string message) -> std::optional<LoadedMesh> {
+        error = std::move(message);
+        return std::nullopt;
+    };
+
+    LoadedMesh mesh;
+    auto& converted = storage->converted;
+    bool have_vertices{false}, have_faces{false};
+    for(const auto& element : *elements) {
+        const auto size{element.FixedSize()};
+        if(element.name == "vertex") {
+            const auto x{element.Find("x")}, y{element.Find("y")}, z{element.Find("z")};
+            if(!size || !x || !y || !z) return fail("vertices need x, y and z, and no lists");
+            if(element.count > std::numeric_limits<std::uint32_t>::max()) return fail("too many vertices for 32-bit indices");
+            if(*size != 0 && element.count > (bytes.size() - offset) / *size) return fail("the file ends inside the vertices");
+            const auto count{static_cast<std::size_t>(element.count)};
+            const auto* data = bytes.data() + offset;
+
+            //Already laid out as Point3s: use them where they are
+            const auto& p = element.properties;
+            const auto is_float = [&](std::size_t i, std::string_view name) {return p[i].name == name && p[i].type == PlyType::FLOAT32;};
+            if(p.size() == 3 && is_float(0, "x") && is_float(1, "y") && is_float(2, "z") && offset % alignof(Point3) == 0) {
+                static_assert(sizeof(Point3) == 3 * sizeof(float));
+                mesh.view.positions = std::span<const Point3>{reinterpret_cast<const Point3*>(data), count};
+            }
+            else {
+                std::vector<std::size_t> offsets(p.size(), 0);
+                for(std::size_t i = 1; i < p.size(); ++i) {offsets[i] = offsets[i - 1] + TypeSize(p[i - 1].type);}
+                const auto nx{element.Find("nx")}, ny{element.Find("ny")}, nz{element.Find("nz")};
+                const auto has_normals{nx && ny && nz};
+
+                converted.positions.resize(count);
+                if(has_normals) {converted.normals.resize(count);}
+                const auto read = [&](const std::byte* record, std::size_t i) {return static_cast<float>(ReadScalar(p[i].type, record + offsets[i]));};
+                ForRanges(pool, count, [&](std::size_t begin, std::size_t end) {
+                    for(auto v = begin; v < end; ++v) {
+                        const auto* record = data + v * *size;
+                        converted.positions[v] = Point3{read(record, *x), read(record, *y), read(record, *z)};
+                        if(has_normals) {converted.normals[v] = Vec3{read(record, *nx), read(record, *ny), read(record, *nz)};}
+                    }
+                });
+                mesh.view.positions = converted.positions;
+                mesh.view.normals = converted.normals;
+            }
+            offset += count * *size;
+            have_vertices = true;
+        }
+        else if(element.name == "face") {
+            if(!have_vertices) return fail("faces before vertices");
+            auto list{element.Find("vertex_indices")};
+            if(!list) {list = element.Find("vertex_index");}
+            if(!list || !element.properties[*list].list_count) return fail("faces need a vertex_indices list");
+            const auto& indices_property = element.properties[*list];
+            const auto index_type{indices_property.type};
+            const auto index_size{TypeSize(index_type)};
+            if(index_type == PlyType::FLOAT32 || index_type == PlyType::FLOAT64) return fail("vertex indices must be integers");
+            const auto vertex_count{static_cast<double>(mesh.view.positions.size())};
+            const auto count{static_cast<std::size_t>(element.count)};
+            auto& indices = converted.indices;
+
+            //Every face a triangle with nothing else in its record: each record has the same size, so ranges of faces can be
+            //converted in parallel. Otherwise, or if a record turns out not to be a triangle, go through them in order.
+            const auto count_size{TypeSize(*indices_property.list_count)};
+            const auto record_size{count_size + 3 * index_size};
+            std::atomic<bool> all_triangles{element.properties.size() == 1 && count <= (bytes.size() - offset) / record_size};
+            std::atomic<bool> in_range{true};
+            if(all_triangles) {
+                indices.resize(3 * count);
+                const auto* data = bytes.data() + offset;
+                ForRanges(pool, count, [&](std::size_t begin, std::size_t end) {
+                    for(auto f = begin; f < end && all_triangles; ++f) {
+                        const auto* record = data + f * record_size;
+                        if(ReadScalar(*indices_property.list_count, record) != 3.) {all_triangles = false; return;}
+                        for(int corner = 0; corner < 3; ++corner) {
+                            const auto index{ReadScalar(index_type, record + count_size + corner * index_size)};
+                            if(!(index >= 0. && index < vertex_count)) {in_range = false;}
+                            indices[3 * f + corner] = static_cast<std::uint32_t>(index);
+                        }
+                    }
+                });
+                if(all_triangles) {offset += count * record_size;}
+            }
+            if(!all_triangles) {
+                //Workers that started past the first non-triangle read misaligned records, so their verdict does not count
+                in_range = true;
+                //One pass to count the triangles, so the second can write them straight into place
+                std::size_t triangles{0};
+                RecordReader counter{bytes, offset};
+                for(std::size_t f = 0; f < count; ++f) {
+                    const auto read = counter.Next(element, [&](std::size_t property, std::size_t corners, const std::byte*) {
+                        if(property == *list) {triangles += std::max<std::size_t>(corners, 2) - 2;}
+                    });
+                    if(!read) return fail("the file ends inside the faces");
+                }
+                indices.assign(3 * triangles, 0);
+
+                std::size_t at{0};
+                RecordReader reader{bytes, offset};
+                for(std::size_t f = 0; f < count; ++f) {
+                    reader.Next(element, [&](std::size_t property, std::size_t corners, const std::byte* first) {
+                        if(property != *list) return;
+                        const auto corner = [&](std::size_t c) {
+                            const auto index{ReadScalar(index_type, first + c * index_size)};
+                            if(!(index >= 0. && index < vertex_count)) {in_range = false;}
+                            return static_cast<std::uint32_t>(index);
+                        };
+                        for(std::size_t c = 2; c < corners; ++c) {
+                            indices[at++] = corner(0);
+                            indices[at++] = corner(c - 1);
+                            indices[at++] = corner(c);
+                        }
+                    });
+                }
+                offset = reader.Offset();
+            }
+            if(!in_range) return fail("vertex index out of range");
+            mesh.view.indices = indices;
+            have_faces = true;
+        }
+        else if(size) {
+            if(*size != 0 && element.count > (bytes.size() - offset) / *size) return fail("the file ends inside element " + element.name);
+            offset += static_cast<std::size_t>(element.count) * *size;
+        }
+        else {
+            RecordReader reader{bytes, offset};
+            for(std::uint64_t r = 0; r < element.count; ++r) {
+                if(!reader.Next(element, [](std::size_t, std::size_t, const std::byte*) {})) return fail("the file ends inside element " + element.name);
+            }
+            offset = reader.Offset();
+        }
+        if(have_vertices && have_faces) break;
+    }
+    if(!have_faces || mesh.view.indices.empty()) return fail("no faces");
+
+    mesh.owner = std::move(storage);
+    return mesh;
+}
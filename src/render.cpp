@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <utility>
+
+#include "render.h"
+#include "tile_scheduler.h"
+#include "trace.h"
+#include "wavefront.h"
+
+std::vector<Tile> MakeTiles(int width, int height, int tile_size)
+{
+    assert(tile_size > 0);
+    const auto tiles_x{(width + tile_size - 1) / tile_size};
+    const auto tiles_y{(height + tile_size - 1) / tile_size};
+
+    //The curve is defined on a square power-of-2 grid, so find the smallest one that covers all tiles
+    std::uint32_t grid{1};
+    while(grid < static_cast<std::uint32_t>(std::max(tiles_x, tiles_y))) {grid *= 2;}
+
+    std::vector<std::pair<std::uint64_t, Tile>> keyed;
+    keyed.reserve(static_cast<std::size_t>(tiles_x) * tiles_y);
+    for(int ty = 0; ty < tiles_y; ++ty) {
+        for(int tx = 0; tx < tiles_x; ++tx) {
+            const auto x{tx * tile_size};
+            const auto y{ty * tile_size};
+            keyed.emplace_back(HilbertIndex(grid, tx, ty), Tile{x, y, std::min(x + tile_size, width), std::min(y + tile_size, height)});
+        }
+    }
+    std::sort(keyed.begin(), keyed.end(), [](auto&& a, auto&& b) {return a.first < b.first;});
+
+    std::vector<Tile> tiles;
+    tiles.reserve(keyed.size());
+    for(const auto& [key, tile] : keyed) {tiles.push_back(tile);}
+    return tiles;
+}
+
+std::pair<float,float> SamplePosition(const Sampler& sampler, int i, int y, int s, int width, int height)
+{
+    //Framebuffer rows go top to bottom, but the camera's v coordinate goes bottom to top
+    const auto j{height - 1 - y};
+    const auto at = PixelSample{static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(y), 
+                                static_cast<std::uint32_t>(y * width + i), static_cast<std::uint32_t>(s)};
+    const auto [jitter_u, jitter_v] = sampler.Get2D(at, 0);
+    const auto u{(static_cast<float>(i) + jitter_u) / static_cast<float>(width-1)}; 
+    const auto v{(static_cast<float>(j) + jitter_v) / static_cast<float>(height-1)};
+    return {u, v};
+}
+
+namespace {
+
+/// @brief Adds samples [first, last) of each active pixel of the tile to its estimate. Each sample of an 8x8 block is one
+/// @brief packet of primary rays, which is intersected with the scene as a whole and then shaded ray by ray.
+void TracePackets(const Tile& tile, const Camera& cam, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights, 
+                  const RenderSettings& settings, const Sampler& sampler, const Framebuffer& image, int first, int last, 
+                  std::span<const std::uint8_t> active, std::span<PixelEstimate> estimates, Pruner& pruner)
+{
+    constexpr auto block{RayPacket::kWidth};
+    const auto tile_width{tile.x1 - tile.x0};
+
+    std::array<float, RayPacket::kSize> us, vs, t_max;
+    std::array<std::optional<HitData>, RayPacket::kSize> hits;
+    std::array<std::size_t, RayPacket::kSize> pixel;
+
+    for(int by = tile.y0; by < tile.y1; by += block)
+    {
+        for(int bx = tile.x0; bx < tile.x1; bx += block)
+        {
+            const auto x1{std::min(bx + block, tile.x1)};
+            const auto y1{std::min(by + block, tile.y1)};
+            const auto count{static_cast<std::size_t>((x1 - bx) * (y1 - by))};
+
+            std::uint64_t block_active{0};
+            std::size_t k{0};
+            for(int y = by; y < y1; ++y) {
+                for(int i = bx; i < x1; ++i, ++k) {
+                    pixel[k] = static_cast<std::size_t>((y - tile.y0) * tile_width + (i - tile.x0));
+                    if(active[pixel[k]]) {block_active |= std::uint64_t{1} << k;}
+                }
+            }
+            if(!block_active) continue;
+
+            for(auto s = first; s < last; ++s)
+            {
+                k = 0;
+                for(int y = by; y < y1; ++y) {
+                    for(int i = bx; i < x1; ++i, ++k) {std::tie(us[k], vs[k]) = SamplePosition(sampler, i, y, s, image.Width(), image.Height());}
+                }
+
+                const auto packet = cam.GetRayPacket(std::span{us.data(), count}, std::span{vs.data(), count});
+                t_max.fill(std::numeric_limits<float>::max());
+                hits.fill(std::nullopt);
+                scene->HitPacket(packet, block_active, 0.f, t_max, hits);
+                for(auto rays = block_active; rays; rays &= rays - 1) {
+                    const auto r{std::countr_zero(rays)};
+                    const auto i{tile.x0 + static_cast<int>(pixel[r]) % tile_width};
+                    const auto y{tile.y0 + static_cast<int>(pixel[r]) / tile_width};
+                    const auto path = PathNode{static_cast<std::uint32_t>(y * image.Width() + i), static_cast<std::uint32_t>(s)};
+                    estimates[pixel[r]].Add(Shade(packet.GetRay(r), hits[r], scene, materials, lights, settings.max_depth, path, &pruner));
+                }
+            }
+        }
+    }
+}
+
+/// @brief Adds samples [first, last) of each active pixel of the tile to its estimate, tracing one ray at a time
+void TraceRays(const Tile& tile, const Camera& cam, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights, 
+               const RenderSettings& settings, const Sampler& sampler, const Framebuffer& image, int first, int last, 
+               std::span<const std::uint8_t> active, std::span<PixelEstimate> estimates, Pruner& pruner)
+{
+    const auto tile_width{tile.x1 - tile.x0};
+    for(int y = tile.y0; y < tile.y1; ++y)
+    {
+        for(int i = tile.x0; i < tile.x1; ++i)
+        {
+            const auto p{static_cast<std::size_t>((y - tile.y0) * tile_width + (i - tile.x0))};
+            if(!active[p]) continue;
+            for(auto s = first; s < last; ++s)
+            {
+                //Sample in a random area around pixel for antialiasing
+                const auto [u, v] = SamplePosition(sampler, i, y, s, image.Width(), image.Height());
+                const Ray r = cam.GetRay(u,v);
+                const auto path = PathNode{static_cast<std::uint32_t>(y * image.Width() + i), static_cast<std::uint32_t>(s)};
+                estimates[p].Add(RayColor(r, scene, materials, lights, 0.f, std::numeric_limits<float>::max(), settings.max_depth, path, &pruner));
+            }
+        }
+    }
+}
+
+}
+
+RenderStats RenderTile(const Tile& tile, const Camera& cam, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights, 
+                       const RenderSettings& settings, Framebuffer& image, std::span<int> sample_counts)
+{
+    Pruner pruner(settings.prune);
+    const auto tile_width{tile.x1 - tile.x0};
+    const auto tile_height{tile.y1 - tile.y0};
+    std::vector<PixelEstimate> estimates(static_cast<std::size_t>(tile_width) * tile_height);
+    std::vector<std::uint8_t> active(estimates.size(), 1);
+    const auto sampler = MakeSampler(settings.sampler, settings.SamplesPerPass());
+
+    const auto trace = [&](int first, int last) {
+        if(settings.primary_packets) {TracePackets(tile, cam, scene, materials, lights, settings, *sampler, image, first, last, active, estimates, pruner);}
+        else {TraceRays(tile, cam, scene, materials, lights, settings, *sampler, image, first, last, active, estimates, pruner);}
+    };
+
+    if(!settings.adaptive.enabled) {
+        trace(settings.first_sample, settings.first_sample + settings.samples_per_pixel);
+    }
+    else {
+        //One sample per round, for the pixels that have not converged yet
+        for(auto s = settings.first_sample; s < settings.first_sample + settings.SamplesPerPass(); ++s) {
+            trace(s, s + 1);
+            if(!UpdateActive(estimates, tile_width, tile_height, settings.adaptive, active)) break;
+        }
+    }
+
+    std::uint64_t samples{0};
+    for(int y = tile.y0; y < tile.y1; ++y) {
+        for(int i = tile.x0; i < tile.x1; ++i) {
+            const auto& estimate = estimates[static_cast<std::size_t>((y - tile.y0) * tile_width + (i - tile.x0))];
+            image.At(i,y) = estimate.Mean();
+            samples += static_cast<std::uint64_t>(estimate.Count());
+            if(!sample_counts.empty()) {sample_counts[static_cast<std::size_t>(y) * image.Width() + i] = estimate.Count();}
+        }
+    }
+    return RenderStats{pruner.Pruned(), samples};
+}
+
+void Accumulator::AddTile(const Tile& tile, const Framebuffer& pass, std::span<const int> samples)
+{
+    for(int y = tile.y0; y < tile.y1; ++y) {
+        for(int x = tile.x0; x < tile.x1; ++x) {
+            const auto p{static_cast<std::size_t>(y) * m_width + x};
+            m_sums[p] += pass.At(x,y) * static_cast<float>(samples[p]);
+            m_samples[p] += samples[p];
+        }
+    }
+}
+
+void Accumulator::Resolve(Framebuffer& image) const
+{
+    Resolve(Tile{0, 0, image.Width(), image.Height()}, image);
+}
+
+void Accumulator::Resolve(const Tile& tile, Framebuffer& image) const
+{
+    for(int y = tile.y0; y < tile.y1; ++y) {
+        for(int x = tile.x0; x < tile.x1; ++x) {
+            const auto p{static_cast<std::size_t>(y) * m_width + x};
+            image.At(x,y) = m_samples[p] > 0 ? m_sums[p] * (1.f / static_cast<float>(m_samples[p])) : Color{0.f};
+        }
+    }
+}
+
+namespace {
+
+/// @brief Renders the tiles with every worker in the pool and calls on_tile after each one, under a lock. 
+/// @brief Given a deadline, tiles that have not been started by then are skipped, as are those not started before a cancel.
+/// @param sample_counts If not empty, receives each rendered pixel's sample count, see RenderTile()
+RenderStats RenderTiles(const std::vector<Tile>& tiles, const Camera& cam, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights, 
+                        const RenderSettings& settings, ThreadPool& pool, Framebuffer& image, std::span<int> sample_counts,
+                        std::optional<std::chrono::steady_clock::time_point> deadline, const std::function<void(const Tile&)>& on_tile)
+{
+    //Each worker starts on its own stretch of the curve, then steals once that runs out
+    TileScheduler scheduler(tiles.size(), pool.Size());
+    std::vector<WavefrontQueues> queues(settings.integrator == Integrator::WAVEFRONT ? static_cast<std::size_t>(pool.Size()) : 0);
+    RenderStats stats;
+    std::mutex mutex;
+
+    pool.Run([&](int worker) {
+        while(const auto t = scheduler.Next(worker))
+        {
+            if(deadline && std::chrono::steady_clock::now() >= deadline.value()) break;
+            if(settings.cancel && settings.cancel->load(std::memory_order_relaxed)) break;
+
+            const auto tile_stats = settings.integrator == Integrator::WAVEFRONT 
+                ? RenderTileWavefront(tiles[t.value()], cam, scene, materials, lights, settings, image, queues[worker], sample_counts)
+                : RenderTile(tiles[t.value()], cam, scene, materials, lights, settings, image, sample_counts);
+
+            std::lock_guard lock{mutex};
+            stats.rays_pruned += tile_stats.rays_pruned;
+            stats.samples += tile_stats.samples;
+            on_tile(tiles[t.value()]);
+        }
+    });
+    return stats;
+}
+
+}
+
+RenderStats Render(const Camera& cam, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights, 
+                   const RenderSettings& settings, ThreadPool& pool, Framebuffer& image, const TileCallback& on_tile)
+{
+    const auto tiles = MakeTiles(image.Width(), image.Height(), settings.tile_size);
+    return RenderTiles(tiles, cam, scene, materials, lights, settings, pool, image, {}, std::nullopt, [&](const Tile& tile) {
+        if(on_tile) {on_tile(image, tile);}
+    });
+}
+
+RenderStats RenderProgressive(const Camera& cam, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights, 
+                              const RenderSettings& settings, const ProgressiveSettings& progressive, ThreadPool& pool, 
+                              Framebuffer& image, const PassCallback& on_pass, const TileCallback& on_tile)
+{
+    assert(progressive.time_budget || progressive.max_passes > 0);
+    const auto tiles = MakeTiles(image.Width(), image.Height(), settings.tile_size);
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    if(progressive.time_budget) {deadline = std::chrono::steady_clock::now() + progressive.time_budget.value();}
+
+    Accumulator accumulator(image.Width(), image.Height());
+    Framebuffer pass_image(image.Width(), image.Height());
+    std::vector<int> pass_samples(static_cast<std::size_t>(image.Width()) * image.Height());
+    RenderStats stats;
+
+    for(int pass = 0; progressive.max_passes == 0 || pass < progressive.max_passes; ++pass)
+    {
+        if(pass > 0 && deadline && std::chrono::steady_clock::now() >= deadline.value()) break;
+        if(settings.cancel && settings.cancel->load(std::memory_order_relaxed)) break;
+
+        auto pass_settings{settings};
+        pass_settings.first_sample = settings.first_sample + pass * settings.SamplesPerPass();
+        std::size_t tiles_done{0};
+        const auto pass_stats = RenderTiles(tiles, cam, scene, materials, lights, pass_settings, pool, pass_image, pass_samples, 
+                                            pass > 0 ? deadline : std::nullopt, [&](const Tile& tile) {
+            accumulator.AddTile(tile, pass_image, pass_samples);
+            ++tiles_done;
+            if(on_tile) {
+                accumulator.Resolve(tile, image);
+                on_tile(image, tile);
+            }
+        });
+
+        stats.rays_pruned += pass_stats.rays_pruned;
+        stats.samples += pass_stats.samples;
+        ++stats.passes;
+        accumulator.Resolve(image);
+        if(on_pass) {on_pass(image, pass);}
+        if(tiles_done < tiles.size()) break;
+    }
+    return stats;
+}
@@ -0,0 +1,438 @@
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "render_server.h"
+#include "sampler.h"
+
+namespace {
+
+constexpr int kMaxImageSide{16384};
+constexpr int kMaxSamples{1 << 16};
+constexpr int kMaxDepth{64};
+constexpr std::size_t kMaxRequestLength{4096};
+//How long a client may go without reading anything before it is dropped
+constexpr std::chrono::milliseconds kStallTimeout{10'000};
+//How far a client may fall behind the renderer before it is dropped and its job cancelled
+constexpr std::size_t kMaxQueuedBytes{64u << 20};
+//Most pixels that the images of all requests may hold at once: one image of the largest size
+constexpr std::size_t kMaxPixelsInFlight{static_cast<std::size_t>(kMaxImageSide) * kMaxImageSide};
+
+/// @brief Pixels of the images of all requests being rendered or waiting for the renderer
+std::atomic<std::size_t> g_pixels_in_flight{0};
+
+/// @brief A share of kMaxPixelsInFlight, held while a request's image exists
+class PixelReservation
+{
+public:
+    explicit PixelReservation(std::size_t pixels)
+    {
+        auto held{g_pixels_in_flight.load()};
+        do {
+            if(pixels > kMaxPixelsInFlight - held) return;
+        } while(!g_pixels_in_flight.compare_exchange_weak(held, held + pixels));
+        m_pixels = pixels;
+    }
+    ~PixelReservation() {g_pixels_in_flight -= m_pixels;}
+
+    PixelReservation(const PixelReservation&) = delete;
+    PixelReservation& operator=(const PixelReservation&) = delete;
+
+    [[nodiscard]] bool Held() const noexcept {return m_pixels > 0;}
+
+private:
+    std::size_t m_pixels{0};
+};
+
+template<typename T>
+bool ParseNumber(std::string_view text, T& value)
+{
+    if(text.starts_with('+')) {text.remove_prefix(1);}
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return error == std::errc{} && end == text.data() + text.size();
+}
+
+bool ParseInt(std::string_view text, int min, int max, int& value)
+{
+    return ParseNumber(text, value) && value >= min && value <= max;
+}
+
+/// @brief Parses "x,y,z"
+bool ParseVec3(std::string_view text, Vec3& value)
+{
+    std::array<float, 3> xyz{};
+    for(std::size_t i = 0; i < xyz.size(); ++i) {
+        const auto comma{i + 1 < xyz.size() ? text.find(',') : text.size()};
+        if(comma == std::string_view::npos || !ParseNumber(text.substr(0, comma), xyz[i])) return false;
+        text.remove_prefix(std::min(comma + 1, text.size()));
+    }
+    value = Vec3{xyz[0], xyz[1], xyz[2]};
+    return true;
+}
+
+/// @brief Writes all of data, unless the client has gone or goes kStallTimeout without reading anything
+bool SendAll(int fd, const void* data, std::size_t size)
+{
+    const auto* bytes = static_cast<const char*>(data);
+    while(size > 0) {
+        const auto sent{send(fd, bytes, size, MSG_NOSIGNAL | MSG_DONTWAIT)};
+        if(sent > 0) {
+            bytes += sent;
+            size -= static_cast<std::size_t>(sent);
+            continue;
+        }
+        if(sent < 0 && errno == EINTR) continue;
+        if(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            //The socket buffer is full: wait for the client to make room, timing the stall afresh after every write
+            pollfd writable{fd, POLLOUT, 0};
+            const auto ready{poll(&writable, 1, static_cast<int>(kStallTimeout.count()))};
+            if(ready > 0 || (ready < 0 && errno == EINTR)) continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+void AppendBytes(std::vector<char>& out, const void* data, std::size_t size)
+{
+    const auto end{out.size()};
+    out.resize(end + size);
+    std::memcpy(out.data() + end, data, size);
+}
+
+template<typename T>
+void Append(std::vector<char>& out, const T& value) {AppendBytes(out, &value, sizeof(value));}
+
+/// @brief Appends the header of a message to a buffer, so that a whole message is sent in one call
+void AppendMessage(std::vector<char>& out, MessageType type, std::uint32_t size) {Append(out, MessageHeader{type, size});}
+
+/// @brief The messages of one job, sent to the client by a writer thread of their own, so that the renderer, which 
+/// @brief queues them from under its lock, never waits on a client. A client that falls more than kMaxQueuedBytes 
+/// @brief behind, or stalls for kStallTimeout, is given up on: the queue is dropped, the socket shut down and the job cancelled.
+class MessageQueue
+{
+public:
+    MessageQueue(int fd, std::atomic<bool>& cancel)
+        : m_fd{fd}, m_cancel{cancel}, m_writer{[this] {Write();}} {}
+
+    ~MessageQueue() {Finish();}
+
+    MessageQueue(const MessageQueue&) = delete;
+    MessageQueue& operator=(const MessageQueue&) = delete;
+
+    /// @return False once the client has been given up on
+    bool Push(std::vector<char> message)
+    {
+        {
+            std::lock_guard lock{m_mutex};
+            if(m_failed) return false;
+            if(m_queued_bytes + message.size() > kMaxQueuedBytes) {
+                GiveUp();
+                return false;
+            }
+            m_queued_bytes += message.size();
+            m_messages.push_back(std::move(message));
+        }
+        m_ready.notify_one();
+        return true;
+    }
+
+    /// @brief Waits until every message has been sent, or the client has been given up on
+    /// @return False if it was given up on
+    bool Finish()
+    {
+        {
+            std::lock_guard lock{m_mutex};
+            m_closed = true;
+        }
+        m_ready.notify_one();
+        if(m_writer.joinable()) {m_writer.join();}
+        std::lock_guard lock{m_mutex};
+        return !m_failed;
+    }
+
+private:
+    void Write()
+    {
+        for(;;)
+        {
+            std::vector<char> message;
+            {
+                std::unique_lock lock{m_mutex};
+                m_ready.wait(lock, [&] {return m_failed || m_closed || !m_messages.empty();});
+                if(m_failed || m_messages.empty()) return;
+                message = std::move(m_messages.front());
+                m_messages.pop_front();
+            }
+            const auto sent{SendAll(m_fd, message.data(), message.size())};
+
+            std::lock_guard lock{m_mutex};
+            m_queued_bytes -= message.size();
+            if(!sent) {
+                GiveUp();
+                return;
+            }
+        }
+    }
+
+    /// @brief Called under m_mutex. Shutting the socket down also ends a send the writer is blocked in.
+    void GiveUp()
+    {
+        if(m_failed) return;
+        m_failed = true;
+        m_messages.clear();
+        m_cancel = true;
+        shutdown(m_fd, SHUT_RDWR);
+        m_ready.notify_one();
+    }
+
+    int m_fd;
+    std::atomic<bool>& m_cancel;
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::deque<std::vector<char>> m_messages;
+    std::size_t m_queued_bytes{0}; //including the message being sent
+    bool m_closed{false};          //no more messages will be pushed
+    bool m_failed{false};
+    std::thread m_writer;          //last, so that it starts once everything it uses is initialised
+};
+
+bool SendError(int fd, std::string_view error)
+{
+    std::vector<char> message;
+    AppendMessage(message, MessageType::ERROR, static_cast<std::uint32_t>(error.size()));
+    AppendBytes(message, error.data(), error.size());
+    return SendAll(fd, message.data(), message.size());
+}
+
+/// @brief Renders one request, sending each tile as it finishes
+/// @return False once the client has gone
+bool RunRequest(Renderer& renderer, const RenderJob& defaults, int fd, std::string_view line)
+{
+    std::string error;
+    auto job = ParseRenderRequest(line, defaults, error);
+    if(!job) return SendError(fd, error);
+
+    //Requests whose images would not fit in what is left of the budget are turned away rather than queued
+    const PixelReservation reservation(static_cast<std::size_t>(job->target.width) * job->target.height);
+    if(!reservation.Held()) return SendError(fd, "server busy, try again later");
+
+    Framebuffer image(job->target.width, job->target.height);
+    job->target.data = image.Data();
+    job->target.stride = 3 * static_cast<std::size_t>(image.Width());
+
+    //Once the client is gone or too far behind, the tiles not yet started are skipped
+    std::atomic<bool> cancelled{false};
+    job->settings.cancel = &cancelled;
+    MessageQueue messages(fd, cancelled);
+
+    //Called under the renderer's lock, so it only copies the tile out; the queue's writer does the sending
+    job->on_tile = [&](const Tile& tile) {
+        if(cancelled) return;
+        const auto pixels{static_cast<std::size_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0)};
+        std::vector<char> message;
+        message.reserve(sizeof(MessageHeader) + 4 * sizeof(std::uint32_t) + 3 * sizeof(float) * pixels);
+        AppendMessage(message, MessageType::TILE, static_cast<std::uint32_t>(4 * sizeof(std::uint32_t) + 3 * sizeof(float) * pixels));
+        for(const auto bound : {tile.x0, tile.y0, tile.x1, tile.y1}) {Append(message, static_cast<std::uint32_t>(bound));}
+        for(int y = tile.y0; y < tile.y1; ++y) {
+            for(int x = tile.x0; x < tile.x1; ++x) {
+                for(const auto c : image.At(x,y).Data()) {Append(message, c);}
+            }
+        }
+        messages.Push(std::move(message));
+    };
+
+    const auto start{std::chrono::steady_clock::now()};
+    const auto stats = renderer.Render(job.value()).value();
+    const auto ms{std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()};
+    if(cancelled) return false;
+
+    std::cerr << "Rendered " << image.Width() << 'x' << image.Height() << " in " << ms << " ms\n";
+    std::vector<char> done;
+    AppendMessage(done, MessageType::DONE, 2 * sizeof(std::uint64_t) + sizeof(double));
+    Append(done, stats.samples);
+    Append(done, stats.rays_pruned);
+    Append(done, ms);
+    return messages.Push(std::move(done)) && messages.Finish();
+}
+
+/// @brief Reads request lines from a client until it disconnects, and runs each in turn
+void ServeConnection(Renderer& renderer, const RenderJob& defaults, int fd)
+{
+    std::string pending;
+    std::array<char, 4096> buffer;
+    for(bool connected = true; connected;)
+    {
+        const auto received{recv(fd, buffer.data(), buffer.size(), 0)};
+        if(received < 0 && errno == EINTR) continue;
+        if(received <= 0) break;
+        pending.append(buffer.data(), static_cast<std::size_t>(received));
+
+        std::size_t newline;
+        while(connected && (newline = pending.find('\n')) != std::string::npos) {
+            auto line = std::string_view{pending}.substr(0, newline);
+            if(line.ends_with('\r')) {line.remove_suffix(1);}
+            if(!line.empty()) {connected = RunRequest(renderer, defaults, fd, line);}
+            pending.erase(0, newline + 1);
+        }
+        if(pending.size() > kMaxRequestLength) {
+            SendError(fd, "request too long");
+            break;
+        }
+    }
+    close(fd);
+}
+
+/// @brief Removes a socket left at path by a server that has gone. Fails, rather than remove it, if anything else is
+/// @brief there: a file that is not a socket, or the socket of a server that still accepts connections.
+bool RemoveStaleSocket(const std::string& path)
+{
+    struct stat status{};
+    if(lstat(path.c_str(), &status) < 0) {
+        if(errno == ENOENT) return true;
+        std::cerr << "cannot check " << path << ": " << std::strerror(errno) << '\n';
+        return false;
+    }
+    if(!S_ISSOCK(status.st_mode)) {
+        std::cerr << path << " exists and is not a socket\n";
+        return false;
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    const auto probe{socket(AF_UNIX, SOCK_STREAM, 0)};
+    if(probe < 0) {
+        std::cerr << "socket: " << std::strerror(errno) << '\n';
+        return false;
+    }
+    const auto refused{connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 && errno == ECONNREFUSED};
+    close(probe);
+    if(!refused) {
+        std::cerr << "another server is listening on " << path << '\n';
+        return false;
+    }
+    unlink(path.c_str());
+    return true;
+}
+
+}
+
+std::optional<RenderJob> ParseRenderRequest(std::string_view line, const RenderJob& defaults, std::string& error)
+{
+    auto job{defaults};
+    job.target.data = nullptr;
+    job.on_tile = {};
+    job.on_pass = {};
+
+    while(!line.empty())
+    {
+        const auto space{line.find(' ')};
+        const auto field{line.substr(0, space)};
+        line.remove_prefix(space == std::string_view::npos ? line.size() : space + 1);
+        if(field.empty()) continue;
+
+        const auto equals{field.find('=')};
+        if(equals == std::string_view::npos) {
+            error = "expected key=value: " + std::string{field};
+            return std::nullopt;
+        }
+        const auto key{field.substr(0, equals)};
+        const auto value{field.substr(equals + 1)};
+
+        bool valid{true};
+        if(key == "width") {valid = ParseInt(value, 2, kMaxImageSide, job.target.width);}
+        else if(key == "height") {valid = ParseInt(value, 2, kMaxImageSide, job.target.height);}
+        else if(key == "spp") {valid = ParseInt(value, 1, kMaxSamples, job.settings.samples_per_pixel);}
+        else if(key == "depth") {valid = ParseInt(value, 1, kMaxDepth, job.settings.max_depth);}
+        else if(key == "vfov") {valid = ParseNumber(value, job.camera.vfov) && job.camera.vfov > 0.f && job.camera.vfov < 180.f;}
+        else if(key == "from") {valid = ParseVec3(value, job.camera.look_from);}
+        else if(key == "at") {valid = ParseVec3(value, job.camera.look_at);}
+        else if(key == "up") {valid = ParseVec3(value, job.camera.up);}
+        else if(key == "sampler") {
+            const auto type = ParseSamplerType(value);
+            valid = type.has_value();
+            if(valid) {job.settings.sampler = type.value();}
+        }
+        else if(key == "wavefront") {
+            int wavefront{0};
+            valid = ParseInt(value, 0, 1, wavefront);
+            job.settings.integrator = wavefront ? Integrator::WAVEFRONT : Integrator::RECURSIVE;
+        }
+        else {
+            error = "unknown field " + std::string{key};
+            return std::nullopt;
+        }
+
+        if(!valid) {
+            error = "invalid " + std::string{key} + ": " + std::string{value};
+            return std::nullopt;
+        }
+    }
+    //An aspect ratio set in the defaults was meant for their size
+    if(job.target.width != defaults.target.width || job.target.height != defaults.target.height) {job.camera.aspect_ratio = 0.f;}
+    return job;
+}
+
+bool ServeRenders(Renderer& renderer, const std::string& path, const RenderJob& defaults)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if(path.empty() || path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "invalid socket path " << path << '\n';
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    const auto listener{socket(AF_UNIX, SOCK_STREAM, 0)};
+    if(listener < 0) {
+        std::cerr << "socket: " << std::strerror(errno) << '\n';
+        return false;
+    }
+    if(!RemoveStaleSocket(path)) {
+        close(listener);
+        return false;
+    }
+    if(bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 || listen(listener, 16) < 0) {
+        std::cerr << "cannot listen on " << path << ": " << std::strerror(errno) << '\n';
+        close(listener);
+        return false;
+    }
+
+    std::cerr << "Listening on " << path << '\n';
+    for(;;)
+    {
+        const auto fd{accept(listener, nullptr, nullptr)};
+        if(fd < 0) {
+            //Out of descriptors, say: wait for connections to close rather than give up on the clients still connected
+            if(errno != EINTR && errno != ECONNABORTED) {
+                std::cerr << "accept: " << std::strerror(errno) << '\n';
+                std::this_thread::sleep_for(std::chrono::milliseconds{100});
+            }
+            continue;
+        }
+        //The renderer and defaults outlive every connection, since this loop never returns
+        std::thread(ServeConnection, std::ref(renderer), std::cref(defaults), fd).detach();
+    }
+}
@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <utility>
+
+#include "camera.h"
+#include "renderer.h"
+
+namespace {
+
+void CopyTile(const Framebuffer& image, const Tile& tile, const ImageView& target)
+{
+    for(int y = tile.y0; y < tile.y1; ++y) {
+        auto* out = target.data + static_cast<std::size_t>(y) * target.stride + 3 * static_cast<std::size_t>(tile.x0);
+        for(int x = tile.x0; x < tile.x1; ++x) {
+            const auto& c = image.At(x,y);
+            *out++ = c.X();
+            *out++ = c.Y();
+            *out++ = c.Z();
+        }
+    }
+}
+
+}
+
+CameraSettings FrameBounds(const CameraSettings& camera, const AABB& bounds)
+{
+    if(bounds.IsEmpty()) return camera;
+    //Far enough that the box's bounding sphere fits in the vertical field of view
+    const auto radius{std::max(0.5f * (bounds.max - bounds.min).Length(), 1e-6f)};
+    const auto half_fov{0.5f * camera.vfov * std::numbers::pi_v<float> / 180.f};
+    auto framed{camera};
+    framed.look_at = bounds.Centroid();
+    framed.look_from = framed.look_at + (radius / std::sin(half_fov)) * UnitVector(camera.look_from - camera.look_at);
+    return framed;
+}
+
+Renderer::Renderer(Scene scene, const PointLight& light, AccelType accel, int num_threads)
+    : m_pool{num_threads}, m_scene{std::move(scene)}, m_light{light}, m_accel{accel}
+{
+    m_root = BuildAccelerator(accel, m_scene.world, &m_pool, &m_build_stats);
+}
+
+Renderer::Renderer(CachedScene cached, const PointLight& light, AccelType accel, int num_threads)
+    : m_pool{num_threads}, m_scene{std::move(cached.scene)}, m_light{light}, m_accel{accel}
+{
+    if(accel == AccelType::LINEAR) {m_root = std::move(cached.root);}
+    else {m_root = BuildAccelerator(accel, m_scene.world, &m_pool, &m_build_stats);}
+}
+
+bool Renderer::SaveScene(const std::string& path, std::uint64_t input_hash)
+{
+    std::lock_guard lock{m_mutex};
+    if(const auto* linear = dynamic_cast<const LinearBVH*>(m_root.get())) {
+        return WriteSceneCache(path, m_scene, *linear, input_hash);
+    }
+    const LinearBVH root(m_scene.world, BVHBuildOptions{.max_prims_in_leaf = kAccelLeafSize, .pool = &m_pool});
+    return WriteSceneCache(path, m_scene, root, input_hash);
+}
+
+std::optional<RenderStats> Renderer::Render(const RenderJob& job)
+{
+    const auto& target = job.target;
+    if(!target.Valid()) return std::nullopt;
+
+    std::lock_guard lock{m_mutex};
+    if(!m_image || m_image->Width() != target.width || m_image->Height() != target.height) {
+        m_image.emplace(target.width, target.height);
+    }
+
+    const auto& camera = job.camera;
+    const auto aspect_ratio{camera.aspect_ratio > 0.f ? camera.aspect_ratio : static_cast<float>(target.width) / static_cast<float>(target.height)};
+    const Camera cam(camera.look_from, camera.look_at, camera.up, camera.vfov, aspect_ratio);
+
+    const auto on_tile = [&](const Framebuffer& image, const Tile& tile) {
+        CopyTile(image, tile, target);
+        if(job.on_tile) {job.on_tile(tile);}
+    };
+
+    if(job.progressive.time_budget || job.progressive.max_passes > 0) {
+        return RenderProgressive(cam, m_root.get(), m_scene.materials, std::span{&m_light, 1}, job.settings, job.progressive, m_pool, *m_image,
+                                 [&](const Framebuffer&, int pass) {if(job.on_pass) {job.on_pass(pass);}}, on_tile);
+    }
+    return ::Render(cam, m_root.get(), m_scene.materials, std::span{&m_light, 1}, job.settings, m_pool, *m_image, on_tile);
+}
@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "rng.h"
+#include "sampler.h"
+
+namespace {
+
+/// @brief The largest float below 1
+constexpr float kOneMinusEpsilon{0x1.fffffep-1f};
+
+/// @brief Maps 32 random bits to [0,1), using the top 24 so that every value is exactly representable
+float ToUnit(std::uint32_t bits) {return static_cast<float>(bits >> 8) * 0x1p-24f;}
+
+/// @brief Keys a sampler's generators. RNG(pixel, sample, n) streams are already drawn from elsewhere, e.g. by Russian 
+/// @brief roulette, so the first argument is salted out of the 32-bit range to keep the sampler's draws independent of them.
+std::uint64_t SamplerKey(std::uint32_t a, std::uint32_t b, std::uint32_t c)
+{
+    constexpr std::uint64_t kSalt{0x53616d706c657200ull};
+    return RNG::Mix(RNG::Mix(RNG::Mix(kSalt ^ a) ^ b) ^ c);
+}
+
+std::uint32_t Hash(std::uint32_t a, std::uint32_t b, std::uint32_t c) {return RNG(SamplerKey(a, b, c)).NextUInt();}
+
+std::uint32_t ReverseBits(std::uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+/// @brief The first two dimensions of the Sobol sequence, as 32-bit fractions
+std::uint32_t Sobol0(std::uint32_t index) {return ReverseBits(index);}
+
+std::uint32_t Sobol1(std::uint32_t index)
+{
+    std::uint32_t result{0};
+    for(std::uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+        if(index & 1) result ^= v;
+    }
+    return result;
+}
+
+/// @brief Owen scrambling by hashing (Burley, "Practical Hash-based Owen Scrambling"). Each bit is flipped depending only
+/// @brief on the bits above it, which keeps the stratification of the Sobol points while decorrelating pixels.
+std::uint32_t NestedUniformScramble(std::uint32_t x, std::uint32_t seed)
+{
+    x = ReverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return ReverseBits(x);
+}
+
+/// @brief A random permutation of [0, count), chosen by seed, evaluated at index (Kensler, "Correlated Multi-Jittered Sampling")
+std::uint32_t Permute(std::uint32_t index, std::uint32_t count, std::uint32_t seed)
+{
+    auto w{count - 1};
+    w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+    do {
+        index ^= seed; index *= 0xe170893du;
+        index ^= seed >> 16; index ^= (index & w) >> 4;
+        index ^= seed >> 8; index *= 0x0929eb3fu;
+        index ^= seed >> 23; index ^= (index & w) >> 1;
+        index *= 1 | seed >> 27; index *= 0x6935fa69u;
+        index ^= (index & w) >> 11; index *= 0x74dcb303u;
+        index ^= (index & w) >> 2; index *= 0x9e501cc3u;
+        index ^= (index & w) >> 2; index *= 0xc860a3dfu;
+        index &= w; index ^= index >> 5;
+    } while(index >= count);
+    return (index + seed) % count;
+}
+
+float RadicalInverse(std::uint32_t base, std::uint32_t index)
+{
+    const auto inv_base{1.0 / base};
+    double inv_power{inv_base};
+    double result{0.0};
+    for(; index; index /= base, inv_power *= inv_base) {result += (index % base) * inv_power;}
+    return std::min(static_cast<float>(result), kOneMinusEpsilon);
+}
+
+/// @brief x + offset, wrapped to [0,1)
+float Rotate(float x, float offset)
+{
+    const auto r{x + offset};
+    return std::min(r >= 1.f ? r - 1.f : r, kOneMinusEpsilon);
+}
+
+/// @brief Ranks [0, n*n) laid out on a toroidal n x n grid so that every prefix of ranks is evenly spread, without clumps
+/// @brief or low-frequency structure (Ulichney, "The void-and-cluster method for dither array generation").
+std::vector<std::uint32_t> VoidAndCluster(int n, RNG rng)
+{
+    const auto size{static_cast<std::size_t>(n) * n};
+    constexpr auto sigma{1.5f};
+
+    //Gaussian energy of a pixel at (0,0) on the torus
+    std::vector<float> kernel(size);
+    for(int y = 0; y < n; ++y) {
+        for(int x = 0; x < n; ++x) {
+            const auto dx{static_cast<float>(std::min(x, n - x))};
+            const auto dy{static_cast<float>(std::min(y, n - y))};
+            kernel[static_cast<std::size_t>(y) * n + x] = std::exp(-(dx*dx + dy*dy) / (2.f * sigma * sigma));
+        }
+    }
+
+    std::vector<std::uint8_t> pattern(size, 0);
+    std::vector<float> energy(size, 0.f);
+    const auto set = [&](std::size_t p, std::uint8_t value) {
+        pattern[p] = value;
+        const auto sign{value ? 1.f : -1.f};
+        const auto px{static_cast<int>(p % n)}, py{static_cast<int>(p / n)};
+        for(int y = 0; y < n; ++y) {
+            const auto* row = &kernel[static_cast<std::size_t>((y - py + n) % n) * n];
+            for(int x = 0; x < n; ++x) {energy[static_cast<std::size_t>(y) * n + x] += sign * row[(x - px + n) % n];}
+        }
+    };
+    //The set pixel with the most set pixels around it, and the unset pixel with the fewest
+    const auto tightest_cluster = [&] {
+        std::size_t best{0};
+        auto best_energy{-std::numeric_limits<float>::infinity()};
+        for(std::size_t p = 0; p < size; ++p) {if(pattern[p] && energy[p] > best_energy) {best = p; best_energy = energy[p];}}
+        return best;
+    };
+    const auto largest_void = [&] {
+        std::size_t best{0};
+        auto best_energy{std::numeric_limits<float>::infinity()};
+        for(std::size_t p = 0; p < size; ++p) {if(!pattern[p] && energy[p] < best_energy) {best = p; best_energy = energy[p];}}
+        return best;
+    };
+
+    //Start from a random 10% of the pixels, and move points from clusters to voids until that no longer changes anything
+    const auto initial{size / 10};
+    for(std::size_t placed = 0; placed < initial;) {
+        const auto p{rng.NextUInt() % size};
+        if(!pattern[p]) {set(p, 1); ++placed;}
+    }
+    for(std::size_t i = 0; i < size; ++i) {
+        const auto cluster{tightest_cluster()};
+        set(cluster, 0);
+        const auto hole{largest_void()};
+        set(hole, 1);
+        if(hole == cluster) break;
+    }
+
+    //Rank the initial points by removing the tightest clusters first, then the rest by filling the largest voids first
+    std::vector<std::uint32_t> rank(size);
+    const auto initial_pattern{pattern};
+    const auto initial_energy{energy};
+    for(auto r = initial; r-- > 0;) {
+        const auto cluster{tightest_cluster()};
+        set(cluster, 0);
+        rank[cluster] = static_cast<std::uint32_t>(r);
+    }
+    pattern = initial_pattern;
+    energy = initial_energy;
+    for(auto r = initial; r < size; ++r) {
+        const auto hole{largest_void()};
+        set(hole, 1);
+        rank[hole] = static_cast<std::uint32_t>(r);
+    }
+    return rank;
+}
+
+class RandomSampler : public Sampler
+{
+public:
+    [[nodiscard]] std::pair<float,float> Get2D(const PixelSample& at, std::uint32_t dimension) const override
+    {
+        RNG rng(SamplerKey(at.pixel, at.sample, dimension));
+        const auto u{rng.GenerateFloat(0.f,1.f)};
+        const auto v{rng.GenerateFloat(0.f,1.f)};
+        return {u, v};
+    }
+};
+
+/// @brief Each run of `count` samples of a pixel is a correlated multi-jittered pattern: one point in each cell of a
+/// @brief columns x rows grid, and one in each of `count` rows and columns of the projections on either axis.
+class StratifiedSampler : public Sampler
+{
+public:
+    explicit StratifiedSampler(int count)
+        : m_count{static_cast<std::uint32_t>(std::max(count, 1))},
+          m_columns{std::max(static_cast<std::uint32_t>(std::sqrt(static_cast<float>(m_count))), 1u)},
+          m_rows{(m_count + m_columns - 1) / m_columns} {}
+
+    [[nodiscard]] std::pair<float,float> Get2D(const PixelSample& at, std::uint32_t dimension) const override
+    {
+        const auto seed{Hash(at.pixel, at.sample / m_count, dimension)};
+        const auto s{Permute(at.sample % m_count, m_count, seed * 0x51633e2du)};
+        const auto sx{Permute(s % m_columns, m_columns, seed * 0x68bc21ebu)};
+        const auto sy{Permute(s / m_columns, m_rows, seed * 0x02e5be93u)};
+        const auto jx{ToUnit(Hash(s, seed, 0))};
+        const auto jy{ToUnit(Hash(s, seed, 1))};
+        const auto u{(static_cast<float>(sx) + (static_cast<float>(sy) + jx) / static_cast<float>(m_rows)) / static_cast<float>(m_columns)};
+        const auto v{(static_cast<float>(s) + jy) / static_cast<float>(m_count)};
+        return {std::min(u, kOneMinusEpsilon), std::min(v, kOneMinusEpsilon)};
+    }
+
+private:
+    std::uint32_t m_count;
+    std::uint32_t m_columns, m_rows;
+};
+
+class HaltonSampler : public Sampler
+{
+public:
+    [[nodiscard]] std::pair<float,float> Get2D(const PixelSample& at, std::uint32_t dimension) const override
+    {
+        //Every pair of dimensions has its own pair of prime bases, up to the table's end
+        static constexpr std::array<std::uint32_t, 16> kPrimes{2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53};
+        const auto d{2 * (dimension % (kPrimes.size() / 2))};
+        //Cranley-Patterson rotation: the same sequence in every pixel, shifted by a random offset
+        const auto u{Rotate(RadicalInverse(kPrimes[d], at.sample), ToUnit(Hash(at.pixel, dimension, 0)))};
+        const auto v{Rotate(RadicalInverse(kPrimes[d + 1], at.sample), ToUnit(Hash(at.pixel, dimension, 1)))};
+        return {u, v};
+    }
+};
+
+class SobolSampler : public Sampler
+{
+public:
+    [[nodiscard]] std::pair<float,float> Get2D(const PixelSample& at, std::uint32_t dimension) const override
+    {
+        //Shuffle the order of the points too, so that a pixel's first samples are not the same in every pixel
+        const auto index{NestedUniformScramble(at.sample, Hash(at.pixel, dimension, 0))};
+        const auto u{ToUnit(NestedUniformScramble(Sobol0(index), Hash(at.pixel, dimension, 1)))};
+        const auto v{ToUnit(NestedUniformScramble(Sobol1(index), Hash(at.pixel, dimension, 2)))};
+        return {u, v};
+    }
+};
+
+/// @brief The same Sobol points in every pixel, rotated by per-pixel offsets from a blue-noise tile. Neighbouring pixels get
+/// @brief very different offsets, so at low sample counts the error looks like fine grain rather than blotches.
+class BlueNoiseSampler : public Sampler
+{
+public:
+    static constexpr int kTileSize{64};
+
+    BlueNoiseSampler()
+        : m_tile{Tile()} {}
+
+    [[nodiscard]] std::pair<float,float> Get2D(const PixelSample& at, std::uint32_t dimension) const override
+    {
+        const auto u{ToUnit(NestedUniformScramble(Sobol0(at.sample), Hash(0, dimension, 1)))};
+        const auto v{ToUnit(NestedUniformScramble(Sobol1(at.sample), Hash(0, dimension, 2)))};
+        //Read the two offsets far apart in the tile, and somewhere else for each pair of dimensions
+        return {Rotate(u, Offset(at.x + 7*dimension, at.y + 19*dimension)), Rotate(v, Offset(at.x + 32 + 23*dimension, at.y + 32 + 5*dimension))};
+    }
+
+private:
+    /// @brief The tile is generated once, the first time a blue-noise sampler is made
+    static const std::vector<std::uint32_t>& Tile()
+    {
+        static const auto tile = VoidAndCluster(kTileSize, RNG{0x5eed});
+        return tile;
+    }
+
+    [[nodiscard]] float Offset(std::uint32_t x, std::uint32_t y) const
+    {
+        const auto rank{m_tile[(y % kTileSize) * kTileSize + x % kTileSize]};
+        return (static_cast<float>(rank) + 0.5f) / static_cast<float>(kTileSize * kTileSize);
+    }
+
+    const std::vector<std::uint32_t>& m_tile;
+};
+
+}
+
+std::optional<SamplerType> ParseSamplerType(std::string_view name)
+{
+    if(name == "random") return SamplerType::RANDOM;
+    if(name == "stratified") return SamplerType::STRATIFIED;
+    if(name == "halton") return SamplerType::HALTON;
+    if(name == "sobol") return SamplerType::SOBOL;
+    if(name == "bluenoise") return SamplerType::BLUE_NOISE;
+    return std::nullopt;
+}
+
+std::string_view SamplerName(SamplerType type)
+{
+    switch(type) {
+        case SamplerType::RANDOM: return "random";
+        case SamplerType::STRATIFIED: return "stratified";
+        case SamplerType::HALTON: return "halton";
+        case SamplerType::SOBOL: return "sobol";
+        case SamplerType::BLUE_NOISE: return "bluenoise";
+    }
+    return "unknown";
+}
+
+std::unique_ptr<Sampler> MakeSampler(SamplerType type, int samples_per_pixel)
+{
+    switch(type) {
+        case SamplerType::RANDOM: return std::make_unique<RandomSampler>();
+        case SamplerType::STRATIFIED: return std::make_unique<StratifiedSampler>(samples_per_pixel);
+        case SamplerType::HALTON: return std::make_unique<HaltonSampler>();
+        case SamplerType::SOBOL: return std::make_unique<SobolSampler>();
+        case SamplerType::BLUE_NOISE: return std::make_unique<BlueNoiseSampler>();
+    }
+    return nullptr;
+}
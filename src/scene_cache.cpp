@@ -0,0 +1,434 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "accel.h"
+#include "content_hash.h"
+#include "mapped_file.h"
+#include "scene_cache.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "triangle.h"
+#include "triangle_mesh.h"
+
+namespace {
+
+//The file is a header, then sections at 64-byte aligned offsets: the materials, the object records, the top-level nodes,
+//and the arrays the records refer to. Everything is stored in native layout; the byte order mark rejects files from a
+//machine of the other endianness.
+constexpr std::array<char, 8> kMagic{'R','T','S','C','E','N','E','\0'};
+constexpr std::uint32_t kByteOrderMark{0x01020304};
+constexpr std::uint64_t kAlignment{64};
+
+static_assert(sizeof(Vec3) == 3 * sizeof(float) && std::is_trivially_copyable_v<Vec3>);
+static_assert(sizeof(LinearBVHNode) == 32 && std::is_trivially_copyable_v<LinearBVHNode>);
+
+/// @brief An array in the file: count elements starting offset bytes from the start of the file
+struct Section
+{
+    std::uint64_t offset;
+    std::uint64_t count;
+};
+
+struct FileHeader
+{
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t input_hash;
+    std::uint64_t file_size;
+    Section materials;
+    Section objects;
+    Section top_nodes;
+};
+
+struct MaterialRecord
+{
+    std::uint32_t type;
+    float kd[3];
+    float ks[3];
+    float exponent;
+};
+
+enum class ObjectKind : std::uint32_t
+{
+    SPHERE,
+    TRIANGLE,
+    SPHERE_SET,
+    MESH
+};
+
+constexpr std::uint32_t kDoubleSided{1};
+constexpr std::uint32_t kPrecomputed{2};
+
+/// @brief One object. What geometry and arrays hold depends on the kind:
+/// @brief Sphere: geometry = centre, radius. Triangle: geometry = the three vertices.
+/// @brief SphereSet: arrays = centre_x, centre_y, centre_z, radius, material, nodes.
+/// @brief TriangleMesh: arrays = positions, normals, indices, nodes, triangles, records. The records section counts the
+/// @brief floats in one field, and holds the 12 fields one after the other.
+struct ObjectRecord
+{
+    ObjectKind kind;
+    MaterialID material;
+    std::uint32_t flags;
+    std::uint32_t pad;
+    std::array<float, 10> geometry;
+    std::array<Section, 6> arrays;
+};
+
+static_assert(std::is_trivially_copyable_v<FileHeader> && std::is_trivially_copyable_v<MaterialRecord> && std::is_trivially_copyable_v<ObjectRecord>);
+
+constexpr std::uint64_t AlignUp(std::uint64_t offset) noexcept {return (offset + kAlignment - 1) / kAlignment * kAlignment;}
+
+/// @brief Pads up to the next section, which is never more than kAlignment bytes away
+void WriteZeros(std::ostream& out, std::uint64_t count)
+{
+    static constexpr std::array<char, kAlignment> zeros{};
+    out.write(zeros.data(), static_cast<std::streamsize>(count));
+}
+
+/// @brief Lays out the arrays of a file before any of it is written, so it can then be written front to back
+class Layout
+{
+public:
+    explicit Layout(std::uint64_t start) : m_end{start} {}
+
+    /// @brief Places an array, or finds where the same memory was placed before
+    template<typename T>
+    Section Add(std::span<const T> values)
+    {
+        if(values.empty()) return Section{0, 0};
+        const auto bytes{std::as_bytes(values)};
+        const auto [it, inserted] = m_placed.try_emplace(std::pair{bytes.data(), bytes.size()}, 0);
+        if(inserted) {it->second = Place({bytes});}
+        return Section{it->second, values.size()};
+    }
+
+    /// @brief Places the fields one after the other, as one section counting the elements of one field
+    Section AddRecords(const TriangleRecordsView& records)
+    {
+        const auto count{records.nx.size()};
+        if(count == 0) return Section{0, 0};
+        std::vector<std::span<const std::byte>> fields;
+        for(const auto* field : records.Fields()) {fields.push_back(std::as_bytes(*field));}
+        return Section{Place(std::move(fields)), count};
+    }
+
+    [[nodiscard]] std::uint64_t End() const noexcept {return m_end;}
+
+    /// @brief Writes the arrays in the order they were placed, each preceded by zeros up to its offset
+    /// @param position Where out is in the file, advanced past what is written
+    void Write(std::ostream& out, std::uint64_t& position) const
+    {
+        for(const auto& chunk : m_chunks) {
+            WriteZeros(out, chunk.offset - position);
+            for(const auto& piece : chunk.pieces) {
+                out.write(reinterpret_cast<const char*>(piece.data()), static_cast<std::streamsize>(piece.size()));
+            }
+            position = chunk.offset + chunk.size;
+        }
+    }
+
+private:
+    struct Chunk
+    {
+        std::uint64_t offset;
+        std::uint64_t size;
+        std::vector<std::span<const std::byte>> pieces;
+    };
+
+    std::uint64_t Place(std::vector<std::span<const std::byte>> pieces)
+    {
+        std::uint64_t size{0};
+        for(const auto& piece : pieces) {size += piece.size();}
+        const auto offset{AlignUp(m_end)};
+        m_end = offset + size;
+        m_chunks.push_back(Chunk{offset, size, std::move(pieces)});
+        return offset;
+    }
+
+    std::uint64_t m_end;
+    std::vector<Chunk> m_chunks;
+    std::map<std::pair<const std::byte*, std::size_t>, std::uint64_t> m_placed;
+};
+
+/// @return The object's record, with its arrays placed in layout, or nothing if it is not a type the cache can store
+std::optional<ObjectRecord> MakeRecord(const Hittable& object, Layout& layout)
+{
+    ObjectRecord record{};
+    if(const auto* sphere = dynamic_cast<const Sphere*>(&object)) {
+        const auto centre{sphere->Centre()};
+        record.kind = ObjectKind::SPHERE;
+        record.material = sphere->MaterialId();
+        record.geometry = {centre.X(), centre.Y(), centre.Z(), sphere->Radius()};
+    }
+    else if(const auto* triangle = dynamic_cast<const Triangle*>(&object)) {
+        const std::array vertices{triangle->V_1(), triangle->V_2(), triangle->V_3()};
+        record.kind = ObjectKind::TRIANGLE;
+        record.material = triangle->MaterialId();
+        record.flags = triangle->DoubleSided() ? kDoubleSided : 0;
+        for(std::size_t v = 0; v < vertices.size(); ++v) {
+            for(int i = 0; i < 3; ++i) {record.geometry[3 * v + i] = vertices[v][i];}
+        }
+    }
+    else if(const auto* set = dynamic_cast<const SphereSet*>(&object)) {
+        const auto& data = set->Data();
+        record.kind = ObjectKind::SPHERE_SET;
+        record.arrays = {layout.Add(data.centre_x), layout.Add(data.centre_y), layout.Add(data.centre_z), layout.Add(data.radius),
+                         layout.Add(data.material), layout.Add(data.nodes)};
+    }
+    else if(const auto* mesh = dynamic_cast<const TriangleMesh*>(&object)) {
+        const auto& view = mesh->View();
+        const auto& bvh = mesh->BVH();
+        record.kind = ObjectKind::MESH;
+        record.material = mesh->MaterialId();
+        record.flags = (mesh->DoubleSided() ? kDoubleSided : 0) | (mesh->Layout() == TriangleLayout::PRECOMPUTED ? kPrecomputed : 0);
+        record.arrays = {layout.Add(view.positions), layout.Add(view.normals), layout.Add(view.indices), layout.Add(bvh.nodes),
+                         layout.Add(bvh.triangles), layout.AddRecords(bvh.records)};
+    }
+    else {
+        return std::nullopt;
+    }
+    return record;
+}
+
+/// @brief Resolves sections of a mapped file to typed views, checking that they lie within it
+class SectionReader
+{
+public:
+    explicit SectionReader(std::span<const std::byte> bytes) : m_bytes{bytes} {}
+
+    /// @param fields Number of consecutive arrays of section.count elements
+    template<typename T>
+    std::optional<std::span<const T>> Get(const Section& section, std::uint64_t fields = 1) const
+    {
+        if(section.count == 0) return std::span<const T>{};
+        if(section.offset % alignof(T) != 0 || section.offset > m_bytes.size()) return std::nullopt;
+        const auto available{(m_bytes.size() - section.offset) / sizeof(T)};
+        if(section.count > available / fields) return std::nullopt;
+        //The mapping starts on a page boundary, so an aligned offset gives an aligned pointer
+        return std::span<const T>{reinterpret_cast<const T*>(m_bytes.data() + section.offset), section.count * fields};
+    }
+
+private:
+    std::span<const std::byte> m_bytes;
+};
+
+/// @brief Checks that a depth-first BVH only refers to nodes after its own and to primitives [0, prim_count), and is no
+/// @brief deeper than kMaxBVHDepth, so that traversal cannot index out of bounds, loop or overflow its stack, however the
+/// @brief file was damaged
+bool ValidNodes(std::span<const LinearBVHNode> nodes, std::size_t prim_count)
+{
+    //Children come after their parents, so each node's depth is known by the time it is reached
+    std::vector<std::uint8_t> depth(nodes.size(), 0);
+    for(std::size_t i = 0; i < nodes.size(); ++i) {
+        const auto& node = nodes[i];
+        if(node.offset < 0) return false;
+        const auto offset{static_cast<std::size_t>(node.offset)};
+        if(node.prim_count > 0) {
+            if(offset > prim_count || node.prim_count > prim_count - offset) return false;
+            continue;
+        }
+        if(i + 1 >= nodes.size() || offset <= i + 1 || offset >= nodes.size()) return false;
+        const auto child_depth{static_cast<std::uint8_t>(depth[i] + 1)};
+        if(child_depth > kMaxBVHDepth) return false;
+        depth[i + 1] = std::max(depth[i + 1], child_depth);
+        depth[offset] = std::max(depth[offset], child_depth);
+    }
+    return true;
+}
+
+/// @return True if every value is below limit
+template<typename T>
+bool AllBelow(std::span<const T> values, std::size_t limit)
+{
+    return std::all_of(values.begin(), values.end(), [&](T v) {return static_cast<std::size_t>(v) < limit;});
+}
+
+std::shared_ptr<Hittable> LoadObject(const ObjectRecord& record, const SectionReader& reader, std::size_t material_count,
+                                     const std::shared_ptr<const MappedFile>& file)
+{
+    const auto& g = record.geometry;
+    const auto& arrays = record.arrays;
+    const auto double_sided{(record.flags & kDoubleSided) != 0};
+    switch(record.kind)
+    {
+    case ObjectKind::SPHERE:
+        if(record.material >= material_count) return nullptr;
+        return std::make_shared<Sphere>(Point3{g[0], g[1], g[2]}, g[3], record.material);
+    case ObjectKind::TRIANGLE:
+        if(record.material >= material_count) return nullptr;
+        return std::make_shared<Triangle>(Point3{g[0], g[1], g[2]}, Point3{g[3], g[4], g[5]}, Point3{g[6], g[7], g[8]}, record.material, double_sided);
+    case ObjectKind::SPHERE_SET: {
+        const auto x = reader.Get<float>(arrays[0]), y = reader.Get<float>(arrays[1]), z = reader.Get<float>(arrays[2]), r = reader.Get<float>(arrays[3]);
+        const auto material = reader.Get<MaterialID>(arrays[4]);
+        const auto nodes = reader.Get<LinearBVHNode>(arrays[5]);
+        if(!x || !y || !z || !r || !material || !nodes) return nullptr;
+        const auto padded{material->size() + SphereSet::kLanes - 1};
+        if(x->size() != padded || y->size() != padded || z->size() != padded || r->size() != padded) return nullptr;
+        if(!AllBelow(*material, material_count) || !ValidNodes(*nodes, material->size())) return nullptr;
+        return std::make_shared<SphereSet>(SphereSetData{*x, *y, *z, *r, *material, *nodes}, file);
+    }
+    case ObjectKind::MESH: {
+        if(record.material >= material_count) return nullptr;
+        const auto positions = reader.Get<Point3>(arrays[0]);
+        const auto normals = reader.Get<Vec3>(arrays[1]);
+        const auto indices = reader.Get<std::uint32_t>(arrays[2]);
+        const auto nodes = reader.Get<LinearBVHNode>(arrays[3]);
+        const auto triangles = reader.Get<std::uint32_t>(arrays[4]);
+        const auto records = reader.Get<float>(arrays[5], 12);
+        if(!positions || !normals || !indices || !nodes || !triangles || !records) return nullptr;
+        if(indices->size() % 3 != 0 || triangles->size() != indices->size() / 3) return nullptr;
+        if(!normals->empty() && normals->size() != positions->size()) return nullptr;
+        if(!AllBelow(*indices, positions->size()) || !AllBelow(*triangles, triangles->size()) || !ValidNodes(*nodes, triangles->size())) return nullptr;
+
+        const auto layout{(record.flags & kPrecomputed) != 0 ? TriangleLayout::PRECOMPUTED : TriangleLayout::INDEXED};
+        TriangleMeshBVH bvh{*nodes, *triangles, {}};
+        if(layout == TriangleLayout::PRECOMPUTED) {
+            const auto count{arrays[5].count};
+            if(count != triangles->size() + TriangleMesh::kLanes - 1) return nullptr;
+            auto fields{bvh.records.Fields()};
+            for(std::size_t f = 0; f < fields.size(); ++f) {*fields[f] = records->subspan(f * count, count);}
+        }
+        return std::make_shared<TriangleMesh>(MeshView{*positions, *normals, *indices}, bvh, file, record.material, double_sided, layout);
+    }
+    }
+    return nullptr;
+}
+
+/// @brief What a file is stored and looked up under: the caller's input hash, combined with everything in this build of
+/// @brief the program that decides what a cache of those inputs holds, so that a file written by an older build is rebuilt
+std::uint64_t CacheKey(std::uint64_t input_hash)
+{
+    ContentHash key;
+    key.Add("scene cache");
+    key.AddValue(input_hash);
+    key.AddValue(kSceneCacheVersion);
+    key.AddValue(kSceneGeneratorVersion);
+    key.AddValue(kBVHBuilderVersion);
+    key.AddValue(kAccelLeafSize);
+    return key.Value();
+}
+
+}
+
+bool WriteSceneCache(const std::string& path, const Scene& scene, const LinearBVH& root, std::uint64_t input_hash)
+{
+    FileHeader header{};
+    header.magic = kMagic;
+    header.version = kSceneCacheVersion;
+    header.byte_order = kByteOrderMark;
+    header.input_hash = CacheKey(input_hash);
+
+    const auto& objects = root.Primitives();
+    const auto nodes{root.Nodes()};
+    header.materials = Section{AlignUp(sizeof(FileHeader)), scene.materials.Size()};
+    header.objects = Section{AlignUp(header.materials.offset + header.materials.count * sizeof(MaterialRecord)), objects.size()};
+    header.top_nodes = Section{AlignUp(header.objects.offset + header.objects.count * sizeof(ObjectRecord)), nodes.size()};
+
+    Layout layout{header.top_nodes.offset + nodes.size_bytes()};
+    std::vector<ObjectRecord> records;
+    records.reserve(objects.size());
+    for(const auto& object : objects) {
+        const auto record{MakeRecord(*object, layout)};
+        if(!record) return false;
+        records.push_back(*record);
+    }
+    header.file_size = layout.End();
+
+    std::vector<MaterialRecord> materials(scene.materials.Size());
+    for(std::size_t i = 0; i < materials.size(); ++i) {
+        const auto& m = scene.materials[static_cast<MaterialID>(i)];
+        materials[i] = MaterialRecord{static_cast<std::uint32_t>(m.m_type), {m.Kd[0], m.Kd[1], m.Kd[2]}, {m.Ks[0], m.Ks[1], m.Ks[2]}, m.specular_exponent};
+    }
+
+    //A temporary file of its own in the same directory, so that writers racing to fill the same cache cannot mix their
+    //files, and the rename that publishes it is atomic
+    std::string tmp_path{path + ".XXXXXX"};
+    const auto fd{mkstemp(tmp_path.data())};
+    if(fd < 0) return false;
+    fchmod(fd, 0644);
+    close(fd);
+    const auto fail = [&] {
+        std::error_code ignored;
+        std::filesystem::remove(tmp_path, ignored);
+        return false;
+    };
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if(!out) return fail();
+
+        std::uint64_t position{0};
+        const auto write = [&](const Section& section, const void* data, std::size_t bytes) {
+            if(section.count == 0) return;
+            WriteZeros(out, section.offset - position);
+            out.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+            position = section.offset + bytes;
+        };
+        write(Section{0, 1}, &header, sizeof(header));
+        write(header.materials, materials.data(), materials.size() * sizeof(MaterialRecord));
+        write(header.objects, records.data(), records.size() * sizeof(ObjectRecord));
+        write(header.top_nodes, nodes.data(), nodes.size_bytes());
+        layout.Write(out, position);
+        //Without top-level nodes or arrays, the file still has to reach the end the header gives
+        WriteZeros(out, header.file_size - position);
+        out.close();
+        if(!out) return fail();
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmp_path, path, error);
+    return !error || fail();
+}
+
+std::optional<CachedScene> LoadSceneCache(const std::string& path, std::uint64_t input_hash)
+{
+    auto file = MappedFile::Open(path);
+    if(!file) return std::nullopt;
+    const auto bytes{file->Bytes()};
+
+    FileHeader header;
+    if(bytes.size() < sizeof(header)) return std::nullopt;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if(header.magic != kMagic || header.version != kSceneCacheVersion || header.byte_order != kByteOrderMark) return std::nullopt;
+    if(header.input_hash != CacheKey(input_hash) || header.file_size != bytes.size()) return std::nullopt;
+
+    const SectionReader reader{bytes};
+    const auto materials = reader.Get<MaterialRecord>(header.materials);
+    const auto records = reader.Get<ObjectRecord>(header.objects);
+    const auto nodes = reader.Get<LinearBVHNode>(header.top_nodes);
+    if(!materials || !records || !nodes) return std::nullopt;
+
+    CachedScene cached;
+    auto& scene = cached.scene;
+    for(std::size_t i = 0; i < materials->size(); ++i) {
+        const auto& m = (*materials)[i];
+        if(m.type > static_cast<std::uint32_t>(Material::MaterialType::DIELECTRIC)) return std::nullopt;
+        const Material material(static_cast<Material::MaterialType>(m.type), Color{m.kd[0], m.kd[1], m.kd[2]}, Color{m.ks[0], m.ks[1], m.ks[2]}, m.exponent);
+        //The writer stores a table without duplicates, so every material gets its own ID back
+        if(scene.materials.Add(material) != i) return std::nullopt;
+    }
+
+    std::vector<std::shared_ptr<Hittable>> objects;
+    objects.reserve(records->size());
+    for(const auto& record : *records) {
+        auto object = LoadObject(record, reader, scene.materials.Size(), file);
+        if(!object) return std::nullopt;
+        scene.world.Add(object);
+        objects.push_back(std::move(object));
+    }
+    if(!ValidNodes(*nodes, objects.size())) return std::nullopt;
+    cached.root = std::make_unique<LinearBVH>(std::move(objects), *nodes, std::move(file));
+    return cached;
+}
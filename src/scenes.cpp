@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include <sys/stat.h>
+
+#include "content_hash.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "obj_loader.h"
+#include "ply_loader.h"
+#include "rng.h"
+#include "scenes.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "triangle.h"
+#include "triangle_mesh.h"
+
+namespace {
+
+/// @brief Shirley's final scene, with the small spheres diffuse below diffuse_below, metal below metal_below and glass above
+Scene SphereField(float diffuse_below, float metal_below) {
+    Scene scene;
+    auto& [world, materials] = scene;
+    RNG rng{0}; //fixed seed, so every run builds the same scene
+    const auto mat_ground = materials.Add(Material(Material::MaterialType::DIFFUSE, Color(0.5f, 0.5f, 0.5f)));
+    world.Add(std::make_shared<Sphere>(Point3(0.f,-1000.f,0.f), 1000.f, mat_ground));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            const auto choose_mat = rng.GenerateFloat(0.f,1.f);
+            const auto offset_x = rng.GenerateFloat(0.f,1.f);
+            const auto offset_z = rng.GenerateFloat(0.f,1.f);
+            const Point3 center(a + 0.9*offset_x, 0.2, b + 0.9*offset_z);
+
+            if ((center - Point3(4.f, 0.2f, 0.f)).Length() > 0.9f) {
+                MaterialID sphere_material;
+
+                if (choose_mat < diffuse_below) {
+                    // diffuse
+                    const auto albedo = Color::Random(rng) * Color::Random(rng);
+                    sphere_material = materials.Add(Material(Material::MaterialType::DIFFUSE, albedo));
+                    world.Add(std::make_shared<Sphere>(center, 0.2f, sphere_material));
+                } else if (choose_mat < metal_below) {
+                    // metal
+                    const auto albedo = Color::Random(rng, 0.5f, 1.f);
+                    sphere_material = materials.Add(Material(Material::MaterialType::MIRROR, albedo));
+                    world.Add(std::make_shared<Sphere>(center, 0.2f, sphere_material));
+                } else {
+                    // glass (every small glass sphere shares one material)
+                    sphere_material = materials.Add(Material(Material::MaterialType::DIELECTRIC,Vec3(0.5f,0.5f,0.5f)));
+                    world.Add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    const auto material1 = materials.Add(Material(Material::MaterialType::DIELECTRIC,Color(0.2f,0.2f,0.2f)));
+    world.Add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
+
+    const auto material2 = materials.Add(Material(Material::MaterialType::DIFFUSE, Color(0.4, 0.2, 0.1)));
+    world.Add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
+
+    const auto material3 = materials.Add(Material(Material::MaterialType::MIRROR,  Color(0.7, 0.6, 0.5)));
+    world.Add(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
+
+    return scene;
+}
+
+}
+
+Scene RandomScene() {return SphereField(0.8f, 0.95f);}
+
+Scene GlassScene() {return SphereField(0.1f, 0.2f);}
+
+
+Scene TerrainScene(int resolution, std::optional<TriangleLayout> mesh_layout)
+{
+    assert(resolution > 0 && resolution <= kMaxTerrainResolution);
+    Scene scene;
+    auto& [world, materials] = scene;
+    const auto mat_ground = materials.Add(Material(Material::MaterialType::DIFFUSE, Color(0.4f, 0.6f, 0.3f)));
+
+    constexpr auto size{20.f}; //side length of the square patch
+    const auto height = [](float x, float z) {
+        return 0.6f * std::sin(0.7f * x) * std::cos(0.9f * z) + 0.15f * std::sin(3.1f * x + 1.3f * z);
+    };
+    const auto vertex = [&](int i, int k) {
+        const auto x{size * (static_cast<float>(i) / resolution - 0.5f)};
+        const auto z{size * (static_cast<float>(k) / resolution - 0.5f)};
+        return Point3(x, height(x, z), z);
+    };
+
+    if(mesh_layout) {
+        //The height's gradient gives smooth per-vertex normals
+        const auto normal = [](const Point3& p) {
+            const auto x{p.X()}, z{p.Z()};
+            const auto dh_dx{0.42f * std::cos(0.7f * x) * std::cos(0.9f * z) + 0.465f * std::cos(3.1f * x + 1.3f * z)};
+            const auto dh_dz{-0.54f * std::sin(0.7f * x) * std::sin(0.9f * z) + 0.195f * std::cos(3.1f * x + 1.3f * z)};
+            return Vec3(-dh_dx, 1.f, -dh_dz);
+        };
+
+        auto buffers = std::make_shared<MeshBuffers>();
+        const auto row{static_cast<std::uint32_t>(resolution + 1)};
+        for(int k = 0; k <= resolution; ++k) {
+            for(int i = 0; i <= resolution; ++i) {
+                buffers->positions.push_back(vertex(i, k));
+                buffers->normals.push_back(normal(buffers->positions.back()));
+            }
+        }
+        for(std::uint32_t k = 0; k < static_cast<std::uint32_t>(resolution); ++k) {
+            for(std::uint32_t i = 0; i < static_cast<std::uint32_t>(resolution); ++i) {
+                const auto i00{k*row + i}, i10{k*row + i + 1}, i01{(k+1)*row + i}, i11{(k+1)*row + i + 1};
+                buffers->indices.insert(buffers->indices.end(), {i00, i01, i10, i10, i01, i11});
+            }
+        }
+        world.Add(std::make_shared<TriangleMesh>(std::move(buffers), mat_ground, false, mesh_layout.value()));
+        return scene;
+    }
+
+    for(int k = 0; k < resolution; ++k) {
+        for(int i = 0; i < resolution; ++i) {
+            //Two CCW (seen from above) triangles per grid cell
+            const auto p00{vertex(i, k)}, p10{vertex(i+1, k)}, p01{vertex(i, k+1)}, p11{vertex(i+1, k+1)};
+            world.Add(std::make_shared<Triangle>(p00, p01, p10, mat_ground));
+            world.Add(std::make_shared<Triangle>(p10, p01, p11, mat_ground));
+        }
+    }
+    return scene;
+}
+
+
+Scene ParticleScene(std::size_t count, ThreadPool* pool)
+{
+    Scene scene;
+    auto& [world, materials] = scene;
+    RNG rng{1};
+    world.Add(std::make_shared<Sphere>(Point3(0.f,-1000.f,0.f), 1000.f, materials.Add(Material(Material::MaterialType::DIFFUSE, Color(0.5f, 0.5f, 0.5f)))));
+
+    //A small palette, so most particles share a handful of materials
+    const std::array palette{
+        materials.Add(Material(Material::MaterialType::DIFFUSE, Color(0.8f, 0.3f, 0.2f))),
+        materials.Add(Material(Material::MaterialType::DIFFUSE, Color(0.2f, 0.5f, 0.8f))),
+        materials.Add(Material(Material::MaterialType::DIFFUSE, Color(0.9f, 0.8f, 0.3f))),
+        materials.Add(Material(Material::MaterialType::MIRROR, Color(0.8f, 0.8f, 0.8f))),
+        materials.Add(Material(Material::MaterialType::DIELECTRIC, Color(0.5f, 0.5f, 0.5f)))
+    };
+
+    constexpr auto half_width{10.f}, height{4.f};
+    const auto spacing{std::cbrt(2.f * half_width * 2.f * half_width * height / static_cast<float>(std::max<std::size_t>(count, 1)))};
+    const auto radius{0.3f * spacing};
+
+    SphereArrays particles;
+    particles.Reserve(count);
+    for(std::size_t i = 0; i < count; ++i) {
+        const auto x{rng.GenerateFloat(-half_width, half_width)};
+        const auto y{rng.GenerateFloat(radius, height)};
+        const auto z{rng.GenerateFloat(-half_width, half_width)};
+        const auto choice{std::min(static_cast<std::size_t>(rng.GenerateFloat(0.f, 1.f) * palette.size()), palette.size() - 1)};
+        particles.Add(Point3(x, y, z), radius, palette[choice]);
+    }
+    world.Add(std::make_shared<SphereSet>(std::move(particles), BVHBuildOptions{.max_prims_in_leaf = SphereSet::kLanes, .traversal_cost = 4.f, .pool = pool}));
+    return scene;
+}
+
+
+Scene MeshScene(MeshView view, std::shared_ptr<const void> owner, ThreadPool* pool)
+{
+    Scene scene;
+    auto& [world, materials] = scene;
+    const auto material = materials.Add(Material(Material::MaterialType::DIFFUSE, Color(0.7f, 0.7f, 0.7f)));
+    auto options{TriangleMesh::DefaultBuildOptions(TriangleLayout::INDEXED)};
+    options.pool = pool;
+    world.Add(std::make_shared<TriangleMesh>(view, std::move(owner), material, true, TriangleLayout::INDEXED, options));
+    return scene;
+}
+
+
+namespace {
+
+constexpr std::string_view kObjPrefix{"obj:"};
+constexpr std::string_view kPlyPrefix{"ply:"};
+
+/// @brief The path in a spec that names a file
+std::string FilePath(std::string_view spec) {return std::string(spec.substr(spec.find(':') + 1));}
+
+}
+
+std::optional<Scene> MakeScene(std::string_view spec, std::string& error, ThreadPool* pool)
+{
+    if(spec.starts_with(kObjPrefix)) {
+        auto mesh = LoadOBJ(FilePath(spec), pool, error);
+        if(!mesh) return std::nullopt;
+        const auto buffers = std::make_shared<const MeshBuffers>(std::move(*mesh));
+        return MeshScene(MeshView{buffers->positions, buffers->normals, buffers->indices}, buffers, pool);
+    }
+    if(spec.starts_with(kPlyPrefix)) {
+        auto mesh = LoadPLY(FilePath(spec), pool, error);
+        if(!mesh) return std::nullopt;
+        return MeshScene(mesh->view, std::move(mesh->owner), pool);
+    }
+
+    const auto colon{spec.find(':')};
+    const auto name{spec.substr(0, colon)};
+    std::size_t size{0};
+    if(colon != std::string_view::npos) {
+        const auto digits{spec.substr(colon + 1)};
+        const auto [end, parse_error] = std::from_chars(digits.data(), digits.data() + digits.size(), size);
+        if(parse_error != std::errc{} || end != digits.data() + digits.size() || size == 0) {
+            error = "bad size in scene " + std::string(spec);
+            return std::nullopt;
+        }
+    }
+
+    if(name == "random" && colon == std::string_view::npos) return RandomScene();
+    if(name == "glass" && colon == std::string_view::npos) return GlassScene();
+    if(name == "terrain") {
+        if(size > static_cast<std::size_t>(kMaxTerrainResolution)) {
+            error = "terrain resolution " + std::to_string(size) + " is above the limit of " + std::to_string(kMaxTerrainResolution);
+            return std::nullopt;
+        }
+        return TerrainScene(size ? static_cast<int>(size) : 256, TriangleLayout::INDEXED);
+    }
+    if(name == "particles") return ParticleScene(size ? size : 1'000'000, pool);
+    error = "unknown scene " + std::string(spec);
+    return std::nullopt;
+}
+
+bool IsFileScene(std::string_view spec)
+{
+    return spec.starts_with(kObjPrefix) || spec.starts_with(kPlyPrefix);
+}
+
+std::optional<std::uint64_t> SceneKey(std::string_view spec, bool hash_contents)
+{
+    ContentHash key;
+    key.Add("scene");
+    key.Add(spec);
+    if(IsFileScene(spec)) {
+        if(hash_contents) {
+            const auto file = MappedFile::Open(FilePath(spec));
+            if(!file) return std::nullopt;
+            key.Add(file->Bytes());
+        }
+        else {
+            struct stat info{};
+            if(::stat(FilePath(spec).c_str(), &info) != 0) return std::nullopt;
+            key.Add("stat");
+            key.AddValue(static_cast<std::uint64_t>(info.st_size));
+            key.AddValue(static_cast<std::int64_t>(info.st_mtim.tv_sec));
+            key.AddValue(static_cast<std::int64_t>(info.st_mtim.tv_nsec));
+            key.AddValue(static_cast<std::uint64_t>(info.st_dev));
+            key.AddValue(static_cast<std::uint64_t>(info.st_ino));
+        }
+    }
+    return key.Value();
+}
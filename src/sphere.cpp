@@ -4,13 +4,8 @@
 #include "math.h"
 #include "sphere.h"
 
-/// @brief Returns data from a ray-sphere intersection.
-/// @brief We only care about the closest intersection, so we specify a range of values that the ray parameter must lie in to be considered. 
-/// @param r Incoming ray object
-/// @param t_low Minimum value of ray parameter considered
-/// @param t_high Max value of ray parameter considered
-/// @return An optional which contains data from the intersection, if one occured, or null.
-std::optional<HitData> Sphere::Hit(const Ray& r, float t_low, float t_high) const
+/// @brief Returns the ray parameter of the closest ray-sphere intersection in [t_low,t_high], if there is one.
+std::optional<float> Sphere::Intersect(const Ray& r, float t_low, float t_high) const
 {
     //The maths for an intersection between a ray and sphere results in a quadratic in the ray parameter t.
     //There is an intersection iff t has two distinct roots.
@@ -34,12 +29,26 @@ std::optional<HitData> Sphere::Hit(const Ray& r, float t_low, float t_high) cons
         }
     }
 
+    return closest_root;
+}
+
+/// @brief Returns data from a ray-sphere intersection.
+/// @brief We only care about the closest intersection, so we specify a range of values that the ray parameter must lie in to be considered. 
+/// @param r Incoming ray object
+/// @param t_low Minimum value of ray parameter considered
+/// @param t_high Max value of ray parameter considered
+/// @return An optional which contains data from the intersection, if one occured, or null.
+std::optional<HitData> Sphere::Hit(const Ray& r, float t_low, float t_high) const
+{
+    const auto t = Intersect(r, t_low, t_high);
+    if(!t) return std::nullopt;
+
     //Store information from the intersection
     HitData data = {
-        closest_root,
-        r.At(closest_root),
-        Norm3(r.At(closest_root) - m_centre),
-        m_mat_ptr
+        t.value(),
+        r.At(t.value()),
+        Norm3(r.At(t.value()) - m_centre),
+        m_mat_id
     };
     return  data;
 }   
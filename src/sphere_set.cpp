@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "sphere_set.h"
+#include "thread_pool.h"
+
+namespace {
+
+/// @brief The arrays a built SphereSet owns
+struct Storage
+{
+    SphereArrays spheres;
+    std::vector<LinearBVHNode> nodes;
+};
+
+/// @brief Returns values[order[i].index] for each i, followed by `pad` zeros
+template<typename T>
+std::vector<T> Gather(const std::vector<T>& values, const std::vector<BVHPrimitiveInfo>& order, std::size_t pad)
+{
+    std::vector<T> gathered(order.size() + pad, T{});
+    for(std::size_t i = 0; i < order.size(); ++i) {gathered[i] = values[order[i].index];}
+    return gathered;
+}
+
+}
+
+SphereSet::SphereSet(SphereArrays spheres, const BVHBuildOptions& options)
+{
+    const auto count{spheres.Size()};
+    assert(spheres.centre_x.size() == count && spheres.centre_y.size() == count && spheres.centre_z.size() == count);
+    assert(spheres.material.size() == count);
+    assert(options.max_prims_in_leaf <= kLanes);
+
+    //The spheres are not Hittables, so fill in the build input directly rather than through ComputePrimitiveInfo()
+    auto start{std::chrono::steady_clock::now()};
+    std::vector<BVHPrimitiveInfo> prims(count);
+    const auto compute = [&](std::size_t begin, std::size_t end, int) {
+        for(auto i = begin; i < end; ++i) {
+            const auto centre = Point3{spheres.centre_x[i], spheres.centre_y[i], spheres.centre_z[i]};
+            const auto r{spheres.radius[i]};
+            prims[i] = BVHPrimitiveInfo{AABB{centre - Vec3{r}, centre + Vec3{r}}, centre, static_cast<std::uint32_t>(i)};
+        }
+    };
+    if(options.pool) {options.pool->ParallelFor(count, compute);}
+    else {compute(0, count, 0);}
+    if(options.stats) {options.stats->info_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();}
+
+    const auto nodes = BuildBVH(prims, options);
+
+    start = std::chrono::steady_clock::now();
+    auto storage = std::make_shared<Storage>();
+    storage->nodes = FlattenBVH(nodes);
+
+    //Reorder into leaf order one array at a time, so only one extra array is alive at once
+    constexpr auto pad{static_cast<std::size_t>(kLanes - 1)};
+    auto& sorted = storage->spheres;
+    sorted.centre_x = Gather(spheres.centre_x, prims, pad); spheres.centre_x = {};
+    sorted.centre_y = Gather(spheres.centre_y, prims, pad); spheres.centre_y = {};
+    sorted.centre_z = Gather(spheres.centre_z, prims, pad); spheres.centre_z = {};
+    sorted.radius = Gather(spheres.radius, prims, pad); spheres.radius = {};
+    sorted.material = Gather(spheres.material, prims, 0);
+    m_data = SphereSetData{sorted.centre_x, sorted.centre_y, sorted.centre_z, sorted.radius, sorted.material, storage->nodes};
+    m_owner = std::move(storage);
+    if(options.stats) {options.stats->finalize_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();}
+}
+
+SphereSet::SphereSet(const SphereSetData& data, std::shared_ptr<const void> owner)
+    : m_data{data}, m_owner{std::move(owner)}
+{
+    [[maybe_unused]] const auto padded{data.material.size() + kLanes - 1};
+    assert(data.centre_x.size() == padded && data.centre_y.size() == padded && data.centre_z.size() == padded && data.radius.size() == padded);
+}
+
+bool SphereSet::IntersectLeaf(const Ray& ray, int first, int count, float t_low, float& t_high, int& hit_index) const
+{
+    //Same maths as Sphere, with b halved: roots of a t^2 + 2b t + c, taken as q/a and c/q with q = -(b + sign(b) sqrt(b^2 - ac))
+    //to avoid cancellation. Lanes with no real roots or no root in range end up at +infinity.
+    //The particles are tiny compared to their distance from the ray origin, so b^2 - ac would lose most of its bits. Instead the
+    //discriminant is computed as a(r^2 - |l|^2), where l = oc - (b/a)d is the vector from the centre to the closest point on the ray.
+    const auto o{ray.Origin()};
+    const auto d{ray.Direction()};
+    const auto a{Dot(d, d)};
+    const auto inv_a{1.f / a};
+    bool found{false};
+
+#if defined(__AVX2__)
+    const auto ox = _mm256_set1_ps(o.X()), oy = _mm256_set1_ps(o.Y()), oz = _mm256_set1_ps(o.Z());
+    const auto dx = _mm256_set1_ps(d.X()), dy = _mm256_set1_ps(d.Y()), dz = _mm256_set1_ps(d.Z());
+    const auto va = _mm256_set1_ps(a);
+    const auto lo = _mm256_set1_ps(t_low);
+    const auto inf = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    const auto sign_bit = _mm256_set1_ps(-0.f);
+    const auto lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for(int base = first; base < first + count; base += kLanes)
+    {
+        const auto ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&m_data.centre_x[base]));
+        const auto ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&m_data.centre_y[base]));
+        const auto ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&m_data.centre_z[base]));
+        const auto r = _mm256_loadu_ps(&m_data.radius[base]);
+
+        const auto b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, ocx), _mm256_mul_ps(dy, ocy)), _mm256_mul_ps(dz, ocz));
+        const auto c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz)),
+                                     _mm256_mul_ps(r, r));
+        const auto b_over_a = _mm256_mul_ps(b, _mm256_set1_ps(inv_a));
+        const auto lx = _mm256_sub_ps(ocx, _mm256_mul_ps(b_over_a, dx));
+        const auto ly = _mm256_sub_ps(ocy, _mm256_mul_ps(b_over_a, dy));
+        const auto lz = _mm256_sub_ps(ocz, _mm256_mul_ps(b_over_a, dz));
+        const auto l_sq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx), _mm256_mul_ps(ly, ly)), _mm256_mul_ps(lz, lz));
+        const auto discr = _mm256_mul_ps(va, _mm256_sub_ps(_mm256_mul_ps(r, r), l_sq));
+
+        const auto sqrt_discr = _mm256_sqrt_ps(_mm256_max_ps(discr, _mm256_setzero_ps()));
+        const auto q = _mm256_xor_ps(_mm256_add_ps(b, _mm256_or_ps(sqrt_discr, _mm256_and_ps(b, sign_bit))), sign_bit);
+        const auto x0 = _mm256_div_ps(q, va);
+        const auto x1 = _mm256_div_ps(c, q);
+        const auto near = _mm256_min_ps(x0, x1);
+        const auto far = _mm256_max_ps(x0, x1);
+
+        //Take the near root if it is in range, else the far one, else nothing
+        const auto hi = _mm256_set1_ps(t_high);
+        const auto near_ok = _mm256_and_ps(_mm256_cmp_ps(near, lo, _CMP_GE_OQ), _mm256_cmp_ps(near, hi, _CMP_LE_OQ));
+        const auto far_ok = _mm256_and_ps(_mm256_cmp_ps(far, lo, _CMP_GE_OQ), _mm256_cmp_ps(far, hi, _CMP_LE_OQ));
+        auto t = _mm256_blendv_ps(_mm256_blendv_ps(inf, far, far_ok), near, near_ok);
+
+        const auto in_leaf = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(first + count - base), lane));
+        const auto valid = _mm256_and_ps(in_leaf, _mm256_cmp_ps(discr, _mm256_setzero_ps(), _CMP_GE_OQ));
+        t = _mm256_blendv_ps(inf, t, valid);
+
+        auto mask{static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t, inf, _CMP_LT_OQ)))};
+        if(mask == 0) continue;
+
+        //At most 8 candidates, and usually one, so pick the closest with scalar code
+        alignas(32) float t_lanes[kLanes];
+        _mm256_store_ps(t_lanes, t);
+        while(mask) {
+            const auto i{std::countr_zero(mask)};
+            mask &= mask - 1;
+            if(t_lanes[i] <= t_high) {
+                t_high = t_lanes[i];
+                hit_index = base + i;
+                found = true;
+            }
+        }
+    }
+#else
+    for(int i = first; i < first + count; ++i)
+    {
+        const auto ocx{o.X() - m_data.centre_x[i]}, ocy{o.Y() - m_data.centre_y[i]}, ocz{o.Z() - m_data.centre_z[i]};
+        const auto r{m_data.radius[i]};
+        const auto b{d.X()*ocx + d.Y()*ocy + d.Z()*ocz};
+        const auto c{ocx*ocx + ocy*ocy + ocz*ocz - r*r};
+        const auto lx{ocx - b*inv_a*d.X()}, ly{ocy - b*inv_a*d.Y()}, lz{ocz - b*inv_a*d.Z()};
+        const auto discr{a * (r*r - (lx*lx + ly*ly + lz*lz))};
+        if(discr < 0.f) continue;
+
+        const auto q{-(b + std::copysign(std::sqrt(discr), b))};
+        const auto x0{q / a}, x1{c / q};
+        const auto near{std::min(x0, x1)}, far{std::max(x0, x1)};
+        auto t{near};
+        if(!(near >= t_low && near <= t_high)) {
+            t = far;
+            if(!(far >= t_low && far <= t_high)) continue;
+        }
+        t_high = t;
+        hit_index = i;
+        found = true;
+    }
+#endif
+    return found;
+}
+
+std::optional<HitData> SphereSet::Hit(const Ray& ray, float t_low, float t_high) const
+{
+    int hit_index{-1};
+    float t_hit{t_high};
+    TraverseLinearBVH(m_data.nodes, ray, t_low, t_high, [&](int first, int count, float& closest_so_far) {
+        if(!IntersectLeaf(ray, first, count, t_low, closest_so_far, hit_index)) return false;
+        t_hit = closest_so_far;
+        return true;
+    });
+    if(hit_index < 0) return std::nullopt;
+    return MakeHitData(ray, t_hit, hit_index);
+}
+
+HitData SphereSet::MakeHitData(const Ray& ray, float t, int index) const
+{
+    const auto centre = Point3{m_data.centre_x[index], m_data.centre_y[index], m_data.centre_z[index]};
+    const auto hit_point{ray.At(t)};
+    return HitData{t, hit_point, Norm3(hit_point - centre), m_data.material[index]};
+}
+
+void SphereSet::HitPacket(const RayPacket& packet, std::uint64_t active, float t_low, std::span<float> t_max, std::span<std::optional<HitData>> hits) const
+{
+    std::array<int, RayPacket::kSize> hit_index;
+    hit_index.fill(-1);
+
+    TraverseLinearBVHPacket(m_data.nodes, packet, active, t_low, t_max, [&](int first, int count, std::uint64_t rays) {
+        while(rays) {
+            const auto i{std::countr_zero(rays)};
+            rays &= rays - 1;
+            IntersectLeaf(packet.GetRay(i), first, count, t_low, t_max[i], hit_index[i]);
+        }
+    });
+
+    while(active) {
+        const auto i{std::countr_zero(active)};
+        active &= active - 1;
+        if(hit_index[i] >= 0) {hits[i] = MakeHitData(packet.GetRay(i), t_max[i], hit_index[i]);}
+    }
+}
+
+bool SphereSet::Occluded(const Ray& ray, float t_low, float t_high) const
+{
+    return TraverseLinearBVH<true>(m_data.nodes, ray, t_low, t_high, [&](int first, int count, float& t_max) {
+        int hit_index{-1};
+        return IntersectLeaf(ray, first, count, t_low, t_max, hit_index);
+    });
+}
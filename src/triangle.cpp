@@ -1,10 +1,11 @@
 #include "triangle.h"
 
-std::optional<HitData> Triangle::Hit(const Ray& r, float low, float high) const
+std::optional<float> Triangle::Intersect(const Ray& r, float low, float high) const
 {
-    std::optional<HitData> data = std::nullopt;
+    std::optional<float> data = std::nullopt;
 
     if(Dot(r.Direction(),m_normal)==0) {return data;} //ray and triangle are parallel
+    if(!b_double_sided && Dot(r.Direction(),m_normal) > 0.f) {return data;} //single-sided triangles cannot be hit from behind
 
     //Write all coefficients of the matrix... (p. 78 in Shirley)
     //LHS
@@ -19,9 +20,9 @@ std::optional<HitData> Triangle::Hit(const Ray& r, float low, float high) const
     const auto I{r.Direction().Z()};
 
     //RHS
-    const auto J{V_1().X() - r.Direction().X()};
-    const auto K{V_1().Y() - r.Direction().Y()};
-    const auto L{V_1().Z() - r.Direction().Z()};
+    const auto J{V_1().X() - r.Origin().X()};
+    const auto K{V_1().Y() - r.Origin().Y()};
+    const auto L{V_1().Z() - r.Origin().Z()};
 
 
     const auto M{A*(E*I-H*F) + B*(G*F-D*I) + C*(D*H-E*G)};
@@ -36,10 +37,16 @@ std::optional<HitData> Triangle::Hit(const Ray& r, float low, float high) const
     const auto t{-1.f*(F*(A*K - J*B) + E*(J*C - A*L) + D*(B*L - K*C)) / M};
 
     if(t > high || t < low) {return data;} //If parameter is outside the range, ignore it
-    return HitData{ t,
-                    r.At(t),
+    return t;
+}
+
+std::optional<HitData> Triangle::Hit(const Ray& r, float low, float high) const
+{
+    const auto t = Intersect(r, low, high);
+    if(!t) return std::nullopt;
+    return HitData{ t.value(),
+                    r.At(t.value()),
                     m_normal, 
-                    mat_ptr
+                    mat_id
     };
-
 }
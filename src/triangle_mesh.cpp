@@ -0,0 +1,294 @@
+#include <array>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+#include "thread_pool.h"
+#include "triangle_mesh.h"
+
+namespace {
+
+/// @brief The arrays a built TriangleMesh owns
+struct Storage
+{
+    std::vector<LinearBVHNode> nodes;
+    std::vector<std::uint32_t> triangles;
+    TriangleRecords records;
+};
+
+}
+
+TriangleMesh::TriangleMesh(std::shared_ptr<const MeshBuffers> buffers, MaterialID material, bool double_sided,
+                           TriangleLayout layout, std::optional<BVHBuildOptions> options)
+    : TriangleMesh(MeshView{buffers->positions, buffers->normals, buffers->indices}, buffers, material, double_sided, layout, options) {}
+
+TriangleMesh::TriangleMesh(MeshView view, std::shared_ptr<const void> owner, MaterialID material, bool double_sided,
+                           TriangleLayout layout, std::optional<BVHBuildOptions> build_options)
+    : m_view{view}, m_owner{std::move(owner)}, m_material{material}, b_double_sided{double_sided}, m_layout{layout}
+{
+    assert(m_view.indices.size() % 3 == 0);
+    assert(m_view.normals.empty() || m_view.normals.size() == m_view.positions.size());
+    const auto options{build_options.value_or(DefaultBuildOptions(layout))};
+    assert(layout != TriangleLayout::PRECOMPUTED || options.max_prims_in_leaf <= kLanes);
+
+    //The triangles are not Hittables, so fill in the build input directly rather than through ComputePrimitiveInfo()
+    auto start{std::chrono::steady_clock::now()};
+    const auto count{m_view.TriangleCount()};
+    std::vector<BVHPrimitiveInfo> prims(count);
+    const auto compute = [&](std::size_t begin, std::size_t end, int) {
+        for(auto i = begin; i < end; ++i) {
+            AABB bounds;
+            for(int k = 0; k < 3; ++k) {
+                assert(m_view.indices[3*i + k] < m_view.positions.size());
+                bounds.Extend(m_view.positions[m_view.indices[3*i + k]]);
+            }
+            prims[i] = BVHPrimitiveInfo{bounds, bounds.Centroid(), static_cast<std::uint32_t>(i)};
+        }
+    };
+    if(options.pool) {options.pool->ParallelFor(count, compute);}
+    else {compute(0, count, 0);}
+    if(options.stats) {options.stats->info_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();}
+
+    const auto nodes = BuildBVH(prims, options);
+
+    start = std::chrono::steady_clock::now();
+    auto storage = std::make_shared<Storage>();
+    storage->nodes = FlattenBVH(nodes);
+    storage->triangles.reserve(count);
+    for(const auto& prim : prims) {storage->triangles.push_back(prim.index);}
+    if(m_layout == TriangleLayout::PRECOMPUTED) {storage->records = BuildRecords(storage->triangles);}
+
+    m_bvh.nodes = storage->nodes;
+    m_bvh.triangles = storage->triangles;
+    const auto fields = storage->records.Fields();
+    const auto views = m_bvh.records.Fields();
+    for(std::size_t f = 0; f < fields.size(); ++f) {*views[f] = *fields[f];}
+    m_bvh_owner = std::move(storage);
+    if(options.stats) {options.stats->finalize_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();}
+}
+
+TriangleMesh::TriangleMesh(MeshView view, const TriangleMeshBVH& bvh, std::shared_ptr<const void> owner, MaterialID material, 
+                           bool double_sided, TriangleLayout layout)
+    : m_view{view}, m_owner{std::move(owner)}, m_material{material}, b_double_sided{double_sided}, m_layout{layout}, m_bvh{bvh}
+{
+    assert(m_view.indices.size() % 3 == 0 && m_bvh.triangles.size() == m_view.TriangleCount());
+    assert(layout != TriangleLayout::PRECOMPUTED || m_bvh.records.nx.size() == m_bvh.triangles.size() + kLanes - 1);
+}
+
+TriangleRecords TriangleMesh::BuildRecords(std::span<const std::uint32_t> triangles) const
+{
+    TriangleRecords records;
+    const auto size{triangles.size() + kLanes - 1};
+    for(auto* field : records.Fields()) {field->assign(size, 0.f);}
+
+    for(std::size_t i = 0; i < triangles.size(); ++i)
+    {
+        const auto tri{triangles[i]};
+        const auto& v0 = m_view.positions[m_view.indices[3*tri]];
+        const auto edge1{m_view.positions[m_view.indices[3*tri + 1]] - v0};
+        const auto edge2{m_view.positions[m_view.indices[3*tri + 2]] - v0};
+        const auto n{Cross(edge1, edge2)};
+        const auto n_sq{n.LengthSquared()};
+        if(n_sq == 0.f) continue; //degenerate: an all-zero record has det == 0, which never hits
+
+        //n1 and n2 are scaled so that Dot(n1,edge1) == 1 and Dot(n2,edge2) == 1
+        const auto n1{Cross(edge2, n) / n_sq};
+        const auto n2{Cross(n, edge1) / n_sq};
+        records.nx[i] = n.X(); records.ny[i] = n.Y(); records.nz[i] = n.Z(); records.d[i] = Dot(n, v0);
+        records.n1x[i] = n1.X(); records.n1y[i] = n1.Y(); records.n1z[i] = n1.Z(); records.d1[i] = -Dot(n1, v0);
+        records.n2x[i] = n2.X(); records.n2y[i] = n2.Y(); records.n2z[i] = n2.Z(); records.d2[i] = -Dot(n2, v0);
+    }
+    return records;
+}
+
+std::optional<TriangleMesh::TriangleHit> TriangleMesh::IntersectTriangle(std::uint32_t tri, const Ray& ray, float t_low, float t_high) const
+{
+    const auto& v0 = m_view.positions[m_view.indices[3*tri]];
+    const auto& v1 = m_view.positions[m_view.indices[3*tri + 1]];
+    const auto& v2 = m_view.positions[m_view.indices[3*tri + 2]];
+
+    const auto edge1{v1 - v0};
+    const auto edge2{v2 - v0};
+    const auto p{Cross(ray.Direction(), edge2)};
+
+    //det = -Dot(direction, Cross(edge1, edge2)), so it is positive when the ray meets the front (CCW) face
+    const auto det{Dot(edge1, p)};
+    if(b_double_sided ? det == 0.f : det <= 0.f) return std::nullopt; //parallel, or a culled back face
+    const auto inv_det{1.f / det};
+
+    const auto s{ray.Origin() - v0};
+    const auto u{Dot(s, p) * inv_det};
+    if(u < 0.f || u > 1.f) return std::nullopt;
+
+    const auto q{Cross(s, edge1)};
+    const auto v{Dot(ray.Direction(), q) * inv_det};
+    if(v < 0.f || u + v > 1.f) return std::nullopt;
+
+    const auto t{Dot(edge2, q) * inv_det};
+    if(t < t_low || t > t_high) return std::nullopt;
+    return TriangleHit{t, u, v};
+}
+
+bool TriangleMesh::IntersectRecords(const Ray& ray, int first, int count, float t_low, float& t_high, TriangleHit& hit, int& slot) const
+{
+    //With det = Dot(n,dir) and t' = d - Dot(n,o), the ray meets the plane at t = t'/det, and det*P = det*o + t'*dir.
+    //The barycentrics are then affine functions of det*P, so nothing is divided until the final scale by 1/det.
+    //The ray meets the front (CCW) face when det < 0.
+    const auto o{ray.Origin()};
+    const auto dir{ray.Direction()};
+    const auto& rec = m_bvh.records;
+    bool found{false};
+
+#if defined(__AVX2__) && defined(__FMA__)
+    const auto ox = _mm256_set1_ps(o.X()), oy = _mm256_set1_ps(o.Y()), oz = _mm256_set1_ps(o.Z());
+    const auto dx = _mm256_set1_ps(dir.X()), dy = _mm256_set1_ps(dir.Y()), dz = _mm256_set1_ps(dir.Z());
+    const auto zero = _mm256_setzero_ps();
+    const auto one = _mm256_set1_ps(1.f);
+    const auto lo = _mm256_set1_ps(t_low);
+    const auto lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const auto dot3 = [](__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz) {
+        return _mm256_fmadd_ps(ax, bx, _mm256_fmadd_ps(ay, by, _mm256_mul_ps(az, bz)));
+    };
+
+    for(int base = first; base < first + count; base += kLanes)
+    {
+        const auto nx = _mm256_loadu_ps(&rec.nx[base]), ny = _mm256_loadu_ps(&rec.ny[base]), nz = _mm256_loadu_ps(&rec.nz[base]);
+        const auto det = dot3(nx, ny, nz, dx, dy, dz);
+        const auto t_scaled = _mm256_sub_ps(_mm256_loadu_ps(&rec.d[base]), dot3(nx, ny, nz, ox, oy, oz));
+        const auto px = _mm256_fmadd_ps(det, ox, _mm256_mul_ps(t_scaled, dx));
+        const auto py = _mm256_fmadd_ps(det, oy, _mm256_mul_ps(t_scaled, dy));
+        const auto pz = _mm256_fmadd_ps(det, oz, _mm256_mul_ps(t_scaled, dz));
+        const auto u_scaled = _mm256_fmadd_ps(det, _mm256_loadu_ps(&rec.d1[base]),
+                                              dot3(_mm256_loadu_ps(&rec.n1x[base]), _mm256_loadu_ps(&rec.n1y[base]), _mm256_loadu_ps(&rec.n1z[base]), px, py, pz));
+        const auto v_scaled = _mm256_fmadd_ps(det, _mm256_loadu_ps(&rec.d2[base]),
+                                              dot3(_mm256_loadu_ps(&rec.n2x[base]), _mm256_loadu_ps(&rec.n2y[base]), _mm256_loadu_ps(&rec.n2z[base]), px, py, pz));
+
+        const auto inv_det = _mm256_div_ps(one, det);
+        const auto t = _mm256_mul_ps(t_scaled, inv_det);
+        const auto u = _mm256_mul_ps(u_scaled, inv_det);
+        const auto v = _mm256_mul_ps(v_scaled, inv_det);
+
+        //Every comparison is ordered, so the NaNs and infinities from det == 0 fail it
+        auto ok = _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        ok = _mm256_and_ps(ok, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+        ok = _mm256_and_ps(ok, _mm256_and_ps(_mm256_cmp_ps(t, lo, _CMP_GE_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(t_high), _CMP_LE_OQ)));
+        ok = _mm256_and_ps(ok, b_double_sided ? _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ) : _mm256_cmp_ps(det, zero, _CMP_LT_OQ));
+        ok = _mm256_and_ps(ok, _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(first + count - base), lane)));
+
+        auto mask{static_cast<std::uint32_t>(_mm256_movemask_ps(ok))};
+        if(mask == 0) continue;
+
+        alignas(32) float t_lanes[kLanes], u_lanes[kLanes], v_lanes[kLanes];
+        _mm256_store_ps(t_lanes, t);
+        _mm256_store_ps(u_lanes, u);
+        _mm256_store_ps(v_lanes, v);
+        while(mask) {
+            const auto i{std::countr_zero(mask)};
+            mask &= mask - 1;
+            if(t_lanes[i] <= t_high) {
+                t_high = t_lanes[i];
+                hit = TriangleHit{t_lanes[i], u_lanes[i], v_lanes[i]};
+                slot = base + i;
+                found = true;
+            }
+        }
+    }
+#else
+    for(int i = first; i < first + count; ++i)
+    {
+        const auto n = Vec3{rec.nx[i], rec.ny[i], rec.nz[i]};
+        const auto det{Dot(n, dir)};
+        if(b_double_sided ? det == 0.f : !(det < 0.f)) continue;
+
+        const auto t_scaled{rec.d[i] - Dot(n, o)};
+        const auto p{det * o + t_scaled * dir};
+        const auto inv_det{1.f / det};
+        const auto u{(Dot(Vec3{rec.n1x[i], rec.n1y[i], rec.n1z[i]}, p) + det * rec.d1[i]) * inv_det};
+        const auto v{(Dot(Vec3{rec.n2x[i], rec.n2y[i], rec.n2z[i]}, p) + det * rec.d2[i]) * inv_det};
+        const auto t{t_scaled * inv_det};
+        if(!(u >= 0.f && v >= 0.f && u + v <= 1.f && t >= t_low && t <= t_high)) continue;
+
+        t_high = t;
+        hit = TriangleHit{t, u, v};
+        slot = i;
+        found = true;
+    }
+#endif
+    return found;
+}
+
+bool TriangleMesh::IntersectLeaf(const Ray& ray, int first, int count, float t_low, float& t_high, TriangleHit& hit, int& slot) const
+{
+    if(m_layout == TriangleLayout::PRECOMPUTED) {return IntersectRecords(ray, first, count, t_low, t_high, hit, slot);}
+
+    bool found{false};
+    for(int i = first; i < first + count; ++i) {
+        if(const auto tri_hit = IntersectTriangle(m_bvh.triangles[i], ray, t_low, t_high); tri_hit) {
+            t_high = tri_hit->t;
+            hit = tri_hit.value();
+            slot = i;
+            found = true;
+        }
+    }
+    return found;
+}
+
+HitData TriangleMesh::MakeHitData(const Ray& ray, const TriangleHit& hit, int slot) const
+{
+    const auto tri{m_bvh.triangles[slot]};
+    const auto i0{m_view.indices[3*tri]}, i1{m_view.indices[3*tri + 1]}, i2{m_view.indices[3*tri + 2]};
+    const auto& [t, u, v] = hit;
+    const auto normal = m_view.normals.empty() ?
+        Norm3{Cross(m_view.positions[i1] - m_view.positions[i0], m_view.positions[i2] - m_view.positions[i0])} :
+        Norm3{(1.f - u - v) * m_view.normals[i0] + u * m_view.normals[i1] + v * m_view.normals[i2]};
+    return HitData{t, ray.At(t), normal, m_material};
+}
+
+std::optional<HitData> TriangleMesh::Hit(const Ray& ray, float t_low, float t_high) const
+{
+    TriangleHit closest{};
+    int slot{-1};
+    TraverseLinearBVH(m_bvh.nodes, ray, t_low, t_high, [&](int first, int count, float& closest_so_far) {
+        return IntersectLeaf(ray, first, count, t_low, closest_so_far, closest, slot);
+    });
+    if(slot < 0) return std::nullopt;
+    return MakeHitData(ray, closest, slot);
+}
+
+void TriangleMesh::HitPacket(const RayPacket& packet, std::uint64_t active, float t_low, std::span<float> t_max, std::span<std::optional<HitData>> hits) const
+{
+    std::array<TriangleHit, RayPacket::kSize> closest;
+    std::array<int, RayPacket::kSize> slots;
+    slots.fill(-1);
+
+    TraverseLinearBVHPacket(m_bvh.nodes, packet, active, t_low, t_max, [&](int first, int count, std::uint64_t rays) {
+        while(rays) {
+            const auto i{std::countr_zero(rays)};
+            rays &= rays - 1;
+            IntersectLeaf(packet.GetRay(i), first, count, t_low, t_max[i], closest[i], slots[i]);
+        }
+    });
+
+    while(active) {
+        const auto i{std::countr_zero(active)};
+        active &= active - 1;
+        if(slots[i] >= 0) {hits[i] = MakeHitData(packet.GetRay(i), closest[i], slots[i]);}
+    }
+}
+
+bool TriangleMesh::Occluded(const Ray& ray, float t_low, float t_high) const
+{
+    return TraverseLinearBVH<true>(m_bvh.nodes, ray, t_low, t_high, [&](int first, int count, float& t_max) {
+        TriangleHit hit;
+        int slot{-1};
+        return IntersectLeaf(ray, first, count, t_low, t_max, hit, slot);
+    });
+}
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <tuple>
+
+#include "trace.h"
+#include "wavefront.h"
+
+namespace {
+
+/// @brief Traces samples [first, last) of each 8x8 block of the tile as packets, one per sample, of the pixels still active.
+/// @brief Hits are queued, misses see the background.
+void TracePrimaryPackets(const Tile& tile, const Camera& cam, Hittable* scene, const Sampler& sampler, int first, int last,
+                         const Framebuffer& image, WavefrontQueues& q)
+{
+    constexpr auto block{RayPacket::kWidth};
+    const auto tile_width{tile.x1 - tile.x0};
+
+    std::array<float, RayPacket::kSize> us, vs, t_max;
+    std::array<std::optional<HitData>, RayPacket::kSize> hits;
+    std::array<std::uint32_t, RayPacket::kSize> pixel;
+    std::array<PathNode, RayPacket::kSize> nodes;
+
+    for(int by = tile.y0; by < tile.y1; by += block)
+    {
+        for(int bx = tile.x0; bx < tile.x1; bx += block)
+        {
+            const auto x1{std::min(bx + block, tile.x1)};
+            const auto y1{std::min(by + block, tile.y1)};
+            const auto count{static_cast<std::size_t>((x1 - bx) * (y1 - by))};
+
+            std::uint64_t active{0};
+            std::size_t k{0};
+            for(int y = by; y < y1; ++y) {
+                for(int i = bx; i < x1; ++i, ++k) {
+                    pixel[k] = static_cast<std::uint32_t>((y - tile.y0) * tile_width + (i - tile.x0));
+                    if(q.active[pixel[k]]) {active |= std::uint64_t{1} << k;}
+                }
+            }
+            if(!active) continue;
+
+            for(auto s = first; s < last; ++s)
+            {
+                k = 0;
+                for(int y = by; y < y1; ++y) {
+                    for(int i = bx; i < x1; ++i, ++k) {
+                        std::tie(us[k], vs[k]) = SamplePosition(sampler, i, y, s, image.Width(), image.Height());
+                        nodes[k] = PathNode{static_cast<std::uint32_t>(y * image.Width() + i), static_cast<std::uint32_t>(s)};
+                    }
+                }
+
+                const auto packet = cam.GetRayPacket(std::span{us.data(), count}, std::span{vs.data(), count});
+                t_max.fill(std::numeric_limits<float>::max());
+                hits.fill(std::nullopt);
+                scene->HitPacket(packet, active, 0.f, t_max, hits);
+                for(auto rays = active; rays; rays &= rays - 1) {
+                    const auto r{std::countr_zero(rays)};
+                    const auto path = PathRay{packet.GetRay(r), nodes[r], pixel[r]};
+                    if(hits[r]) {q.hits.push_back(PathHit{path, hits[r].value()});}
+                    else {q.pixels[path.pixel] += kBackGroundColor;}
+                }
+            }
+        }
+    }
+}
+
+/// @brief Queues a primary ray for each of samples [first, last) of each active pixel in the tile
+void GeneratePrimaryRays(const Tile& tile, const Camera& cam, const Sampler& sampler, int first, int last, const Framebuffer& image, WavefrontQueues& q)
+{
+    const auto tile_width{tile.x1 - tile.x0};
+    for(int y = tile.y0; y < tile.y1; ++y) {
+        for(int i = tile.x0; i < tile.x1; ++i) {
+            const auto pixel{static_cast<std::uint32_t>((y - tile.y0) * tile_width + (i - tile.x0))};
+            if(!q.active[pixel]) continue;
+            for(auto s = first; s < last; ++s) {
+                const auto [u, v] = SamplePosition(sampler, i, y, s, image.Width(), image.Height());
+                const auto path = PathNode{static_cast<std::uint32_t>(y * image.Width() + i), static_cast<std::uint32_t>(s)};
+                q.rays.push_back(PathRay{cam.GetRay(u,v), path, pixel});
+            }
+        }
+    }
+}
+
+/// @brief Intersects every queued ray with the scene. The rays that hit something are compacted into q.hits;
+/// @brief the others end there and add the background to their pixel.
+void IntersectRays(Hittable* scene, float t_low, WavefrontQueues& q)
+{
+    q.hits.clear();
+    for(const auto& path : q.rays) {
+        if(auto hit = scene->Hit(path.ray, t_low, std::numeric_limits<float>::max()); hit) {
+            q.hits.push_back(PathHit{path, hit.value()});
+        }
+        else {
+            q.pixels[path.pixel] += path.node.throughput * kBackGroundColor;
+        }
+    }
+    q.rays.clear();
+}
+
+/// @brief Counting sort of the indices of q.hits into q.by_type by the type of the material hit, keeping the order within a type
+void GroupByMaterialType(const MaterialTable& materials, WavefrontQueues& q)
+{
+    const auto type_of = [&](const PathHit& h) {return static_cast<std::size_t>(materials[h.hit.mat_id].m_type);};
+
+    std::array<std::size_t, 3> counts{};
+    for(const auto& h : q.hits) {++counts[type_of(h)];}
+
+    std::size_t begin{0};
+    for(std::size_t t = 0; t < counts.size(); ++t) {
+        q.type_begin[t] = begin;
+        begin += counts[t];
+    }
+
+    auto next{q.type_begin};
+    q.by_type.resize(q.hits.size());
+    for(std::size_t i = 0; i < q.hits.size(); ++i) {q.by_type[next[type_of(q.hits[i])]++] = static_cast<std::uint32_t>(i);}
+}
+
+/// @brief Shades every hit of this bounce, one material type at a time. Diffuse hits queue a shadow ray per light, carrying
+/// @brief its Blinn-Phong color; mirror and glass hits queue the rays they spawn for the next bounce, unless the pruner drops them.
+void ShadeHits(const MaterialTable& materials, std::span<const PointLight> lights, int depth, Pruner& pruner, WavefrontQueues& q)
+{
+    GroupByMaterialType(materials, q);
+    const auto group = [&](Material::MaterialType type) {
+        const auto t{static_cast<std::size_t>(type)};
+        const auto end{t + 1 < q.type_begin.size() ? q.type_begin[t + 1] : q.by_type.size()};
+        return std::span{q.by_type}.subspan(q.type_begin[t], end - q.type_begin[t]);
+    };
+
+    q.shadows.clear();
+    for(const auto index : group(Material::MaterialType::DIFFUSE)) {
+        const auto& [path, hit] = q.hits[index];
+        for(const auto& light : lights) {
+            const auto shadow = ShadowRayTo(light, hit.hit_point);
+            const auto color = BlinnPhong(path.ray, hit, materials[hit.mat_id], light);
+            q.shadows.push_back(PathShadow{shadow.ray, shadow.dist_to_light, path.node.throughput * color, path.pixel});
+        }
+    }
+
+    //Same rule as Shade(): rays spawned at depth 1 only add the background, so only deeper ones are pruned
+    const auto queue_spawned = [&](const PathRay& parent, const SpecularRay& spawned, std::uint32_t which) {
+        auto child = parent.node.Child(which, spawned.weight);
+        const auto survival{depth > 1 ? pruner.Survival(child) : 1.f};
+        if(survival == 0.f) return;
+        child.throughput *= survival;
+        q.rays.push_back(PathRay{spawned.ray, child, parent.pixel});
+    };
+
+    for(const auto type : {Material::MaterialType::MIRROR, Material::MaterialType::DIELECTRIC}) {
+        for(const auto index : group(type)) {
+            const auto& [path, hit] = q.hits[index];
+            const auto [reflected, refracted] = SpecularBounce(path.ray, hit, type);
+            queue_spawned(path, reflected, 0);
+            if(refracted) {queue_spawned(path, refracted.value(), 1);}
+        }
+    }
+}
+
+/// @brief Adds the contribution of each shadow ray that reaches its light
+void TraceShadowRays(Hittable* scene, WavefrontQueues& q)
+{
+    for(const auto& shadow : q.shadows) {
+        if(!scene->Occluded(shadow.ray, eps, shadow.dist_to_light)) {q.pixels[shadow.pixel] += shadow.contribution;}
+    }
+}
+
+/// @brief Traces samples [first, last) of every active pixel of the tile to the end, adding their colors to q.pixels
+void TraceSamples(const Tile& tile, const Camera& cam, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights,
+                  const RenderSettings& settings, const Sampler& sampler, const Framebuffer& image, int first, int last, Pruner& pruner, WavefrontQueues& q)
+{
+    q.rays.clear();
+    q.hits.clear();
+
+    if(settings.primary_packets) {
+        TracePrimaryPackets(tile, cam, scene, sampler, first, last, image, q);
+    }
+    else {
+        GeneratePrimaryRays(tile, cam, sampler, first, last, image, q);
+        IntersectRays(scene, 0.f, q);
+    }
+
+    //Same depth rules as RayColor: hits are shaded while depth > 0, and a ray spawned at depth 1 sees the background
+    for(int depth = settings.max_depth; !q.hits.empty(); --depth)
+    {
+        if(depth <= 0) {
+            for(const auto& h : q.hits) {q.pixels[h.path.pixel] += h.path.node.throughput * kBackGroundColor;}
+            break;
+        }
+
+        ShadeHits(materials, lights, depth, pruner, q);
+        TraceShadowRays(scene, q);
+
+        if(depth - 1 <= 0) {
+            for(const auto& path : q.rays) {q.pixels[path.pixel] += path.node.throughput * kBackGroundColor;}
+            break;
+        }
+        IntersectRays(scene, eps, q);
+    }
+}
+
+}
+
+RenderStats RenderTileWavefront(const Tile& tile, const Camera& cam, Hittable* scene, const MaterialTable& materials, std::span<const PointLight> lights,
+                                const RenderSettings& settings, Framebuffer& image, WavefrontQueues& q, std::span<int> sample_counts)
+{
+    Pruner pruner(settings.prune);
+    const auto sampler = MakeSampler(settings.sampler, settings.SamplesPerPass());
+    const auto tile_width{tile.x1 - tile.x0};
+    const auto pixel_count{static_cast<std::size_t>(tile_width) * (tile.y1 - tile.y0)};
+    const auto pixel_at = [&](int i, int y) {return static_cast<std::size_t>((y - tile.y0) * tile_width + (i - tile.x0));};
+    q.active.assign(pixel_count, 1);
+
+    if(!settings.adaptive.enabled) {
+        //All samples of all pixels in one wavefront
+        q.pixels.assign(pixel_count, Color{0.f,0.f,0.f});
+        TraceSamples(tile, cam, scene, materials, lights, settings, *sampler, image, settings.first_sample, settings.first_sample + settings.samples_per_pixel, pruner, q);
+
+        const auto scale{1.f / static_cast<float>(settings.samples_per_pixel)};
+        for(int y = tile.y0; y < tile.y1; ++y) {
+            for(int i = tile.x0; i < tile.x1; ++i) {
+                image.At(i,y) = q.pixels[pixel_at(i,y)] * scale;
+                if(!sample_counts.empty()) {sample_counts[static_cast<std::size_t>(y) * image.Width() + i] = settings.samples_per_pixel;}
+            }
+        }
+        return RenderStats{pruner.Pruned(), pixel_count * static_cast<std::uint64_t>(settings.samples_per_pixel)};
+    }
+
+    //One wavefront per sample, of the pixels that have not converged yet
+    q.estimates.assign(pixel_count, PixelEstimate{});
+    for(auto s = settings.first_sample; s < settings.first_sample + settings.SamplesPerPass(); ++s)
+    {
+        q.pixels.assign(pixel_count, Color{0.f,0.f,0.f});
+        TraceSamples(tile, cam, scene, materials, lights, settings, *sampler, image, s, s + 1, pruner, q);
+
+        for(std::size_t p = 0; p < pixel_count; ++p) {
+            if(q.active[p]) {q.estimates[p].Add(q.pixels[p]);}
+        }
+        if(!UpdateActive(q.estimates, tile_width, tile.y1 - tile.y0, settings.adaptive, q.active)) break;
+    }
+
+    std::uint64_t samples{0};
+    for(int y = tile.y0; y < tile.y1; ++y) {
+        for(int i = tile.x0; i < tile.x1; ++i) {
+            image.At(i,y) = q.estimates[pixel_at(i,y)].Mean();
+            samples += static_cast<std::uint64_t>(q.estimates[pixel_at(i,y)].Count());
+            if(!sample_counts.empty()) {sample_counts[static_cast<std::size_t>(y) * image.Width() + i] = q.estimates[pixel_at(i,y)].Count();}
+        }
+    }
+    return RenderStats{pruner.Pruned(), samples};
+}